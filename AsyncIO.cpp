@@ -0,0 +1,615 @@
+//! @file AsyncIO.cpp
+#include "AsyncIO.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+// POSIX / Linux headers
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace svg
+{
+    namespace
+    {
+        //! Largest transfer per read or write call.
+        const size_t MAX_TRANSFER = 1 << 30;
+        //! Largest number of threads of the thread-pool engine.
+        const size_t MAX_THREADS = 16;
+
+        int read_whole(const std::string &file, std::vector<char> &data)
+        {
+            int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return errno;
+            }
+            struct stat st;
+            int error = ::fstat(fd, &st) == 0 ? 0 : errno;
+            data.resize(error == 0 ? (size_t)st.st_size : 0);
+            size_t done = 0;
+            while (error == 0 && done < data.size())
+            {
+                ssize_t n = ::pread(fd, data.data() + done, std::min(MAX_TRANSFER, data.size() - done), done);
+                if (n < 0 && errno != EINTR)
+                {
+                    error = errno;
+                }
+                else if (n == 0)
+                {
+                    data.resize(done);   // the file shrank
+                }
+                else if (n > 0)
+                {
+                    done += n;
+                }
+            }
+            ::close(fd);
+            return error;
+        }
+
+        int write_whole(const std::string &file, const std::vector<char> &data)
+        {
+            int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                return errno;
+            }
+            int error = 0;
+            size_t done = 0;
+            while (error == 0 && done < data.size())
+            {
+                ssize_t n = ::pwrite(fd, data.data() + done, std::min(MAX_TRANSFER, data.size() - done), done);
+                if (n < 0 && errno != EINTR)
+                {
+                    error = errno;
+                }
+                else if (n > 0)
+                {
+                    done += n;
+                }
+            }
+            if (::close(fd) != 0 && error == 0)
+            {
+                error = errno;
+            }
+            return error;
+        }
+
+        //! Threads doing blocking reads and writes.
+        class ThreadPoolIO : public AsyncIO
+        {
+        public:
+            ThreadPoolIO(size_t depth) : AsyncIO(depth), stopping_(false)
+            {
+                for (size_t i = 0; i < std::min(depth, MAX_THREADS); i++)
+                {
+                    threads_.emplace_back(&ThreadPoolIO::run, this);
+                }
+            }
+            ~ThreadPoolIO()
+            {
+                drain();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                }
+                ready_.notify_all();
+                for (std::thread &t : threads_)
+                {
+                    t.join();
+                }
+            }
+            void read_file(const std::string &file, ReadCallback done) override
+            {
+                submit({false, file, std::vector<char>(), done, WriteCallback()});
+            }
+            void write_file(const std::string &file, std::vector<char> data, WriteCallback done) override
+            {
+                submit({true, file, std::move(data), ReadCallback(), done});
+            }
+            const char *name() const override
+            {
+                return "thread pool";
+            }
+
+        private:
+            void submit(Request request)
+            {
+                begin();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    queue_.push_back(std::move(request));
+                }
+                ready_.notify_one();
+            }
+            void run()
+            {
+                for (;;)
+                {
+                    Request request;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+                        if (queue_.empty())
+                        {
+                            return;
+                        }
+                        request = std::move(queue_.front());
+                        queue_.pop_front();
+                    }
+                    int error = request.write ? write_whole(request.file, request.data)
+                                              : read_whole(request.file, request.data);
+                    complete(request, error);
+                }
+            }
+
+            std::mutex mutex_;
+            std::condition_variable ready_;
+            std::deque<Request> queue_;
+            bool stopping_;
+            std::vector<std::thread> threads_;
+        };
+
+        int io_uring_setup(unsigned entries, io_uring_params *params)
+        {
+            return (int)::syscall(__NR_io_uring_setup, entries, params);
+        }
+
+        int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+        {
+            return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+        }
+
+        //! Check that a ring supports every operation UringIO issues.
+        bool io_uring_supports_ops(int fd)
+        {
+            const uint8_t needed[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                                      IORING_OP_WRITE, IORING_OP_CLOSE};
+            const unsigned slots = 256;
+            std::vector<char> buffer(sizeof(io_uring_probe) + slots * sizeof(io_uring_probe_op), 0);
+            io_uring_probe *probe = (io_uring_probe *)buffer.data();
+            if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, slots) < 0)
+            {
+                return false;   // kernels without probing predate some of them
+            }
+            for (uint8_t op : needed)
+            {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //! One thread driving an io_uring instance. Each request runs as a
+        //! chain of operations (open, statx for reads, read or write until
+        //! done, close), one in flight at a time, and all requests run
+        //! concurrently. An eventfd read stays queued so that the thread,
+        //! waiting for completions, also wakes up for new requests. If the
+        //! ring fails, every pending and later request fails with its error.
+        class UringIO : public AsyncIO
+        {
+        public:
+            UringIO(size_t depth)
+                : AsyncIO(depth), ring_fd_(-1), wake_fd_(-1), sq_ring_(nullptr), cq_ring_(nullptr),
+                  sqes_(nullptr), sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0),
+                  to_submit_(0), wake_value_(0), failed_(0), stopping_(false)
+            {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                ring_fd_ = io_uring_setup((unsigned)depth + 1, &params);
+                if (ring_fd_ < 0)
+                {
+                    throw std::runtime_error(std::string("io_uring unavailable: ") + std::strerror(errno));
+                }
+                if (!io_uring_supports_ops(ring_fd_))
+                {
+                    release();
+                    throw std::runtime_error("io_uring unavailable: file operations not supported");
+                }
+                sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                if (params.features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+                }
+                sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+                sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+                cq_ring_ = params.features & IORING_FEAT_SINGLE_MMAP ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+                sqes_ = (io_uring_sqe *)map(sqes_size_, IORING_OFF_SQES);
+                wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+                if (sq_ring_ == nullptr || cq_ring_ == nullptr || sqes_ == nullptr || wake_fd_ < 0)
+                {
+                    release();
+                    throw std::runtime_error("io_uring unavailable: setup failed");
+                }
+                sq_tail_ = (unsigned *)(sq_ring_ + params.sq_off.tail);
+                sq_mask_ = *(unsigned *)(sq_ring_ + params.sq_off.ring_mask);
+                sq_array_ = (unsigned *)(sq_ring_ + params.sq_off.array);
+                cq_head_ = (unsigned *)(cq_ring_ + params.cq_off.head);
+                cq_tail_ = (unsigned *)(cq_ring_ + params.cq_off.tail);
+                cq_mask_ = *(unsigned *)(cq_ring_ + params.cq_off.ring_mask);
+                cqes_ = (io_uring_cqe *)(cq_ring_ + params.cq_off.cqes);
+                thread_ = std::thread(&UringIO::run, this);
+            }
+            ~UringIO()
+            {
+                drain();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                }
+                wake();
+                thread_.join();
+                release();
+            }
+            void read_file(const std::string &file, ReadCallback done) override
+            {
+                submit({false, file, std::vector<char>(), done, WriteCallback()});
+            }
+            void write_file(const std::string &file, std::vector<char> data, WriteCallback done) override
+            {
+                submit({true, file, std::move(data), ReadCallback(), done});
+            }
+            const char *name() const override
+            {
+                return "io_uring";
+            }
+
+        private:
+            //! A request in flight.
+            struct Op
+            {
+                enum Step { OPEN, STAT, TRANSFER, CLOSE };
+                Request request;
+                Step step;
+                int fd;
+                //! Bytes transferred.
+                size_t done;
+                //! Failure to report once the file is closed.
+                int error;
+                struct statx stat;
+            };
+
+            char *map(size_t size, off_t offset)
+            {
+                void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+                return p == MAP_FAILED ? nullptr : (char *)p;
+            }
+            void release()
+            {
+                if (sqes_ != nullptr)
+                {
+                    ::munmap(sqes_, sqes_size_);
+                }
+                if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+                {
+                    ::munmap(cq_ring_, cq_ring_size_);
+                }
+                if (sq_ring_ != nullptr)
+                {
+                    ::munmap(sq_ring_, sq_ring_size_);
+                }
+                if (wake_fd_ >= 0)
+                {
+                    ::close(wake_fd_);
+                }
+                ::close(ring_fd_);
+            }
+            void submit(Request request)
+            {
+                begin();
+                int error;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    error = failed_;
+                    if (error == 0)
+                    {
+                        queue_.push_back(std::move(request));
+                    }
+                }
+                if (error != 0)
+                {
+                    complete(request, error);
+                    return;
+                }
+                wake();
+            }
+            void wake()
+            {
+                uint64_t one = 1;
+                while (::write(wake_fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+                {
+                }
+            }
+
+            //! Queue an operation (submitted by the next io_uring_enter).
+            io_uring_sqe *push(uint8_t opcode, int fd, Op *op)
+            {
+                unsigned tail = *sq_tail_;
+                unsigned index = tail & sq_mask_;
+                io_uring_sqe *sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = opcode;
+                sqe->fd = fd;
+                sqe->user_data = (uint64_t)(uintptr_t)op;
+                sq_array_[index] = index;
+                __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+                to_submit_++;
+                return sqe;
+            }
+            void arm_wake()
+            {
+                io_uring_sqe *sqe = push(IORING_OP_READ, wake_fd_, nullptr);
+                sqe->addr = (uint64_t)(uintptr_t)&wake_value_;
+                sqe->len = sizeof(wake_value_);
+            }
+            void open(Op *op)
+            {
+                io_uring_sqe *sqe = push(IORING_OP_OPENAT, AT_FDCWD, op);
+                sqe->addr = (uint64_t)(uintptr_t)op->request.file.c_str();
+                sqe->open_flags = op->request.write ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+                sqe->len = 0644;
+            }
+            void transfer(Op *op)
+            {
+                std::vector<char> &data = op->request.data;
+                io_uring_sqe *sqe = push(op->request.write ? IORING_OP_WRITE : IORING_OP_READ, op->fd, op);
+                sqe->addr = (uint64_t)(uintptr_t)(data.data() + op->done);
+                sqe->len = (unsigned)std::min(MAX_TRANSFER, data.size() - op->done);
+                sqe->off = op->done;
+            }
+            void close(Op *op, int error)
+            {
+                op->step = Op::CLOSE;
+                op->error = error;
+                push(IORING_OP_CLOSE, op->fd, op);
+            }
+            void finish(Op *op, int error)
+            {
+                complete(op->request, error);
+                ops_.erase(op);
+                delete op;
+            }
+            //! Stop using the ring after it failed: fail the queued and
+            //! in-flight requests, and every request submitted from now on.
+            void fail(int error)
+            {
+                std::vector<Request> requests;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    failed_ = error;
+                    requests.swap(queue_);
+                }
+                for (Request &request : requests)
+                {
+                    complete(request, error);
+                }
+                for (Op *op : ops_)
+                {
+                    if (op->fd >= 0 && op->step != Op::CLOSE)
+                    {
+                        ::close(op->fd);
+                    }
+                    complete(op->request, error);
+                    delete op;
+                }
+                ops_.clear();
+            }
+
+            //! Move a request on after its last operation completed.
+            //! @param res Result of the operation (negative errno on failure).
+            void advance(Op *op, int res)
+            {
+                bool retry = res == -EINTR || res == -EAGAIN;
+                switch (op->step)
+                {
+                case Op::OPEN:
+                    if (res < 0)
+                    {
+                        finish(op, -res);
+                        break;
+                    }
+                    op->fd = res;
+                    if (op->request.write)
+                    {
+                        op->step = Op::TRANSFER;
+                        op->request.data.empty() ? close(op, 0) : transfer(op);
+                        break;
+                    }
+                    {
+                        op->step = Op::STAT;
+                        io_uring_sqe *sqe = push(IORING_OP_STATX, op->fd, op);
+                        sqe->addr = (uint64_t)(uintptr_t)"";
+                        sqe->len = STATX_SIZE;
+                        sqe->statx_flags = AT_EMPTY_PATH;
+                        sqe->off = (uint64_t)(uintptr_t)&op->stat;
+                    }
+                    break;
+                case Op::STAT:
+                    if (res < 0)
+                    {
+                        close(op, -res);
+                        break;
+                    }
+                    op->request.data.resize(op->stat.stx_size);
+                    op->step = Op::TRANSFER;
+                    op->request.data.empty() ? close(op, 0) : transfer(op);
+                    break;
+                case Op::TRANSFER:
+                    if (retry)
+                    {
+                        transfer(op);
+                    }
+                    else if (res < 0)
+                    {
+                        close(op, -res);
+                    }
+                    else if (res == 0)
+                    {
+                        // A read ends early if the file shrank; a write
+                        // making no progress is an error.
+                        op->request.data.resize(op->done);
+                        close(op, op->request.write ? EIO : 0);
+                    }
+                    else
+                    {
+                        op->done += res;
+                        op->done < op->request.data.size() ? transfer(op) : close(op, 0);
+                    }
+                    break;
+                case Op::CLOSE:
+                    finish(op, op->error != 0 ? op->error : res < 0 ? -res : 0);
+                    break;
+                }
+            }
+
+            void run()
+            {
+                arm_wake();
+                for (;;)
+                {
+                    std::vector<Request> requests;
+                    bool stopping;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        requests.swap(queue_);
+                        stopping = stopping_;
+                    }
+                    for (Request &request : requests)
+                    {
+                        Op *op = new Op();
+                        op->request = std::move(request);
+                        op->step = Op::OPEN;
+                        op->fd = -1;
+                        op->done = 0;
+                        op->error = 0;
+                        ops_.insert(op);
+                        open(op);
+                    }
+                    if (stopping && ops_.empty())
+                    {
+                        return;
+                    }
+                    int submitted = io_uring_enter(ring_fd_, to_submit_, 1, IORING_ENTER_GETEVENTS);
+                    if (submitted < 0)
+                    {
+                        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                        {
+                            continue;
+                        }
+                        // The ring is unusable: nothing is left to wait for.
+                        fail(errno);
+                        return;
+                    }
+                    to_submit_ -= submitted;
+                    unsigned head = *cq_head_;
+                    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+                    {
+                        const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+                        Op *op = (Op *)(uintptr_t)cqe.user_data;
+                        int res = cqe.res;
+                        head++;
+                        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+                        if (op == nullptr)
+                        {
+                            arm_wake();
+                        }
+                        else
+                        {
+                            advance(op, res);
+                        }
+                    }
+                }
+            }
+
+            int ring_fd_, wake_fd_;
+            char *sq_ring_, *cq_ring_;
+            io_uring_sqe *sqes_;
+            size_t sq_ring_size_, cq_ring_size_, sqes_size_;
+            unsigned *sq_tail_, *sq_array_, sq_mask_;
+            unsigned *cq_head_, *cq_tail_, cq_mask_;
+            io_uring_cqe *cqes_;
+            //! Operations queued and not submitted yet.
+            unsigned to_submit_;
+            //! Requests started and not completed (I/O thread only).
+            std::unordered_set<Op *> ops_;
+            uint64_t wake_value_;
+            std::mutex mutex_;
+            std::vector<Request> queue_;
+            //! Error the ring failed with, 0 while it works.
+            int failed_;
+            bool stopping_;
+            std::thread thread_;
+        };
+    }
+
+    std::unique_ptr<AsyncIO> AsyncIO::create(size_t depth, Backend backend)
+    {
+        depth = std::max<size_t>(depth, 1);
+        if (backend != THREAD_POOL)
+        {
+            try
+            {
+                return std::unique_ptr<AsyncIO>(new UringIO(depth));
+            }
+            catch (const std::runtime_error &)
+            {
+                if (backend == IO_URING)
+                {
+                    throw;
+                }
+            }
+        }
+        return std::unique_ptr<AsyncIO>(new ThreadPoolIO(depth));
+    }
+
+    AsyncIO::AsyncIO(size_t depth) : depth_(depth), pending_(0) {}
+
+    void AsyncIO::drain()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+    size_t AsyncIO::depth() const
+    {
+        return depth_;
+    }
+
+    void AsyncIO::begin()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() { return pending_ < depth_; });
+        pending_++;
+    }
+
+    void AsyncIO::complete(Request &request, int error)
+    {
+        if (request.write)
+        {
+            request.on_write(error);
+        }
+        else
+        {
+            request.on_read(request.data, error);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_--;
+        changed_.notify_all();
+    }
+}
@@ -0,0 +1,93 @@
+//! @file AsyncIO.hpp
+#ifndef __svg_AsyncIO_hpp__
+#define __svg_AsyncIO_hpp__
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! Asynchronous whole-file reads and writes, for batch conversion.
+    //! Requests are queued and run in the background, many at a time;
+    //! their callbacks run on an I/O thread, so they must be quick and
+    //! must not queue further requests.
+    class AsyncIO
+    {
+    public:
+        //! I/O engine.
+        enum Backend
+        {
+            AUTO,           //!< io_uring if the kernel supports its file operations, else THREAD_POOL.
+            IO_URING,       //!< One thread driving an io_uring instance.
+            THREAD_POOL     //!< Threads doing blocking pread / pwrite.
+        };
+        //! Called when a read completes.
+        //! @param data File contents (may be moved from).
+        //! @param error 0, or the errno value of the failure.
+        typedef std::function<void(std::vector<char> &data, int error)> ReadCallback;
+        //! Called when a write completes.
+        //! @param error 0, or the errno value of the failure.
+        typedef std::function<void(int error)> WriteCallback;
+
+        //! Create an engine.
+        //! Throws std::runtime_error if IO_URING is requested and unavailable.
+        //! @param depth Largest number of requests in flight; submitting
+        //! more waits for one to complete.
+        //! @param backend Engine to use.
+        //! @return The engine.
+        static std::unique_ptr<AsyncIO> create(size_t depth = 64, Backend backend = AUTO);
+        //! Destructor. Waits for the pending requests.
+        virtual ~AsyncIO() {}
+        //! Queue the read of a whole file.
+        //! @param file File name.
+        //! @param done Completion callback.
+        virtual void read_file(const std::string &file, ReadCallback done) = 0;
+        //! Queue the write of a whole file (created or truncated).
+        //! @param file File name.
+        //! @param data Contents.
+        //! @param done Completion callback.
+        virtual void write_file(const std::string &file, std::vector<char> data, WriteCallback done) = 0;
+        //! Wait until all queued requests have completed.
+        void drain();
+        //! Get the engine name.
+        //! @return "io_uring" or "thread pool".
+        virtual const char *name() const = 0;
+        //! Get the largest number of requests in flight.
+        //! @return Depth.
+        size_t depth() const;
+
+    protected:
+        //! A queued request.
+        struct Request
+        {
+            bool write;
+            std::string file;
+            std::vector<char> data;
+            ReadCallback on_read;
+            WriteCallback on_write;
+        };
+
+        AsyncIO(size_t depth);
+        //! Wait for room, then count a new request.
+        void begin();
+        //! Run a request's callback and uncount it.
+        //! @param error 0, or the errno value of the failure.
+        void complete(Request &request, int error);
+
+    private:
+        AsyncIO(const AsyncIO &) = delete;
+        AsyncIO &operator=(const AsyncIO &) = delete;
+
+        size_t depth_;
+        //! Requests queued and not completed.
+        size_t pending_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+    };
+}
+#endif
@@ -0,0 +1,433 @@
+//! @file BinaryScene.cpp
+#include "BinaryScene.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace svg
+{
+    namespace
+    {
+        const char MAGIC[4] = {'S', 'V', 'G', 'B'};
+
+        //! A double, stored in a vertex entry.
+        Point double_entry(double value)
+        {
+            Point p;
+            std::memcpy(&p, &value, sizeof(value));
+            return p;
+        }
+
+        double entry_double(const Point &p)
+        {
+            double value;
+            std::memcpy(&value, &p, sizeof(value));
+            return value;
+        }
+    }
+
+    void SceneWriter::add_ellipse(const Point &center, const Point &radius, const Color &fill)
+    {
+        svgb::SceneRecord r;
+        r.kind = svgb::ELLIPSE;
+        r.red = fill.red;
+        r.green = fill.green;
+        r.blue = fill.blue;
+        r.a = center.x;
+        r.b = center.y;
+        r.c = radius.x;
+        r.d = radius.y;
+        Point extent = {radius.x < 0 ? -radius.x : radius.x, radius.y < 0 ? -radius.y : radius.y};
+        r.box = {{center.x - extent.x, center.y - extent.y},
+                 {center.x + extent.x, center.y + extent.y}};
+        records_.push_back(r);
+    }
+
+    void SceneWriter::add_polyline(const std::vector<Point> &points, const Color &stroke)
+    {
+        add_points(svgb::POLYLINE, points, stroke);
+    }
+
+    void SceneWriter::add_polygon(const std::vector<Point> &points, const Color &fill)
+    {
+        add_points(svgb::POLYGON, points, fill);
+    }
+
+    void SceneWriter::add_points(svgb::Kind kind, const std::vector<Point> &points, const Color &c)
+    {
+        svgb::SceneRecord r;
+        r.kind = kind;
+        r.red = c.red;
+        r.green = c.green;
+        r.blue = c.blue;
+        r.a = (int32_t)points_.size();
+        r.b = (int32_t)points.size();
+        r.c = r.d = 0;
+        r.box = BoundingBox::none();
+        for (const Point &p : points)
+        {
+            r.box.extend(p);
+        }
+        points_.insert(points_.end(), points.begin(), points.end());
+        records_.push_back(r);
+    }
+
+    void SceneWriter::add_gradient(const Gradient &gradient)
+    {
+        svgb::SceneRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.kind = svgb::GRADIENT;
+        r.a = (int32_t)points_.size();
+        r.b = (int32_t)gradient.stops().size();
+        r.c = gradient.kind();
+        r.box = BoundingBox::none();
+        for (int k = 0; k < 6; k++)
+        {
+            points_.push_back(double_entry(gradient.matrix()[k]));
+        }
+        points_.push_back(gradient.anchor());
+        for (const Gradient::Stop &stop : gradient.stops())
+        {
+            points_.push_back(double_entry(stop.offset));
+            points_.push_back({stop.color.red << 16 | stop.color.green << 8 | stop.color.blue, 0});
+        }
+        records_.push_back(r);
+    }
+
+    void SceneWriter::add_rings(const std::vector<Point> &points, const std::vector<size_t> &ring_ends,
+                                bool even_odd, bool outline, const Color &fill)
+    {
+        add_points(svgb::RINGS, points, fill);
+        svgb::SceneRecord &r = records_.back();
+        r.c = (int32_t)ring_ends.size();
+        r.d = (even_odd ? svgb::RINGS_EVEN_ODD : 0) | (outline ? svgb::RINGS_OUTLINE : 0);
+        for (size_t end : ring_ends)
+        {
+            points_.push_back({(int)end, 0});
+        }
+    }
+
+    size_t SceneWriter::begin_group()
+    {
+        svgb::SceneRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.kind = svgb::GROUP;
+        records_.push_back(r);
+        return records_.size() - 1;
+    }
+
+    void SceneWriter::end_group(size_t group)
+    {
+        svgb::SceneRecord &g = records_[group];
+        g.a = (int32_t)(records_.size() - group - 1);
+        g.box = BoundingBox::none();
+        for (size_t i = group + 1; i < records_.size(); i++)
+        {
+            g.box.extend(records_[i].box);
+        }
+    }
+
+    size_t SceneWriter::begin_clip()
+    {
+        svgb::SceneRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.kind = svgb::CLIP;
+        records_.push_back(r);
+        return records_.size() - 1;
+    }
+
+    void SceneWriter::end_clip_region(size_t clip)
+    {
+        records_[clip].a = (int32_t)(records_.size() - clip - 1);
+    }
+
+    void SceneWriter::end_clip(size_t clip)
+    {
+        svgb::SceneRecord &c = records_[clip];
+        c.b = (int32_t)(records_.size() - clip - 1 - c.a);
+        BoundingBox region = BoundingBox::none(), content = BoundingBox::none();
+        for (size_t i = clip + 1; i < records_.size(); i++)
+        {
+            (i <= clip + c.a ? region : content).extend(records_[i].box);
+        }
+        c.box = BoundingBox::none();
+        if (region.intersects(content))
+        {
+            c.box.min = {std::max(region.min.x, content.min.x), std::max(region.min.y, content.min.y)};
+            c.box.max = {std::min(region.max.x, content.max.x), std::min(region.max.y, content.max.y)};
+        }
+    }
+
+    void SceneWriter::save(const std::string &file_name, const Point &dimensions) const
+    {
+        svgb::SceneHeader h;
+        std::memcpy(h.magic, MAGIC, 4);
+        h.version = svgb::VERSION;
+        h.byte_order = svgb::BYTE_ORDER_MARK;
+        h.width = dimensions.x;
+        h.height = dimensions.y;
+        h.record_count = (uint32_t)records_.size();
+        h.point_count = (uint32_t)points_.size();
+        h.reserved = 0;
+        FILE *f = std::fopen(file_name.c_str(), "wb");
+        if (f == nullptr)
+        {
+            throw std::runtime_error(file_name + ": could not open for writing!");
+        }
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  (records_.empty() ||
+                   std::fwrite(records_.data(), sizeof(svgb::SceneRecord), records_.size(), f) == records_.size()) &&
+                  (points_.empty() ||
+                   std::fwrite(points_.data(), sizeof(Point), points_.size(), f) == points_.size());
+        ok = (std::fclose(f) == 0) && ok;
+        if (!ok)
+        {
+            throw std::runtime_error(file_name + ": could not write scene!");
+        }
+    }
+
+    const uint32_t BinaryScene::NO_CLIP;
+
+    bool BinaryScene::is_binary(const MappedFile &file)
+    {
+        return file.size() >= sizeof(svgb::SceneHeader) &&
+               std::memcmp(file.data(), MAGIC, 4) == 0;
+    }
+
+    BinaryScene::BinaryScene(const std::string &file_name)
+        : file_(MappedFile::open(file_name))
+    {
+        if (!is_binary(*file_))
+        {
+            throw std::runtime_error(file_name + ": not a compiled scene");
+        }
+        header_ = (const svgb::SceneHeader *)file_->data();
+        if (header_->byte_order != svgb::BYTE_ORDER_MARK || header_->version == 0 ||
+            header_->version > svgb::VERSION)
+        {
+            throw std::runtime_error(file_name + ": unsupported scene version or byte order");
+        }
+        size_t records_size = (size_t)header_->record_count * sizeof(svgb::SceneRecord);
+        size_t points_size = (size_t)header_->point_count * sizeof(Point);
+        if (file_->size() != sizeof(svgb::SceneHeader) + records_size + points_size)
+        {
+            throw std::runtime_error(file_name + ": truncated scene");
+        }
+        records_ = (const svgb::SceneRecord *)(file_->data() + sizeof(svgb::SceneHeader));
+        points_ = (const Point *)(file_->data() + sizeof(svgb::SceneHeader) + records_size);
+
+        // Validate once, so that drawing can trust every record, and find
+        // the clip of each record.
+        clip_of_.assign(header_->record_count, NO_CLIP);
+        in_region_.assign(header_->record_count, false);
+        std::vector<std::pair<uint32_t, uint64_t>> open_clips;     // CLIP records, and their end
+        for (uint32_t i = 0; i < header_->record_count; i++)
+        {
+            while (!open_clips.empty() && open_clips.back().second <= i)
+            {
+                open_clips.pop_back();
+            }
+            if (!open_clips.empty())
+            {
+                clip_of_[i] = open_clips.back().first;
+            }
+            const svgb::SceneRecord &r = records_[i];
+            bool valid = true;
+            switch (r.kind)
+            {
+            case svgb::ELLIPSE:
+                break;
+            case svgb::POLYLINE:
+            case svgb::POLYGON:
+                valid = r.a >= 0 && r.b >= 0 && (uint32_t)r.a <= header_->point_count &&
+                        (uint32_t)r.b <= header_->point_count - (uint32_t)r.a;
+                break;
+            case svgb::RINGS:
+                valid = r.a >= 0 && r.b >= 0 && r.c >= 0 && (uint32_t)r.a <= header_->point_count &&
+                        (uint64_t)r.b + (uint64_t)r.c <= header_->point_count - (uint32_t)r.a;
+                // Ring ends must increase up to the vertex count.
+                for (int32_t k = 0, last = 0; valid && k < r.c; k++)
+                {
+                    int32_t end = points_[r.a + r.b + k].x;
+                    valid = end >= last && end <= r.b && (k + 1 < r.c || end == r.b);
+                    last = end;
+                }
+                break;
+            case svgb::GROUP:
+                valid = r.a >= 0 && (uint32_t)r.a < header_->record_count - i;
+                break;
+            case svgb::GRADIENT:
+                valid = r.a >= 0 && r.b >= 0 && (r.c == Gradient::LINEAR || r.c == Gradient::RADIAL) &&
+                        (uint32_t)r.a <= header_->point_count &&
+                        7 + 2 * (uint64_t)r.b <= header_->point_count - (uint32_t)r.a &&
+                        i + 1 < header_->record_count &&
+                        (records_[i + 1].kind == svgb::ELLIPSE || records_[i + 1].kind == svgb::POLYGON ||
+                         records_[i + 1].kind == svgb::RINGS);
+                if (valid)
+                {
+                    double matrix[6];
+                    for (int k = 0; k < 6; k++)
+                    {
+                        matrix[k] = entry_double(points_[r.a + k]);
+                    }
+                    std::vector<Gradient::Stop> stops;
+                    for (int32_t k = 0; k < r.b; k++)
+                    {
+                        int32_t rgb = points_[r.a + 7 + 2 * k + 1].x;
+                        stops.push_back({entry_double(points_[r.a + 7 + 2 * k]),
+                                         {(rgb_value)(rgb >> 16), (rgb_value)(rgb >> 8), (rgb_value)rgb}});
+                    }
+                    gradients_[i + 1] = Gradient::from_matrix((Gradient::Kind)r.c, matrix, points_[r.a + 6], stops);
+                }
+                break;
+            case svgb::CLIP:
+            {
+                uint64_t end = (uint64_t)i + 1 + (uint64_t)r.a + (uint64_t)r.b;
+                // Clips nest, and their regions hold shapes only.
+                valid = r.a >= 0 && r.b >= 0 && end <= header_->record_count &&
+                        (open_clips.empty() || end <= open_clips.back().second);
+                for (uint32_t k = i + 1; valid && k <= i + (uint32_t)r.a; k++)
+                {
+                    uint8_t kind = records_[k].kind;
+                    valid = kind == svgb::ELLIPSE || kind == svgb::POLYGON || kind == svgb::RINGS ||
+                            kind == svgb::GRADIENT;
+                    in_region_[k] = true;
+                }
+                open_clips.push_back({i, end});
+                break;
+            }
+            default:
+                valid = false;
+            }
+            if (!valid)
+            {
+                throw std::runtime_error(file_name + ": corrupt scene record");
+            }
+        }
+    }
+
+    Point BinaryScene::dimensions() const
+    {
+        return {header_->width, header_->height};
+    }
+
+    void BinaryScene::draw(PNGImage &img) const
+    {
+        std::vector<uint32_t> clips;
+        if (img.front_to_back())
+        {
+            // Records are in painter's order, so walking them backwards
+            // visits the elements topmost first; groups and clips draw
+            // nothing by themselves.
+            for (uint32_t i = header_->record_count; i-- > 0;)
+            {
+                const svgb::SceneRecord &r = records_[i];
+                if (r.kind != svgb::GROUP && r.kind != svgb::CLIP && !in_region_[i] && !img.covered(r.box))
+                {
+                    set_clips(img, clips, clip_of_[i]);
+                    draw_record(img, i);
+                }
+            }
+            set_clips(img, clips, NO_CLIP);
+            return;
+        }
+        BoundingBox bounds = img.bounds();
+        for (uint32_t i = 0; i < header_->record_count; i++)
+        {
+            const svgb::SceneRecord &r = records_[i];
+            if (!r.box.intersects(bounds))
+            {
+                if (r.kind == svgb::GROUP)
+                {
+                    i += r.a;
+                }
+                else if (r.kind == svgb::CLIP)
+                {
+                    i += r.a + r.b;
+                }
+                continue;
+            }
+            if (r.kind == svgb::CLIP)
+            {
+                // The region is drawn when a clipped record is.
+                i += r.a;
+                continue;
+            }
+            set_clips(img, clips, clip_of_[i]);
+            draw_record(img, i);
+        }
+        set_clips(img, clips, NO_CLIP);
+    }
+
+    void BinaryScene::set_clips(PNGImage &img, std::vector<uint32_t> &clips, uint32_t clip) const
+    {
+        if (clip == (clips.empty() ? NO_CLIP : clips.back()))
+        {
+            return;
+        }
+        std::vector<uint32_t> chain;    // from the outermost clip to clip
+        for (uint32_t c = clip; c != NO_CLIP; c = clip_of_[c])
+        {
+            chain.push_back(c);
+        }
+        std::reverse(chain.begin(), chain.end());
+        size_t keep = 0;
+        while (keep < clips.size() && keep < chain.size() && clips[keep] == chain[keep])
+        {
+            keep++;
+        }
+        for (; clips.size() > keep; clips.pop_back())
+        {
+            img.pop_clip();
+        }
+        for (; keep < chain.size(); keep++)
+        {
+            uint32_t c = chain[keep];
+            img.begin_clip();
+            for (uint32_t k = c + 1; k <= c + (uint32_t)records_[c].a; k++)
+            {
+                draw_record(img, k);
+            }
+            img.end_clip();
+            clips.push_back(c);
+        }
+    }
+
+    void BinaryScene::draw_record(PNGImage &img, uint32_t i) const
+    {
+        const svgb::SceneRecord &r = records_[i];
+        Color c = {r.red, r.green, r.blue};
+        auto gradient = gradients_.find(i);
+        img.set_gradient(gradient != gradients_.end() ? &gradient->second : nullptr);
+        switch (r.kind)
+        {
+        case svgb::ELLIPSE:
+            img.draw_ellipse({r.a, r.b}, {r.c, r.d}, c);
+            break;
+        case svgb::POLYLINE:
+            img.draw_polyline(points_ + r.a, r.b, c);
+            break;
+        case svgb::POLYGON:
+            img.draw_polygon(points_ + r.a, r.b, c);
+            break;
+        case svgb::RINGS:
+        {
+            std::vector<size_t> ring_ends(r.c);
+            for (int32_t k = 0; k < r.c; k++)
+            {
+                ring_ends[k] = points_[r.a + r.b + k].x;
+            }
+            img.draw_rings(points_ + r.a, ring_ends.data(), ring_ends.size(),
+                           (r.d & svgb::RINGS_EVEN_ODD) != 0, (r.d & svgb::RINGS_OUTLINE) != 0, c);
+            break;
+        }
+        default:
+            // Group and clip members follow as ordinary records;
+            // gradients are drawn with the record they fill.
+            break;
+        }
+        img.set_gradient(nullptr);
+    }
+}
@@ -0,0 +1,181 @@
+//! @file BinaryScene.hpp
+#ifndef __svg_BinaryScene_hpp__
+#define __svg_BinaryScene_hpp__
+
+#include "Color.hpp"
+#include "Gradient.hpp"
+#include "Point.hpp"
+#include "PNGImage.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace svg
+{
+    //! Compiled scene file format (.svgb), version 4.
+    //!
+    //! A little-endian file made of a SceneHeader, an array of SceneRecord
+    //! in painter's order and an array of 32-bit (x, y) vertex pairs.
+    //! Geometry is stored after transformations and <use> resolution, so a
+    //! scene can be drawn straight from a read-only mapping of the file.
+    namespace svgb
+    {
+        //! RINGS flag: fill with the even-odd rule instead of nonzero.
+        const int32_t RINGS_EVEN_ODD = 1;
+        //! RINGS flag: also draw the rings' edges.
+        const int32_t RINGS_OUTLINE = 2;
+        //! Format version written by SceneWriter.
+        const uint32_t VERSION = 4;
+        //! Value of SceneHeader::byte_order as written on this host.
+        const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+        //! Record kinds.
+        enum Kind : uint8_t
+        {
+            //! Ellipse: a, b = center; c, d = radius.
+            ELLIPSE = 1,
+            //! Polyline: a = first vertex, b = vertex count.
+            POLYLINE = 2,
+            //! Polygon: a = first vertex, b = vertex count.
+            POLYGON = 3,
+            //! Group: a = number of records that follow and belong to it.
+            GROUP = 4,
+            //! Polygon with several rings (since version 2): a = first
+            //! vertex, b = vertex count, c = ring count, d = RINGS_* flags.
+            //! The c vertex entries after the b vertices hold the end
+            //! index of each ring in x (relative to a).
+            RINGS = 5,
+            //! Gradient filling the next record, an ellipse, polygon or
+            //! rings (since version 3): a = first vertex entry, b = stop
+            //! count, c = Gradient::Kind. The entries hold the 6 doubles
+            //! of Gradient::matrix, the anchor, then an offset (a double)
+            //! and a color (0xRRGGBB in x) per stop. Its box is empty.
+            GRADIENT = 6,
+            //! Clip (since version 4): the a records that follow make the
+            //! clip region (ellipses, polygons, rings, and their gradients,
+            //! whose colors do not matter), and the b records after them are
+            //! drawn clipped to it. Its box is where both overlap.
+            CLIP = 7
+        };
+
+        //! File header.
+        struct SceneHeader
+        {
+            char magic[4];
+            uint32_t version;
+            uint32_t byte_order;
+            int32_t width;
+            int32_t height;
+            uint32_t record_count;
+            uint32_t point_count;
+            uint32_t reserved;
+        };
+
+        //! One element.
+        struct SceneRecord
+        {
+            uint8_t kind;
+            //! Fill or stroke color.
+            uint8_t red, green, blue;
+            //! Kind-specific values.
+            int32_t a, b, c, d;
+            //! Area the element (or group) may draw to.
+            BoundingBox box;
+        };
+
+        static_assert(sizeof(SceneHeader) == 32, "unexpected svgb header layout");
+        static_assert(sizeof(SceneRecord) == 36, "unexpected svgb record layout");
+        static_assert(sizeof(Point) == 8, "svgb vertices are mapped as Point");
+    }
+
+    //! Builds a compiled scene, see SVGElement::serialize.
+    class SceneWriter
+    {
+    public:
+        //! Add an ellipse.
+        void add_ellipse(const Point &center, const Point &radius, const Color &fill);
+        //! Add a polyline.
+        void add_polyline(const std::vector<Point> &points, const Color &stroke);
+        //! Add a polygon.
+        void add_polygon(const std::vector<Point> &points, const Color &fill);
+        //! Fill the next element added with a gradient.
+        void add_gradient(const Gradient &gradient);
+        //! Add a polygon with several rings (see PNGImage::draw_rings).
+        void add_rings(const std::vector<Point> &points, const std::vector<size_t> &ring_ends,
+                       bool even_odd, bool outline, const Color &fill);
+        //! Start a group; elements added until end_group belong to it.
+        //! @return Group handle.
+        size_t begin_group();
+        //! Close a group.
+        //! @param group Handle returned by begin_group.
+        void end_group(size_t group);
+        //! Start a clip; elements added until end_clip_region make its
+        //! region, those added after them until end_clip are clipped.
+        //! @return Clip handle.
+        size_t begin_clip();
+        //! Close the region of a clip.
+        //! @param clip Handle returned by begin_clip.
+        void end_clip_region(size_t clip);
+        //! Close a clip.
+        //! @param clip Handle returned by begin_clip.
+        void end_clip(size_t clip);
+        //! Write the scene to a file.
+        //! Throws std::runtime_error if the file can not be written.
+        //! @param file_name Output file name.
+        //! @param dimensions Canvas width and height.
+        void save(const std::string &file_name, const Point &dimensions) const;
+
+    private:
+        void add_points(svgb::Kind kind, const std::vector<Point> &points, const Color &c);
+
+        std::vector<svgb::SceneRecord> records_;
+        std::vector<Point> points_;
+    };
+
+    //! Read-only view of a compiled scene file.
+    class BinaryScene
+    {
+    public:
+        //! Map and validate a compiled scene.
+        //! Throws std::runtime_error if the file is not a valid scene.
+        //! @param file_name File name.
+        BinaryScene(const std::string &file_name);
+        //! Check if mapped contents hold a compiled scene.
+        //! @param file Mapped file.
+        //! @return True if the file starts with the svgb magic.
+        static bool is_binary(const MappedFile &file);
+        //! Get the canvas dimensions.
+        //! @return Width and height.
+        Point dimensions() const;
+        //! Draw the scene, skipping elements and groups that miss the image.
+        //! @param img Image to draw to.
+        void draw(PNGImage &img) const;
+
+    private:
+        //! Draw a single element record.
+        //! @param i Record index.
+        void draw_record(PNGImage &img, uint32_t i) const;
+        //! Set the clip regions of a record on an image.
+        //! @param clips CLIP records whose regions are set, outermost
+        //! first; updated.
+        //! @param clip Innermost CLIP record of the record (see clip_of_).
+        void set_clips(PNGImage &img, std::vector<uint32_t> &clips, uint32_t clip) const;
+
+        std::shared_ptr<const MappedFile> file_;
+        const svgb::SceneHeader *header_;
+        const svgb::SceneRecord *records_;
+        const Point *points_;
+        //! Gradients, by the index of the record they fill.
+        std::unordered_map<uint32_t, Gradient> gradients_;
+        //! Innermost CLIP record clipping each record, or NO_CLIP.
+        std::vector<uint32_t> clip_of_;
+        //! Records that belong to a clip region (and are not drawn).
+        std::vector<bool> in_region_;
+        static const uint32_t NO_CLIP = 0xFFFFFFFF;
+    };
+}
+#endif
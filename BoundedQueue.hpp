@@ -0,0 +1,86 @@
+//! @file BoundedQueue.hpp
+#ifndef __svg_BoundedQueue_hpp__
+#define __svg_BoundedQueue_hpp__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace svg
+{
+    //! Fixed-capacity queue between producer and consumer threads.
+    //! Producers wait while it is full, consumers while it is empty and
+    //! not closed yet.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        //! Constructor.
+        //! @param capacity Largest number of queued items (at least 1).
+        explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+        //! Add an item, waiting for room.
+        //! @param item Item.
+        //! @return Seconds spent waiting.
+        double push(T item)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            double waited = wait(lock, not_full_, [this]() { return items_.size() < capacity_; });
+            items_.push_back(std::move(item));
+            not_empty_.notify_one();
+            return waited;
+        }
+
+        //! Take the oldest item, waiting for one.
+        //! @param item Receives the item.
+        //! @param waited Receives the seconds spent waiting.
+        //! @return False once the queue is closed and empty.
+        bool pop(T &item, double &waited)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            waited = wait(lock, not_empty_, [this]() { return !items_.empty() || closed_; });
+            if (items_.empty())
+            {
+                return false;
+            }
+            item = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        //! Signal that no more items will be pushed.
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+        }
+
+    private:
+        template <typename Ready>
+        static double wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, Ready ready)
+        {
+            if (ready())
+            {
+                return 0;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            cv.wait(lock, ready);
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        BoundedQueue(const BoundedQueue &) = delete;
+        BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+        std::mutex mutex_;
+        std::condition_variable not_full_, not_empty_;
+        std::deque<T> items_;
+        size_t capacity_;
+        bool closed_;
+    };
+}
+#endif
@@ -0,0 +1,337 @@
+//! @file Gradient.cpp
+#include "Gradient.hpp"
+
+#include <algorithm>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace svg
+{
+    namespace
+    {
+        //! Fixed-point positions per unit of gradient space: 255 ramp
+        //! entries of 65536 steps.
+        const double RAMP_UNIT = 255.0 * 65536.0;
+        //! Largest step per device pixel, so that positions stay in 64 bits.
+        const double STEP_LIMIT = (double)((int64_t)1 << 36);
+        //! Positions within this bound are stepped in 32-bit lanes.
+        const int64_t LANE_LIMIT = (int64_t)1 << 30;
+
+        int64_t fixed(double x)
+        {
+            return ::llround(std::max(-STEP_LIMIT, std::min(STEP_LIMIT, x)));
+        }
+
+        bool in_lane(int64_t x)
+        {
+            return x > -LANE_LIMIT && x < LANE_LIMIT;
+        }
+
+        int32_t clamp_lane(int64_t x)
+        {
+            return (int32_t)std::max(-LANE_LIMIT, std::min(LANE_LIMIT, x));
+        }
+
+#ifdef __SSE2__
+        //! Ramp entries of 8 pixels, from their positions in two vectors
+        //! of 4 lanes each: rounded and saturated to 0..255.
+        void ramp_entries(bool radial, __m128i u_lo, __m128i u_hi, __m128i v_lo, __m128i v_hi,
+                          unsigned char *entries)
+        {
+            __m128i lo, hi;
+            if (radial)
+            {
+                const __m128 unit = _mm_set1_ps(1.0f / 65536), past_end = _mm_set1_ps(256.0f);
+                __m128 u = _mm_cvtepi32_ps(u_lo), v = _mm_cvtepi32_ps(v_lo);
+                __m128 t = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v))), unit);
+                lo = _mm_cvtps_epi32(_mm_min_ps(t, past_end));
+                u = _mm_cvtepi32_ps(u_hi);
+                v = _mm_cvtepi32_ps(v_hi);
+                t = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v))), unit);
+                hi = _mm_cvtps_epi32(_mm_min_ps(t, past_end));
+            }
+            else
+            {
+                const __m128i half = _mm_set1_epi32(0x8000);
+                lo = _mm_srai_epi32(_mm_add_epi32(u_lo, half), 16);
+                hi = _mm_srai_epi32(_mm_add_epi32(u_hi, half), 16);
+            }
+            // Saturate to 16 bits, then to 0..255.
+            __m128i words = _mm_packs_epi32(lo, hi);
+            _mm_storel_epi64((__m128i *)entries, _mm_packus_epi16(words, words));
+        }
+#else
+        //! Ramp entries of 8 pixels, as the SSE2 version computes them.
+        void ramp_entries(bool radial, const int32_t *u, const int32_t *v, unsigned char *entries)
+        {
+            for (int k = 0; k < 8; k++)
+            {
+                long e;
+                if (radial)
+                {
+                    float fu = (float)u[k], fv = (float)v[k];
+                    e = ::lrintf(std::min(std::sqrt(fu * fu + fv * fv) * (1.0f / 65536), 256.0f));
+                }
+                else
+                {
+                    e = (u[k] + 0x8000) >> 16;
+                }
+                entries[k] = (unsigned char)std::max(0L, std::min(255L, e));
+            }
+        }
+#endif
+    }
+
+    void SpanShader::shade(Color *out, int x, int y, int n) const
+    {
+        int64_t u = u0 + x * u_dx + y * u_dy;
+        int64_t v = v0 + x * v_dx + y * v_dy;
+        // Pixels go 8 at a time; when the positions of every lane fit in
+        // 32 bits, they are stepped incrementally, else computed in 64 bits
+        // and clamped (far enough to give the same ramp entry).
+        int64_t last = ((n + 7) & ~7) - 1;
+        bool stepped = in_lane(u) && in_lane(u + last * u_dx) && in_lane(v) && in_lane(v + last * v_dx);
+        alignas(16) int32_t lane_u[8], lane_v[8];
+        for (int k = 0; k < 8; k++)
+        {
+            lane_u[k] = clamp_lane(u + k * u_dx);
+            lane_v[k] = clamp_lane(v + k * v_dx);
+        }
+        unsigned char entries[8];
+#ifdef __SSE2__
+        __m128i u_lo = _mm_load_si128((const __m128i *)lane_u), u_hi = _mm_load_si128((const __m128i *)(lane_u + 4));
+        __m128i v_lo = _mm_load_si128((const __m128i *)lane_v), v_hi = _mm_load_si128((const __m128i *)(lane_v + 4));
+        __m128i u_step = _mm_set1_epi32((int32_t)(8 * u_dx)), v_step = _mm_set1_epi32((int32_t)(8 * v_dx));
+#endif
+        for (int i = 0; i < n; i += 8)
+        {
+            if (i > 0)
+            {
+                if (stepped)
+                {
+#ifdef __SSE2__
+                    u_lo = _mm_add_epi32(u_lo, u_step);
+                    u_hi = _mm_add_epi32(u_hi, u_step);
+                    v_lo = _mm_add_epi32(v_lo, v_step);
+                    v_hi = _mm_add_epi32(v_hi, v_step);
+#else
+                    for (int k = 0; k < 8; k++)
+                    {
+                        lane_u[k] += (int32_t)(8 * u_dx);
+                        lane_v[k] += (int32_t)(8 * v_dx);
+                    }
+#endif
+                }
+                else
+                {
+                    for (int k = 0; k < 8; k++)
+                    {
+                        lane_u[k] = clamp_lane(u + (i + k) * u_dx);
+                        lane_v[k] = clamp_lane(v + (i + k) * v_dx);
+                    }
+#ifdef __SSE2__
+                    u_lo = _mm_load_si128((const __m128i *)lane_u);
+                    u_hi = _mm_load_si128((const __m128i *)(lane_u + 4));
+                    v_lo = _mm_load_si128((const __m128i *)lane_v);
+                    v_hi = _mm_load_si128((const __m128i *)(lane_v + 4));
+#endif
+                }
+            }
+#ifdef __SSE2__
+            ramp_entries(radial, u_lo, u_hi, v_lo, v_hi, entries);
+#else
+            ramp_entries(radial, lane_u, lane_v, entries);
+#endif
+            int m = std::min(8, n - i);
+            for (int k = 0; k < m; k++)
+            {
+                out[i + k] = colors[entries[k]];
+            }
+        }
+    }
+
+    Gradient::Gradient() : kind_(LINEAR), matrix_{0, 0, 0, 0, 0, 0}, anchor_{0, 0}
+    {
+    }
+
+    Gradient::Gradient(Kind kind, const std::vector<Stop> &stops)
+        : kind_(kind), matrix_{0, 0, 0, 0, 0, 0}, anchor_{0, 0}
+    {
+        // Offsets are clamped to [0, 1] and never decrease (an offset
+        // below the previous one takes its value).
+        std::shared_ptr<Ramp> ramp = std::make_shared<Ramp>();
+        double previous = 0;
+        for (const Stop &stop : stops)
+        {
+            previous = std::max(previous, std::min(1.0, stop.offset));
+            ramp->stops.push_back({previous, stop.color});
+        }
+        const std::vector<Stop> &s = ramp->stops;
+        size_t k = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            double t = i / 255.0;
+            while (k < s.size() && s[k].offset <= t)
+            {
+                k++;
+            }
+            if (s.empty())
+            {
+                ramp->colors[i] = {0, 0, 0};
+            }
+            else if (k == 0 || k == s.size())
+            {
+                ramp->colors[i] = s[k == 0 ? 0 : k - 1].color;
+            }
+            else
+            {
+                // Between stops k - 1 and k.
+                const Stop &a = s[k - 1], &b = s[k];
+                double f = (t - a.offset) / (b.offset - a.offset);
+                ramp->colors[i] = {(rgb_value)::lround(a.color.red + f * (b.color.red - a.color.red)),
+                                   (rgb_value)::lround(a.color.green + f * (b.color.green - a.color.green)),
+                                   (rgb_value)::lround(a.color.blue + f * (b.color.blue - a.color.blue))};
+            }
+        }
+        ramp_ = ramp;
+    }
+
+    Gradient Gradient::linear(double x1, double y1, double x2, double y2, const std::vector<Stop> &stops)
+    {
+        Gradient g(LINEAR, stops);
+        double dx = x2 - x1, dy = y2 - y1, length2 = dx * dx + dy * dy;
+        if (length2 == 0)
+        {
+            // The last stop's color everywhere.
+            g.matrix_[4] = 1;
+            return g;
+        }
+        g.matrix_[0] = dx / length2;
+        g.matrix_[2] = dy / length2;
+        g.matrix_[4] = -(x1 * dx + y1 * dy) / length2;
+        return g;
+    }
+
+    Gradient Gradient::radial(double cx, double cy, double r, const std::vector<Stop> &stops)
+    {
+        Gradient g(RADIAL, stops);
+        if (r <= 0)
+        {
+            g.matrix_[4] = 1;
+            return g;
+        }
+        g.matrix_[0] = g.matrix_[3] = 1 / r;
+        g.matrix_[4] = -cx / r;
+        g.matrix_[5] = -cy / r;
+        return g;
+    }
+
+    Gradient Gradient::from_matrix(Kind kind, const double matrix[6], const Point &anchor,
+                                   const std::vector<Stop> &stops)
+    {
+        Gradient g(kind, stops);
+        std::copy(matrix, matrix + 6, g.matrix_);
+        g.anchor_ = anchor;
+        return g;
+    }
+
+    bool Gradient::empty() const
+    {
+        return ramp_ == nullptr;
+    }
+
+    Gradient::Kind Gradient::kind() const
+    {
+        return kind_;
+    }
+
+    const std::vector<Gradient::Stop> &Gradient::stops() const
+    {
+        return ramp_->stops;
+    }
+
+    const double *Gradient::matrix() const
+    {
+        return matrix_;
+    }
+
+    Point Gradient::anchor() const
+    {
+        return anchor_;
+    }
+
+    void Gradient::transform_inverse(const double l[6])
+    {
+        double *m = matrix_;
+        // Where the anchor was, relative to it.
+        double qx = l[0] * anchor_.x + l[2] * anchor_.y + l[4] - anchor_.x;
+        double qy = l[1] * anchor_.x + l[3] * anchor_.y + l[5] - anchor_.y;
+        double r[6] = {m[0] * l[0] + m[2] * l[1], m[1] * l[0] + m[3] * l[1],
+                       m[0] * l[2] + m[2] * l[3], m[1] * l[2] + m[3] * l[3],
+                       m[4] + m[0] * qx + m[2] * qy, m[5] + m[1] * qx + m[3] * qy};
+        std::copy(r, r + 6, matrix_);
+    }
+
+    void Gradient::fit(const BoundingBox &box)
+    {
+        if (empty() || box.empty())
+        {
+            return;
+        }
+        double w = (double)box.max.x - box.min.x + 1, h = (double)box.max.y - box.min.y + 1;
+        double l[6] = {1 / w, 0, 0, 1 / h, -box.min.x / w, -box.min.y / h};
+        transform_inverse(l);
+    }
+
+    void Gradient::translate(const Point &t)
+    {
+        anchor_ = anchor_.translate(t);
+    }
+
+    void Gradient::rotate(int degrees, const Point &origin)
+    {
+        if (empty())
+        {
+            return;
+        }
+        double angle = M_PI * degrees / 180.0;
+        double s = ::sin(angle), c = ::cos(angle);
+        double l[6] = {c, -s, s, c,
+                       origin.x - (c * origin.x + s * origin.y),
+                       origin.y - (-s * origin.x + c * origin.y)};
+        transform_inverse(l);
+    }
+
+    void Gradient::scale(int v, const Point &origin)
+    {
+        if (empty() || v == 0)
+        {
+            return;
+        }
+        double l[6] = {1.0 / v, 0, 0, 1.0 / v, origin.x - origin.x / (double)v, origin.y - origin.y / (double)v};
+        transform_inverse(l);
+    }
+
+    SpanShader Gradient::shader(double scale) const
+    {
+        SpanShader s = {nullptr, kind_ == RADIAL, 0, 0, 0, 0, 0, 0};
+        if (empty())
+        {
+            return s;
+        }
+        s.colors = ramp_->colors;
+        const double *m = matrix_;
+        s.u_dx = fixed(RAMP_UNIT * m[0] / scale);
+        s.u_dy = fixed(RAMP_UNIT * m[2] / scale);
+        s.v_dx = fixed(RAMP_UNIT * m[1] / scale);
+        s.v_dy = fixed(RAMP_UNIT * m[3] / scale);
+        // Relative to the anchor's device pixel, so that moving the anchor
+        // by whole pixels moves every position exactly.
+        int64_t ax = ::llround(anchor_.x * scale), ay = ::llround(anchor_.y * scale);
+        s.u0 = fixed(RAMP_UNIT * m[4]) - ax * s.u_dx - ay * s.u_dy;
+        s.v0 = fixed(RAMP_UNIT * m[5]) - ax * s.v_dx - ay * s.v_dy;
+        return s;
+    }
+}
@@ -0,0 +1,112 @@
+//! @file Gradient.hpp
+#ifndef __svg_Gradient_hpp__
+#define __svg_Gradient_hpp__
+
+#include "Color.hpp"
+#include "Point.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace svg
+{
+    //! A gradient in device pixels, ready to shade spans (see
+    //! Gradient::shader). Positions are fixed point, in 1/65536 of a
+    //! ramp entry, and step exactly from pixel to pixel, so a pixel gets
+    //! the same color whatever span (band, window) it is drawn in.
+    struct SpanShader
+    {
+        //! Ramp of 256 colors, or nullptr when no gradient is set.
+        const Color *colors;
+        //! True for a radial gradient (ramp entry = distance from (u, v)
+        //! to the origin), false for a linear one (ramp entry = u).
+        bool radial;
+        //! u and v at device pixel (0, 0), and their steps along x and y.
+        int64_t u0, u_dx, u_dy;
+        int64_t v0, v_dx, v_dy;
+
+        //! Shade a span of a row.
+        //! @param out Receives the colors.
+        //! @param x Device x of the first pixel.
+        //! @param y Device y of the row.
+        //! @param n Number of pixels.
+        void shade(Color *out, int x, int y, int n) const;
+    };
+
+    //! A linear or radial gradient fill (<linearGradient>,
+    //! <radialGradient>), mapped to canvas coordinates. The stops are
+    //! resolved once into a ramp of 256 colors shared by all copies, so
+    //! gradients are cheap to copy and transform with their elements.
+    //! Focal points, spread methods other than pad and gradient
+    //! transforms are not supported.
+    class Gradient
+    {
+    public:
+        //! A color stop.
+        struct Stop
+        {
+            //! Position on the gradient, from 0 to 1.
+            double offset;
+            Color color;
+        };
+        //! Gradient shape.
+        enum Kind { LINEAR, RADIAL };
+
+        //! Constructor of an empty gradient, which fills nothing (elements
+        //! use their plain fill color instead).
+        Gradient();
+        //! Linear gradient, from stop 0 at (x1, y1) to stop 1 at (x2, y2).
+        static Gradient linear(double x1, double y1, double x2, double y2, const std::vector<Stop> &stops);
+        //! Radial gradient, from stop 0 at the center to stop 1 at radius r.
+        static Gradient radial(double cx, double cy, double r, const std::vector<Stop> &stops);
+        //! Gradient of a compiled scene (see matrix and anchor).
+        static Gradient from_matrix(Kind kind, const double matrix[6], const Point &anchor,
+                                    const std::vector<Stop> &stops);
+        //! Check if the gradient is empty.
+        //! @return True for the default gradient.
+        bool empty() const;
+        //! Get the gradient shape.
+        Kind kind() const;
+        //! Get the stops, in order of offset.
+        const std::vector<Stop> &stops() const;
+        //! Get the map from canvas coordinates to gradient space:
+        //! u = m[0] (x - anchor.x) + m[2] (y - anchor.y) + m[4], and
+        //! v = m[1] (x - anchor.x) + m[3] (y - anchor.y) + m[5].
+        const double *matrix() const;
+        //! Get the anchor point, which integer translations move exactly.
+        Point anchor() const;
+        //! Map gradient coordinates given in a box's units
+        //! (gradientUnits="objectBoundingBox") to the box.
+        //! @param box Pixels the element covers.
+        void fit(const BoundingBox &box);
+        //! Transform the gradient as its element's vertices (see Point).
+        void translate(const Point &t);
+        void rotate(int degrees, const Point &origin);
+        void scale(int v, const Point &origin);
+        //! Get the shader of the gradient at a scale.
+        //! @param scale Scale applied to canvas coordinates.
+        //! @return Shader, inactive for an empty gradient.
+        SpanShader shader(double scale) const;
+
+    private:
+        //! Stops, and the ramp built from them.
+        struct Ramp
+        {
+            std::vector<Stop> stops;
+            Color colors[256];
+        };
+
+        Gradient(Kind kind, const std::vector<Stop> &stops);
+        //! Apply an affine map to the gradient's content, given by its
+        //! inverse: canvas point p was at (l[0] p.x + l[2] p.y + l[4],
+        //! l[1] p.x + l[3] p.y + l[5]) before.
+        void transform_inverse(const double l[6]);
+
+        Kind kind_;
+        double matrix_[6];
+        Point anchor_;
+        std::shared_ptr<const Ramp> ramp_;
+    };
+}
+#endif
@@ -0,0 +1,123 @@
+//! @file Gzip.cpp
+#include "Gzip.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+
+// Declarations only: the implementation is compiled in PNGImage.cpp.
+#include "external/stb/stb_image.h"
+
+namespace svg
+{
+    namespace
+    {
+        // Header flags (RFC 1952).
+        const unsigned char FHCRC = 2, FEXTRA = 4, FNAME = 8, FCOMMENT = 16;
+
+        // Bounds on the initial output buffer, from the compressed size.
+        const size_t MIN_HINT = 64 * 1024, MAX_HINT_RATIO = 16;
+
+        uint32_t read_le32(const unsigned char *p)
+        {
+            return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        }
+
+        //! CRC-32 (IEEE) lookup table.
+        struct CrcTable
+        {
+            uint32_t entries[256];
+            CrcTable()
+            {
+                for (uint32_t n = 0; n < 256; n++)
+                {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; k++)
+                    {
+                        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[n] = c;
+                }
+            }
+        };
+    }
+
+    uint32_t crc32(const void *data, size_t size, uint32_t crc)
+    {
+        static const CrcTable table;
+        const unsigned char *p = (const unsigned char *)data;
+        crc ^= 0xffffffffu;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc ^ 0xffffffffu;
+    }
+
+    bool is_gzip(const char *data, size_t size)
+    {
+        return size >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+    }
+
+    std::vector<char> gunzip(const char *data, size_t size)
+    {
+        const unsigned char *p = (const unsigned char *)data;
+        // Header, deflate data, CRC-32 and length.
+        if (!is_gzip(data, size) || size < 18 || p[2] != 8)
+        {
+            throw std::runtime_error("gzip: not a deflate stream!");
+        }
+        unsigned char flags = p[3];
+        size_t pos = 10;
+        if (flags & FEXTRA)
+        {
+            pos += 2 + (p[pos] | p[pos + 1] << 8);
+        }
+        for (unsigned char field : {FNAME, FCOMMENT})
+        {
+            if (flags & field)
+            {
+                while (pos < size && p[pos] != 0)
+                {
+                    pos++;
+                }
+                pos++;
+            }
+        }
+        if (flags & FHCRC)
+        {
+            pos += 2;
+        }
+        if (pos + 8 > size || size - pos > INT_MAX)
+        {
+            throw std::runtime_error("gzip: truncated stream!");
+        }
+        uint32_t crc = read_le32(p + size - 8);
+        uint32_t length = read_le32(p + size - 4);
+        // The trailer holds the length mod 2^32 and is not authenticated,
+        // so it is only a size hint: capped at a plausible expansion of
+        // the compressed data, with stb growing the buffer past it as it
+        // inflates. The length is checked once the stream is inflated.
+        size_t hint = std::min<size_t>(length, MIN_HINT + (size - pos) * MAX_HINT_RATIO);
+        hint = std::max<size_t>(std::min<size_t>(hint, INT_MAX), 1);
+        // stb wants 16 bits of lookahead before each code, so it is handed
+        // the trailer too.
+        int n = 0;
+        char *inflated = stbi_zlib_decode_malloc_guesssize_headerflag(data + pos, (int)(size - pos),
+                                                                     (int)hint, &n, 0);
+        if (inflated == nullptr || n < 0)
+        {
+            stbi_image_free(inflated);
+            throw std::runtime_error("gzip: corrupt or oversized stream!");
+        }
+        std::vector<char> out(inflated, inflated + n);
+        stbi_image_free(inflated);
+        if ((uint32_t)n != length || crc32(out.data(), out.size()) != crc)
+        {
+            throw std::runtime_error("gzip: corrupt stream!");
+        }
+        return out;
+    }
+}
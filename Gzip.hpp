@@ -0,0 +1,35 @@
+//! @file Gzip.hpp
+#ifndef __svg_Gzip_hpp__
+#define __svg_Gzip_hpp__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! CRC-32 (IEEE), as gzip and PNG use it. Chains: the CRC of a
+    //! buffer continues from the CRC of the bytes before it.
+    //! @param data Bytes.
+    //! @param size Size in bytes.
+    //! @param crc CRC of the preceding bytes (0 for none).
+    //! @return CRC of the preceding bytes followed by data.
+    uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+    //! Check for the gzip magic bytes (e.g. an .svgz file).
+    //! @param data File contents.
+    //! @param size Size in bytes.
+    //! @return True if the data starts a gzip stream.
+    bool is_gzip(const char *data, size_t size);
+
+    //! Inflate a single-member gzip stream into memory, with the bundled
+    //! stb zlib decoder. The output buffer grows while inflating, from a
+    //! first size taken from the length trailer but capped by the
+    //! compressed size; the length and CRC-32 are checked at the end.
+    //! Throws std::runtime_error on a truncated or corrupt stream.
+    //! @param data Stream.
+    //! @param size Size in bytes.
+    //! @return Uncompressed contents.
+    std::vector<char> gunzip(const char *data, size_t size);
+}
+#endif
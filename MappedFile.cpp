@@ -0,0 +1,132 @@
+//! @file MappedFile.cpp
+#include "MappedFile.hpp"
+
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace svg
+{
+    namespace
+    {
+        //! Number of recently used mappings kept alive by the cache.
+        const size_t CACHE_CAPACITY = 32;
+
+        unsigned long long mtime_ns(const struct stat &st)
+        {
+            return (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+        }
+    }
+
+    //! Small most-recently-used cache of mappings, keyed by file name.
+    struct MappedFileCache
+    {
+        std::mutex lock;
+        std::deque<std::pair<std::string, std::shared_ptr<const MappedFile>>> entries;
+
+        static MappedFileCache &instance()
+        {
+            static MappedFileCache cache;
+            return cache;
+        }
+    };
+
+    MappedFile::MappedFile(const std::string &file_name)
+        : data_(nullptr), size_(0)
+    {
+        int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to open " + file_name);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to stat " + file_name);
+        }
+        size_ = (size_t)st.st_size;
+        device_ = st.st_dev;
+        inode_ = st.st_ino;
+        mtime_ns_ = mtime_ns(st);
+        if (size_ > 0)
+        {
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Unable to map " + file_name);
+            }
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+            data_ = (char *)p;
+        }
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (data_ != nullptr)
+        {
+            ::munmap(data_, size_);
+        }
+    }
+
+    std::shared_ptr<const MappedFile> MappedFile::open(const std::string &file_name)
+    {
+        struct stat st;
+        bool exists = ::stat(file_name.c_str(), &st) == 0;
+        MappedFileCache &cache = MappedFileCache::instance();
+        {
+            std::lock_guard<std::mutex> guard(cache.lock);
+            for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it)
+            {
+                if (it->first != file_name)
+                {
+                    continue;
+                }
+                std::shared_ptr<const MappedFile> m = it->second;
+                cache.entries.erase(it);
+                if (exists && m->device_ == (unsigned long long)st.st_dev &&
+                    m->inode_ == (unsigned long long)st.st_ino &&
+                    m->size_ == (size_t)st.st_size && m->mtime_ns_ == mtime_ns(st))
+                {
+                    cache.entries.emplace_front(file_name, m);
+                    return m;
+                }
+                break; // stale entry, map the file again
+            }
+        }
+        std::shared_ptr<const MappedFile> m(new MappedFile(file_name));
+        std::lock_guard<std::mutex> guard(cache.lock);
+        cache.entries.emplace_front(file_name, m);
+        if (cache.entries.size() > CACHE_CAPACITY)
+        {
+            cache.entries.pop_back();
+        }
+        return m;
+    }
+
+    void MappedFile::clear_cache()
+    {
+        MappedFileCache &cache = MappedFileCache::instance();
+        std::lock_guard<std::mutex> guard(cache.lock);
+        cache.entries.clear();
+    }
+
+    const char *MappedFile::data() const
+    {
+        return data_;
+    }
+
+    size_t MappedFile::size() const
+    {
+        return size_;
+    }
+}
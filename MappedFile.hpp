@@ -0,0 +1,45 @@
+//! @file MappedFile.hpp
+#ifndef __svg_MappedFile_hpp__
+#define __svg_MappedFile_hpp__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace svg
+{
+    //! Read-only memory mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        //! Map a file, reusing a cached mapping when the same file (same
+        //! inode, size and modification time) was mapped recently.
+        //! Throws std::runtime_error if the file can not be mapped.
+        //! @param file_name File name.
+        //! @return Shared mapping, valid while referenced.
+        static std::shared_ptr<const MappedFile> open(const std::string &file_name);
+        //! Drop all cached mappings (mappings still referenced stay valid).
+        static void clear_cache();
+        //! Destructor. Unmaps the file.
+        ~MappedFile();
+        //! Get the file contents.
+        //! @return Pointer to the first byte.
+        const char *data() const;
+        //! Get the file size.
+        //! @return Size in bytes.
+        size_t size() const;
+
+    private:
+        MappedFile(const std::string &file_name);
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        //! Mapped contents (nullptr for an empty file).
+        char *data_;
+        //! Size in bytes.
+        size_t size_;
+        //! Identity of the mapped file, used to validate cache hits.
+        unsigned long long device_, inode_, mtime_ns_;
+    };
+}
+#endif
@@ -1,10 +1,15 @@
 #include "PNGImage.hpp"
+#include "Gzip.hpp"
 
 #include <stdexcept>
 #include <cmath>
 #include <cstring>
 #include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <cstdint>
+#include <utility>
 
 #define STBI_ONLY_PNG
 #define STB_IMAGE_IMPLEMENTATION
@@ -14,7 +19,91 @@
 
 namespace svg
 {
+    namespace
+    {
+        //! Level-of-detail simplification is not worth it below this
+        //! number of vertices.
+        const size_t DOUGLAS_PEUCKER_MIN = 16;
+
+        //! Bit reader over a deflate stream (bits are packed LSB first).
+        struct BitReader
+        {
+            const unsigned char *data;
+            size_t pos;
+            int bit(size_t len)
+            {
+                if ((pos >> 3) >= len)
+                {
+                    throw std::runtime_error("PNG stream: truncated deflate block!");
+                }
+                int b = (data[pos >> 3] >> (pos & 7)) & 1;
+                pos++;
+                return b;
+            }
+            //! Read a Huffman code, which is stored MSB first.
+            int code(int bits, size_t len)
+            {
+                int c = 0;
+                for (int i = 0; i < bits; i++)
+                {
+                    c = (c << 1) | bit(len);
+                }
+                return c;
+            }
+        };
+
+        //! Find where a fixed-Huffman deflate block ends.
+        //! stb pads the block to a byte boundary, but the inflater resumes
+        //! reading right after the end-of-block code, so the exact bit
+        //! position is needed to append another block.
+        //! @param data Block data, starting with its 3-bit header.
+        //! @param len Data length.
+        //! @return Bit position just after the end-of-block code.
+        size_t fixed_block_end(const unsigned char *data, size_t len)
+        {
+            static const int length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            BitReader in = {data, 3};
+            for (;;)
+            {
+                int sym = in.code(7, len);
+                if (sym <= 23)
+                {
+                    sym += 256;
+                }
+                else
+                {
+                    sym = (sym << 1) | in.bit(len);
+                    if (sym >= 48 && sym <= 191)
+                    {
+                        sym -= 48;
+                    }
+                    else if (sym >= 192 && sym <= 199)
+                    {
+                        sym = sym - 192 + 280;
+                    }
+                    else
+                    {
+                        sym = ((sym << 1) | in.bit(len)) - 400 + 144;
+                    }
+                }
+                if (sym == 256)
+                {
+                    return in.pos;
+                }
+                if (sym > 256)
+                {
+                    in.pos += length_extra[sym - 257];
+                    int dist = in.code(5, len);
+                    in.pos += dist < 4 ? 0 : (dist - 2) / 2;
+                }
+            }
+        }
+    }
+
     PNGImage::PNGImage(const std::string &png_file_name)
+        : origin_({0, 0}), scale_(1.0), lod_tolerance_(0), coverage_stride_(0),
+          profiler_(nullptr), pixels_written_(0), vertices_(0), owned_(true), shader_(), recording_(false)
     {
         int dummy;
         pixels_ = (Color *)::stbi_load(png_file_name.c_str(),
@@ -24,124 +113,1373 @@ namespace svg
         {
             throw std::runtime_error(png_file_name + ": could not load image!");
         }
+        row_bytes_ = (size_t)width_ * sizeof(Color);
+        reset_spans(false);
+    }
+    PNGImage::PNGImage(int w, int h, const Point &origin, double scale)
+    {
+        assert(w > 0 && h > 0);
+        size_t sz = (size_t)w * (size_t)h * sizeof(Color);
+        pixels_ = (Color *)::stbi__malloc(sz);
+        if (pixels_ == nullptr)
+        {
+            throw std::runtime_error("could not allocate image!");
+        }
+        width_ = w;
+        height_ = h;
+        row_bytes_ = (size_t)w * sizeof(Color);
+        owned_ = true;
+        origin_ = origin;
+        scale_ = scale;
+        lod_tolerance_ = 0;
+        coverage_stride_ = 0;
+        profiler_ = nullptr;
+        pixels_written_ = 0;
+        vertices_ = 0;
+        shader_ = SpanShader();
+        recording_ = false;
+        ::memset(pixels_, 0xFF, sz);
+        reset_spans(true);
+    }
+    PNGImage::PNGImage(Color *pixels, int w, int h, size_t row_bytes, const Point &origin, double scale)
+        : width_(w), height_(h), origin_(origin), scale_(scale), lod_tolerance_(0), coverage_stride_(0),
+          profiler_(nullptr), pixels_written_(0), vertices_(0), row_bytes_(row_bytes), owned_(false),
+          shader_(), recording_(false), pixels_(pixels)
+    {
+        if (pixels == nullptr || w <= 0 || h <= 0 || row_bytes < (size_t)w * sizeof(Color))
+        {
+            throw std::invalid_argument("invalid pixel buffer: null, empty, or rows shorter than the width");
+        }
+        reset_spans(false);
+    }
+    namespace
+    {
+        //! Runs of white rows shorter than this are deflated with their
+        //! neighbours, which compresses them as well and saves a call.
+        const int MIN_WHITE_RUN = 16;
+
+        //! Receives the bytes of an encoded PNG, as PNGImage::encode does.
+        typedef void (*WriteFunction)(void *context, const void *data, size_t size);
+
+        //! Write a PNG chunk, its data straight from the caller's buffer.
+        //! @param write Receives the chunk, in pieces.
+        //! @param context Passed to write.
+        //! @param tag Chunk type.
+        //! @param data Chunk data.
+        //! @param len Data length.
+        void write_chunk(WriteFunction write, void *context, const char *tag, const unsigned char *data, size_t len)
+        {
+            if (len > INT_MAX)
+            {
+                throw std::runtime_error("could not encode image!");
+            }
+            unsigned char header[8];
+            unsigned char *o = header;
+            stbiw__wp32(o, len);
+            std::memcpy(header + 4, tag, 4);
+            write(context, header, sizeof(header));
+            if (len > 0)
+            {
+                write(context, data, len);
+            }
+            unsigned char crc[4];
+            o = crc;
+            stbiw__wp32(o, crc32(data, len, crc32(tag, 4)));
+            write(context, crc, sizeof(crc));
+        }
+
+        //! Write the PNG signature and IHDR chunk of an RGB image.
+        void write_header(WriteFunction write, void *context, int w, int h)
+        {
+            static const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+            write(context, signature, sizeof(signature));
+            unsigned char ihdr[13];
+            unsigned char *o = ihdr;
+            stbiw__wp32(o, w);
+            stbiw__wp32(o, h);
+            *o++ = 8; // bit depth
+            *o++ = 2; // RGB
+            *o++ = 0;
+            *o++ = 0;
+            *o++ = 0;
+            write_chunk(write, context, "IHDR", ihdr, sizeof(ihdr));
+        }
+
+        //! WriteFunction appending to a FILE.
+        void write_to_file(void *context, const void *data, size_t size)
+        {
+            ::fwrite(data, 1, size, (FILE *)context);
+        }
+
+        //! Reverse the bits of a Huffman code, which deflate stores MSB first.
+        uint32_t reverse_bits(uint32_t code, int len)
+        {
+            uint32_t r = 0;
+            for (int i = 0; i < len; i++)
+            {
+                r = (r << 1) | ((code >> i) & 1);
+            }
+            return r;
+        }
+    }
+
+    //! Zlib stream of filtered PNG rows, built one image of rows at a time.
+    //! Rows are filtered as stbi_write_png does and deflated by stb, each
+    //! call on its own; the pieces end with an empty stored block (like
+    //! zlib's Z_SYNC_FLUSH) so they concatenate into one stream. White rows
+    //! below a white row filter to the same bytes (Up filter, all zeros),
+    //! so their fixed-Huffman encoding is computed once and repeated.
+    class PNGRowDeflater
+    {
+    public:
+        explicit PNGRowDeflater(int width);
+        //! Append the rows of an image, which follow the rows of earlier calls.
+        void add_image(const PNGImage &rows);
+        //! End the stream, once all rows were added.
+        void finish();
+        //! Compressed bytes produced so far (the caller may consume them).
+        std::vector<unsigned char> out;
+
+    private:
+        //! Filter a row into filtered_.
+        //! @param above Row above it, or nullptr for the top row of the PNG.
+        void filter_row(const Color *above, const Color *row);
+        //! Deflate filtered_ and append it to the stream.
+        void deflate_filtered();
+        //! Append white rows that follow a white row.
+        void add_white_rows(int n);
+        //! Append bits to the stream, LSB first.
+        void put_bits(uint32_t bits, int n);
+        //! Start the stream with the zlib header, if not done yet.
+        void start(unsigned char cmf, unsigned char flg);
+
+        int width_;
+        size_t line_len_;
+        bool started_;
+        //! Running Adler-32 sums of the uncompressed stream.
+        unsigned int adler_a_, adler_b_;
+        //! Last row added, and whether it was white.
+        std::vector<Color> last_row_;
+        bool has_last_row_;
+        bool last_row_white_;
+        //! Filtered rows waiting to be deflated.
+        std::vector<unsigned char> filtered_;
+        //! Scratch: one filtered line, and a row with the one above it.
+        std::vector<signed char> line_;
+        std::vector<Color> pair_;
+        //! Whether each row of the current image is white.
+        std::vector<char> white_;
+        //! Fixed-Huffman encoding of a white row below a white row, as
+        //! (bits, count) pairs.
+        std::vector<std::pair<uint32_t, int>> white_row_;
+        //! Bits not yet written to out.
+        uint64_t bit_buffer_;
+        int bit_count_;
+    };
+
+    PNGRowDeflater::PNGRowDeflater(int width)
+        : width_(width), line_len_((size_t)width * 3), started_(false), adler_a_(1), adler_b_(0),
+          last_row_(width), has_last_row_(false), last_row_white_(false), line_(line_len_),
+          pair_(2 * (size_t)width), bit_buffer_(0), bit_count_(0)
+    {
+        // Filter byte 2 (Up) and the first zero as literals, then the other
+        // zeros as matches at distance 1 (distance code 0).
+        static const int length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                          31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                           2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        auto literal = [this](int lit) { white_row_.push_back({reverse_bits(0x30 + lit, 8), 8}); };
+        literal(2);
+        literal(0);
+        size_t zeros = line_len_ - 1;
+        while (zeros >= 3)
+        {
+            int len = (int)std::min(zeros, (size_t)258);
+            int i = 28;
+            while (length_base[i] > len)
+            {
+                i--;
+            }
+            int sym = 257 + i;
+            if (sym < 280)
+            {
+                white_row_.push_back({reverse_bits(sym - 256, 7), 7});
+            }
+            else
+            {
+                white_row_.push_back({reverse_bits(0xC0 + sym - 280, 8), 8});
+            }
+            if (length_extra[i] > 0)
+            {
+                white_row_.push_back({(uint32_t)(len - length_base[i]), length_extra[i]});
+            }
+            white_row_.push_back({0, 5});
+            zeros -= len;
+        }
+        for (; zeros > 0; zeros--)
+        {
+            literal(0);
+        }
+    }
+
+    void PNGRowDeflater::put_bits(uint32_t bits, int n)
+    {
+        bit_buffer_ |= (uint64_t)bits << bit_count_;
+        bit_count_ += n;
+        while (bit_count_ >= 8)
+        {
+            out.push_back((unsigned char)bit_buffer_);
+            bit_buffer_ >>= 8;
+            bit_count_ -= 8;
+        }
+    }
+
+    void PNGRowDeflater::start(unsigned char cmf, unsigned char flg)
+    {
+        if (!started_)
+        {
+            out.push_back(cmf);
+            out.push_back(flg);
+            started_ = true;
+        }
+    }
+
+    void PNGRowDeflater::filter_row(const Color *above, const Color *row)
+    {
+        // Lay the rows out as stbiw__encode_png_line expects them.
+        const unsigned char *pixels = (const unsigned char *)row;
+        int stride = (int)line_len_;
+        int y = 0;
+        if (above != nullptr)
+        {
+            std::copy(above, above + width_, pair_.begin());
+            std::copy(row, row + width_, pair_.begin() + width_);
+            pixels = (const unsigned char *)pair_.data();
+            y = 1;
+        }
+        // Choose the filter the same way as stbi_write_png.
+        int best_filter = 0, best_filter_val = INT_MAX;
+        for (int filter_type = 0; filter_type < 5; filter_type++)
+        {
+            stbiw__encode_png_line((unsigned char *)pixels, stride, width_, y + 1, y, 3, filter_type, line_.data());
+            int est = 0;
+            for (size_t i = 0; i < line_len_; i++)
+            {
+                est += std::abs((int)line_[i]);
+            }
+            if (est < best_filter_val)
+            {
+                best_filter_val = est;
+                best_filter = filter_type;
+            }
+        }
+        stbiw__encode_png_line((unsigned char *)pixels, stride, width_, y + 1, y, 3, best_filter, line_.data());
+        filtered_.push_back((unsigned char)best_filter);
+        filtered_.insert(filtered_.end(), (unsigned char *)line_.data(), (unsigned char *)line_.data() + line_len_);
+    }
+
+    void PNGRowDeflater::deflate_filtered()
+    {
+        size_t filt_len = filtered_.size();
+        if (filt_len == 0)
+        {
+            return;
+        }
+        if (filt_len > (size_t)INT_MAX / 2)
+        {
+            throw std::runtime_error("PNG stream: too many rows in a single write!");
+        }
+
+        // Running Adler-32 over the uncompressed stream.
+        for (size_t i = 0; i < filt_len;)
+        {
+            size_t block = std::min(filt_len - i, (size_t)5552);
+            for (size_t k = 0; k < block; k++)
+            {
+                adler_a_ += filtered_[i + k];
+                adler_b_ += adler_a_;
+            }
+            adler_a_ %= 65521;
+            adler_b_ %= 65521;
+            i += block;
+        }
+
+        // Deflate the rows on their own: stb emits a zlib header, a single
+        // fixed-Huffman block and the Adler-32 trailer. The block is kept with
+        // its BFINAL bit cleared and followed by an empty stored block, which
+        // realigns the stream to a byte boundary (like zlib's Z_SYNC_FLUSH),
+        // so the blocks of successive calls concatenate into one stream.
+        int zlen;
+        unsigned char *zlib = stbi_zlib_compress(filtered_.data(), (int)filt_len, &zlen,
+                                                 stbi_write_png_compression_level);
+        if (zlib == nullptr)
+        {
+            throw std::runtime_error("PNG stream: compression failed!");
+        }
+        start(zlib[0], zlib[1]);
+        if ((zlib[2] & 6) == 2)
+        {
+            size_t block_len = zlen - 6;
+            size_t end = fixed_block_end(zlib + 2, block_len);
+            out.insert(out.end(), zlib + 2, zlib + 2 + (end + 7) / 8);
+            out[out.size() - (end + 7) / 8] &= ~1;
+            // The stored block header takes 3 bits; the bits after the
+            // end-of-block code are zero, so they can hold it if they fit.
+            if (end % 8 == 0 || end % 8 > 5)
+            {
+                out.push_back(0);
+            }
+            static const unsigned char sync[] = {0, 0, 0xFF, 0xFF};
+            out.insert(out.end(), sync, sync + 4);
+        }
+        else
+        {
+            // stb fell back to stored blocks; emit our own, none final.
+            for (size_t i = 0; i < filt_len;)
+            {
+                size_t block = std::min(filt_len - i, (size_t)65535);
+                unsigned char header[5] = {0,
+                                           (unsigned char)block, (unsigned char)(block >> 8),
+                                           (unsigned char)~block, (unsigned char)(~block >> 8)};
+                out.insert(out.end(), header, header + 5);
+                out.insert(out.end(), filtered_.begin() + i, filtered_.begin() + i + block);
+                i += block;
+            }
+        }
+        STBIW_FREE(zlib);
+        filtered_.clear();
+    }
+
+    void PNGRowDeflater::add_white_rows(int n)
+    {
+        start(0x78, 0x01);
+        put_bits(2, 3); // not final, fixed Huffman codes
+        uint64_t row_bytes = line_len_ + 1;
+        for (int i = 0; i < n; i++)
+        {
+            for (const auto &code : white_row_)
+            {
+                put_bits(code.first, code.second);
+            }
+            // Adler-32 of a filter byte of 2 and zeros.
+            adler_a_ = (adler_a_ + 2) % 65521;
+            adler_b_ = (unsigned int)((adler_b_ + adler_a_ * row_bytes) % 65521);
+        }
+        put_bits(0, 7); // end of block
+        put_bits(0, 3); // empty stored block, to realign the stream
+        if (bit_count_ > 0)
+        {
+            put_bits(0, 8 - bit_count_);
+        }
+        static const unsigned char sync[] = {0, 0, 0xFF, 0xFF};
+        out.insert(out.end(), sync, sync + 4);
+    }
+
+    void PNGRowDeflater::add_image(const PNGImage &rows)
+    {
+        assert(rows.width() == width_);
+        int n = rows.height();
+        white_.resize(n);
+        for (int y = 0; y < n; y++)
+        {
+            int x0, x1;
+            white_[y] = !rows.dirty_span(y, x0, x1);
+        }
+        for (int y = 0; y < n;)
+        {
+            // Rows that are white, like the row above them.
+            int end = y;
+            while (end < n && white_[end] && (end > 0 ? white_[end - 1] : has_last_row_ && last_row_white_))
+            {
+                end++;
+            }
+            if (end - y >= MIN_WHITE_RUN)
+            {
+                deflate_filtered();
+                add_white_rows(end - y);
+                y = end;
+                continue;
+            }
+            for (end = std::max(end, y + 1); y < end; y++)
+            {
+                const Color *above = y > 0 ? rows.row(y - 1) : has_last_row_ ? last_row_.data() : nullptr;
+                filter_row(above, rows.row(y));
+            }
+        }
+        deflate_filtered();
+        std::copy(rows.row(n - 1), rows.row(n - 1) + width_, last_row_.begin());
+        has_last_row_ = true;
+        last_row_white_ = white_[n - 1];
+    }
+
+    void PNGRowDeflater::finish()
+    {
+        deflate_filtered();
+        start(0x78, 0x01);
+        // Empty final stored block, then the Adler-32 trailer.
+        unsigned char tail[] = {1, 0, 0, 0xFF, 0xFF,
+                                (unsigned char)(adler_b_ >> 8), (unsigned char)adler_b_,
+                                (unsigned char)(adler_a_ >> 8), (unsigned char)adler_a_};
+        out.insert(out.end(), tail, tail + sizeof(tail));
+    }
+
+    void PNGImage::save(const std::string &png_file_name) const
+    {
+        std::vector<char> png;
+        encode(png);
+        FILE *file = ::fopen(png_file_name.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error(png_file_name + ": could not open for writing!");
+        }
+        bool written = ::fwrite(png.data(), 1, png.size(), file) == png.size();
+        if (::fclose(file) != 0 || !written)
+        {
+            throw std::runtime_error(png_file_name + ": could not write image!");
+        }
+    }
+
+    void PNGImage::encode(std::vector<char> &out) const
+    {
+        out.clear();
+        encode([](void *context, const void *data, size_t size) {
+                   std::vector<char> &out = *(std::vector<char> *)context;
+                   out.insert(out.end(), (const char *)data, (const char *)data + size);
+               },
+               &out);
+    }
+
+    void PNGImage::encode(void (*write)(void *context, const void *data, size_t size), void *context) const
+    {
+        // Each chunk goes out as soon as it is complete: the rows' IDAT
+        // after they are deflated, and the end of the stream in another.
+        write_header(write, context, width_, height_);
+        PNGRowDeflater deflater(width_);
+        deflater.add_image(*this);
+        write_chunk(write, context, "IDAT", deflater.out.data(), deflater.out.size());
+        deflater.out.clear();
+        deflater.finish();
+        write_chunk(write, context, "IDAT", deflater.out.data(), deflater.out.size());
+        write_chunk(write, context, "IEND", nullptr, 0);
+    }
+
+    PNGImage::PNGImage(PNGImage &&other)
+        : width_(other.width_), height_(other.height_),
+          origin_(other.origin_), scale_(other.scale_), lod_tolerance_(other.lod_tolerance_),
+          coverage_(std::move(other.coverage_)), coverage_stride_(other.coverage_stride_),
+          profiler_(other.profiler_), pixels_written_(other.pixels_written_), vertices_(other.vertices_),
+          row_bytes_(other.row_bytes_), owned_(other.owned_), spans_(std::move(other.spans_)),
+          shader_(other.shader_), clips_(std::move(other.clips_)), recording_(other.recording_),
+          recorded_(std::move(other.recorded_)), pixels_(other.pixels_)
+    {
+        other.pixels_ = nullptr;
+    }
+
+    PNGImage::~PNGImage()
+    {
+        if (owned_)
+        {
+            stbi_image_free(pixels_);
+        }
+    }
+
+    Sprite PNGImage::capture() const
+    {
+        assert(front_to_back());
+        Sprite sprite;
+        sprite.origin = origin_;
+        for (int y = 0; y < height_; y++)
+        {
+            const uint64_t *mask = coverage_.data() + y * coverage_stride_;
+            for (int x = 0; x < width_;)
+            {
+                if (!(mask[x / 64] >> (x % 64) & 1))
+                {
+                    x++;
+                    continue;
+                }
+                int start = x;
+                while (x < width_ && (mask[x / 64] >> (x % 64) & 1))
+                {
+                    x++;
+                }
+                const Color *row = row_at(y);
+                sprite.runs.push_back({start, y, x - start, sprite.colors.size()});
+                sprite.colors.insert(sprite.colors.end(), row + start, row + x);
+            }
+        }
+        return sprite;
+    }
+
+    void PNGImage::blit(const Sprite &sprite, const Point &offset)
+    {
+        for (const Sprite::Run &run : sprite.runs)
+        {
+            int y = sprite.origin.y + offset.y + run.y - origin_.y;
+            if (y < 0 || y >= height_)
+            {
+                continue;
+            }
+            int x0 = sprite.origin.x + offset.x + run.x - origin_.x;
+            int skip = std::max(0, -x0);
+            int x1 = std::min(x0 + run.length, width_) - 1;
+            if (x0 + skip > x1)
+            {
+                continue;
+            }
+            const Color *src = sprite.colors.data() + run.first + skip;
+            x0 += skip;
+            if (recording_)
+            {
+                recorded_.push_back({y, x0, x1});
+                continue;
+            }
+            if (clips_.empty())
+            {
+                copy_span(x0, x1, y, src);
+                continue;
+            }
+            const Span *s, *end;
+            clips_.back().row(y, x0, s, end);
+            for (; s != end && s->x0 <= x1; s++)
+            {
+                int from = std::max(x0, s->x0);
+                copy_span(from, std::min(x1, s->x1), y, src + (from - x0));
+            }
+        }
+    }
+    void PNGImage::copy_span(int x0, int x1, int y, const Color *src)
+    {
+        touch(y, x0, x1);
+        Color *row = row_at(y);
+        if (!front_to_back())
+        {
+            std::copy(src, src + (x1 - x0 + 1), row + x0);
+            if (profiler_ != nullptr)
+            {
+                pixels_written_ += x1 - x0 + 1;
+            }
+            return;
+        }
+        uint64_t *mask = coverage_.data() + y * coverage_stride_;
+        uint64_t written = 0;
+        for (int x = x0; x <= x1; x++, src++)
+        {
+            uint64_t bit = 1ULL << (x % 64);
+            if (!(mask[x / 64] & bit))
+            {
+                mask[x / 64] |= bit;
+                row[x] = *src;
+                written++;
+            }
+        }
+        if (profiler_ != nullptr)
+        {
+            pixels_written_ += written;
+        }
+    }
+
+    PNGImage PNGImage::downscale(int w, int h) const
+    {
+        assert(w > 0 && w <= width_ && h > 0 && h <= height_);
+        PNGImage out(w, h);
+        std::vector<int> x_start(w + 1);
+        for (int x = 0; x <= w; x++)
+        {
+            x_start[x] = (int)((long long)x * width_ / w);
+        }
+        size_t row_len = (size_t)width_ * 3;
+        std::vector<uint32_t> acc(row_len);
+        for (int y = 0; y < h; y++)
+        {
+            int y0 = (int)((long long)y * height_ / h);
+            int y1 = (int)((long long)(y + 1) * height_ / h);
+            // Vertical pass: plain loops over whole rows of bytes, which the
+            // compiler turns into SIMD adds.
+            std::fill(acc.begin(), acc.end(), 0);
+            for (int yy = y0; yy < y1; yy++)
+            {
+                const unsigned char *src = (const unsigned char *)row(yy);
+                for (size_t i = 0; i < row_len; i++)
+                {
+                    acc[i] += src[i];
+                }
+            }
+            // Horizontal pass over each pixel's footprint.
+            Color *dst = out.row_at(y);
+            for (int x = 0; x < w; x++)
+            {
+                uint32_t r = 0, g = 0, b = 0;
+                for (int xx = x_start[x]; xx < x_start[x + 1]; xx++)
+                {
+                    r += acc[xx * 3];
+                    g += acc[xx * 3 + 1];
+                    b += acc[xx * 3 + 2];
+                }
+                uint32_t n = (uint32_t)(x_start[x + 1] - x_start[x]) * (uint32_t)(y1 - y0);
+                dst[x] = {(rgb_value)((r + n / 2) / n), (rgb_value)((g + n / 2) / n), (rgb_value)((b + n / 2) / n)};
+            }
+        }
+        out.reset_spans(false);
+        return out;
+    }
+
+    int PNGImage::width() const
+    {
+        return width_;
+    }
+    int PNGImage::height() const
+    {
+        return height_;
+    }
+    Point PNGImage::origin() const
+    {
+        return origin_;
+    }
+    double PNGImage::scale() const
+    {
+        return scale_;
+    }
+    BoundingBox PNGImage::bounds() const
+    {
+        if (scale_ == 1.0)
+        {
+            return device_bounds();
+        }
+        // Canvas points that round into the image, with a margin for rounding.
+        return {{(int)::floor((origin_.x - 0.5) / scale_), (int)::floor((origin_.y - 0.5) / scale_)},
+                {(int)::ceil((origin_.x + width_ - 0.5) / scale_), (int)::ceil((origin_.y + height_ - 0.5) / scale_)}};
+    }
+    BoundingBox PNGImage::device_bounds() const
+    {
+        return {origin_, {origin_.x + width_ - 1, origin_.y + height_ - 1}};
+    }
+    Point PNGImage::to_device(const Point &p) const
+    {
+        if (scale_ == 1.0)
+        {
+            return p;
+        }
+        return {(int)::lround(p.x * scale_), (int)::lround(p.y * scale_)};
+    }
+    void PNGImage::reset(const Point &origin)
+    {
+        origin_ = origin;
+        if (row_bytes_ == (size_t)width_ * sizeof(Color))
+        {
+            ::memset(pixels_, 0xFF, row_bytes_ * (size_t)height_);
+        }
+        else
+        {
+            for (int y = 0; y < height_; y++)
+            {
+                ::memset(row_at(y), 0xFF, (size_t)width_ * sizeof(Color));
+            }
+        }
+        std::fill(coverage_.begin(), coverage_.end(), 0);
+        reset_spans(true);
+    }
+    void PNGImage::reset_spans(bool clean)
+    {
+        spans_.assign(height_, clean ? Span{width_, -1} : Span{0, width_ - 1});
+    }
+    void PNGImage::touch(int y, int x0, int x1)
+    {
+        Span &s = spans_[y];
+        s.x0 = std::min(s.x0, x0);
+        s.x1 = std::max(s.x1, x1);
+    }
+    bool PNGImage::dirty_span(int y, int &x0, int &x1) const
+    {
+        assert(y >= 0 && y < height_);
+        const Span &s = spans_[y];
+        if (s.x0 > s.x1)
+        {
+            return false;
+        }
+        x0 = s.x0;
+        x1 = s.x1;
+        return true;
+    }
+    void PNGImage::trim_dirty_spans()
+    {
+        auto white = [](const Color &c) { return c.red == 255 && c.green == 255 && c.blue == 255; };
+        for (int y = 0; y < height_; y++)
+        {
+            Span &s = spans_[y];
+            const Color *row = row_at(y);
+            while (s.x0 <= s.x1 && white(row[s.x0]))
+            {
+                s.x0++;
+            }
+            while (s.x1 >= s.x0 && white(row[s.x1]))
+            {
+                s.x1--;
+            }
+            if (s.x0 > s.x1)
+            {
+                s = {width_, -1};
+            }
+        }
+    }
+    void PNGImage::set_front_to_back(bool enable)
+    {
+        coverage_stride_ = enable ? ((size_t)width_ + 63) / 64 : 0;
+        coverage_.assign(coverage_stride_ * height_, 0);
+    }
+    bool PNGImage::front_to_back() const
+    {
+        return coverage_stride_ > 0;
+    }
+    void PNGImage::set_lod_tolerance(double pixels)
+    {
+        lod_tolerance_ = pixels;
+    }
+    double PNGImage::lod_tolerance() const
+    {
+        return lod_tolerance_;
+    }
+    void PNGImage::set_profiler(Profiler *profiler)
+    {
+        profiler_ = profiler;
+    }
+    void PNGImage::set_gradient(const Gradient *gradient)
+    {
+        shader_ = gradient != nullptr ? gradient->shader(scale_) : SpanShader();
+    }
+    void PNGImage::begin_clip()
+    {
+        assert(!recording_);
+        recording_ = true;
+        recorded_.clear();
+    }
+    void PNGImage::end_clip()
+    {
+        assert(recording_);
+        recording_ = false;
+        // Sort the recorded spans by row, and merge the overlapping and
+        // adjacent ones.
+        std::sort(recorded_.begin(), recorded_.end(), [](const RowSpan &a, const RowSpan &b) {
+            return a.y != b.y ? a.y < b.y : a.x0 < b.x0;
+        });
+        ClipRegion region;
+        region.y0 = recorded_.empty() ? 0 : recorded_.front().y;
+        region.rows.push_back(0);
+        int y = region.y0;
+        for (const RowSpan &r : recorded_)
+        {
+            for (; y < r.y; y++)
+            {
+                region.rows.push_back(region.spans.size());
+            }
+            if (region.spans.size() > region.rows.back() && r.x0 <= region.spans.back().x1 + 1)
+            {
+                region.spans.back().x1 = std::max(region.spans.back().x1, r.x1);
+            }
+            else
+            {
+                region.spans.push_back({r.x0, r.x1});
+            }
+        }
+        region.rows.push_back(region.spans.size());
+        if (!clips_.empty())
+        {
+            // Keep only what the enclosing region also holds, row by row.
+            const ClipRegion &outer = clips_.back();
+            ClipRegion both;
+            both.y0 = region.y0;
+            both.rows.push_back(0);
+            for (size_t k = 0; k + 1 < region.rows.size(); k++)
+            {
+                const Span *a = region.spans.data() + region.rows[k];
+                const Span *a_end = region.spans.data() + region.rows[k + 1];
+                const Span *b, *b_end;
+                outer.row(region.y0 + (int)k, INT_MIN, b, b_end);
+                while (a != a_end && b != b_end)
+                {
+                    int x0 = std::max(a->x0, b->x0), x1 = std::min(a->x1, b->x1);
+                    if (x0 <= x1)
+                    {
+                        both.spans.push_back({x0, x1});
+                    }
+                    if (a->x1 < b->x1)
+                    {
+                        a++;
+                    }
+                    else
+                    {
+                        b++;
+                    }
+                }
+                both.rows.push_back(both.spans.size());
+            }
+            region = std::move(both);
+        }
+        clips_.push_back(std::move(region));
+    }
+    void PNGImage::pop_clip()
+    {
+        assert(!clips_.empty());
+        clips_.pop_back();
+    }
+    void PNGImage::ClipRegion::row(int y, int x0, const Span *&begin, const Span *&end) const
+    {
+        if (y < y0 || (size_t)(y - y0) + 1 >= rows.size())
+        {
+            begin = end = nullptr;
+            return;
+        }
+        begin = spans.data() + rows[y - y0];
+        end = spans.data() + rows[y - y0 + 1];
+        begin = std::lower_bound(begin, end, x0, [](const Span &s, int x) { return s.x1 < x; });
+    }
+    bool PNGImage::ClipRegion::contains(int x, int y) const
+    {
+        const Span *s, *end;
+        row(y, x, s, end);
+        return s != end && s->x0 <= x;
+    }
+    Profiler *PNGImage::profiler() const
+    {
+        return profiler_;
+    }
+    uint64_t PNGImage::pixels_written() const
+    {
+        return pixels_written_;
+    }
+    uint64_t PNGImage::vertices_processed() const
+    {
+        return vertices_;
+    }
+    bool PNGImage::covered(const BoundingBox &box) const
+    {
+        if (!front_to_back() || recording_)
+        {
+            return false;
+        }
+        if (box.empty())
+        {
+            return true;
+        }
+        BoundingBox device = {to_device(box.min), to_device(box.max)};
+        if (scale_ != 1.0)
+        {
+            // Scaled radii are rounded separately from centers.
+            device.min = device.min.translate({-1, -1});
+            device.max = device.max.translate({1, 1});
+        }
+        if (!device.intersects(device_bounds()))
+        {
+            return true;
+        }
+        int x0 = std::max(device.min.x, origin_.x) - origin_.x;
+        int x1 = std::min(device.max.x, origin_.x + width_ - 1) - origin_.x;
+        int y0 = std::max(device.min.y, origin_.y) - origin_.y;
+        int y1 = std::min(device.max.y, origin_.y + height_ - 1) - origin_.y;
+        size_t w0 = x0 / 64, w1 = x1 / 64;
+        uint64_t first = ~0ULL << (x0 % 64);
+        uint64_t last = ~0ULL >> (63 - x1 % 64);
+        for (int y = y0; y <= y1; y++)
+        {
+            const uint64_t *mask = coverage_.data() + y * coverage_stride_;
+            if (w0 == w1)
+            {
+                if ((mask[w0] & first & last) != (first & last))
+                {
+                    return false;
+                }
+                continue;
+            }
+            if ((mask[w0] & first) != first || (mask[w1] & last) != last)
+            {
+                return false;
+            }
+            for (size_t w = w0 + 1; w < w1; w++)
+            {
+                if (mask[w] != ~0ULL)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
     }
-    PNGImage::PNGImage(int w, int h)
+    const Color *PNGImage::row(int y) const
     {
-        assert(w > 0 && h > 0);
-        size_t sz = w * h * sizeof(Color);
-        pixels_ = (Color *)::stbi__malloc(sz);
-        width_ = w;
-        height_ = h;
-        ::memset(pixels_, 0xFF, sz);
+        assert(y >= 0 && y < height_);
+        return row_at(y);
     }
-    void PNGImage::save(const std::string &png_file_name) const
+    Color *PNGImage::row_at(int y) const
     {
-        ::stbi_write_png(png_file_name.c_str(),
-                         width_,
-                         height_,
-                         3,
-                         pixels_,
-                         width_ * 3);
+        return (Color *)((unsigned char *)pixels_ + (size_t)y * row_bytes_);
     }
-
-    PNGImage::~PNGImage()
+    void PNGImage::plot(int x, int y, const Color &c)
     {
-        stbi_image_free(pixels_);
+        x -= origin_.x;
+        y -= origin_.y;
+        if (x >= 0 && x < width_ && y >= 0 && y < height_)
+        {
+            if (recording_)
+            {
+                recorded_.push_back({y, x, x});
+                return;
+            }
+            if (!clips_.empty() && !clips_.back().contains(x, y))
+            {
+                return;
+            }
+            if (front_to_back())
+            {
+                uint64_t &mask = coverage_[y * coverage_stride_ + x / 64];
+                uint64_t bit = 1ULL << (x % 64);
+                if (mask & bit)
+                {
+                    return;
+                }
+                mask |= bit;
+            }
+            if (shader_.colors != nullptr)
+            {
+                shader_.shade(row_at(y) + x, x + origin_.x, y + origin_.y, 1);
+            }
+            else
+            {
+                row_at(y)[x] = c;
+            }
+            touch(y, x, x);
+            if (profiler_ != nullptr)
+            {
+                pixels_written_++;
+            }
+        }
     }
-
-    int PNGImage::width() const
+    void PNGImage::fill_span(int x0, int x1, int y, const Color &c)
     {
-        return width_;
+        if (recording_)
+        {
+            recorded_.push_back({y, x0, x1});
+            return;
+        }
+        if (clips_.empty())
+        {
+            write_span(x0, x1, y, c);
+            return;
+        }
+        // Fill the parts of the span inside the clip region's spans.
+        const Span *s, *end;
+        clips_.back().row(y, x0, s, end);
+        for (; s != end && s->x0 <= x1; s++)
+        {
+            write_span(std::max(x0, s->x0), std::min(x1, s->x1), y, c);
+        }
     }
-    int PNGImage::height() const
+    void PNGImage::write_span(int x0, int x1, int y, const Color &c)
     {
-        return height_;
+        Color *row = row_at(y);
+        touch(y, x0, x1);
+        const Color *shaded = nullptr;
+        if (shader_.colors != nullptr)
+        {
+            if (!front_to_back())
+            {
+                shader_.shade(row + x0, x0 + origin_.x, y + origin_.y, x1 - x0 + 1);
+                if (profiler_ != nullptr)
+                {
+                    pixels_written_ += x1 - x0 + 1;
+                }
+                return;
+            }
+            // Shade the whole span, and copy the pixels not covered yet.
+            shaded_.resize(x1 - x0 + 1);
+            shader_.shade(shaded_.data(), x0 + origin_.x, y + origin_.y, x1 - x0 + 1);
+            shaded = shaded_.data();
+        }
+        else if (!front_to_back())
+        {
+            std::fill(row + x0, row + x1 + 1, c);
+            if (profiler_ != nullptr)
+            {
+                pixels_written_ += x1 - x0 + 1;
+            }
+            return;
+        }
+        // Write only the pixels not covered yet, a 64-pixel word at a time.
+        uint64_t *mask = coverage_.data() + y * coverage_stride_;
+        for (int x = x0; x <= x1;)
+        {
+            size_t w = x / 64;
+            int end = std::min(x1, (int)(w * 64 + 63));
+            uint64_t bits = (~0ULL << (x % 64)) & (~0ULL >> (63 - end % 64));
+            uint64_t todo = bits & ~mask[w];
+            if (profiler_ != nullptr)
+            {
+                pixels_written_ += __builtin_popcountll(todo);
+            }
+            if (todo == bits)
+            {
+                if (shaded != nullptr)
+                {
+                    std::copy(shaded + (x - x0), shaded + (end - x0) + 1, row + x);
+                }
+                else
+                {
+                    std::fill(row + x, row + end + 1, c);
+                }
+            }
+            else
+            {
+                for (; todo != 0; todo &= todo - 1)
+                {
+                    int i = w * 64 + __builtin_ctzll(todo);
+                    row[i] = shaded != nullptr ? shaded[i - x0] : c;
+                }
+            }
+            mask[w] |= bits;
+            x = end + 1;
+        }
+    }
+    void PNGImage::fill_column(int x, int y0, int y1, const Color &c)
+    {
+        if (recording_ || !clips_.empty())
+        {
+            for (int y = y0; y <= y1; y++)
+            {
+                fill_span(x, x, y, c);
+            }
+            return;
+        }
+        unsigned char *p = (unsigned char *)(row_at(y0) + x);
+        for (int y = y0; y <= y1; y++)
+        {
+            touch(y, x, x);
+        }
+        if (shader_.colors != nullptr)
+        {
+            // Shade pixel by pixel, through plot.
+            for (int y = y0; y <= y1; y++)
+            {
+                plot(x + origin_.x, y + origin_.y, c);
+            }
+            return;
+        }
+        if (!front_to_back())
+        {
+            for (int y = y0; y <= y1; y++, p += row_bytes_)
+            {
+                *(Color *)p = c;
+            }
+            if (profiler_ != nullptr)
+            {
+                pixels_written_ += y1 - y0 + 1;
+            }
+            return;
+        }
+        uint64_t *mask = coverage_.data() + y0 * coverage_stride_ + x / 64;
+        uint64_t bit = 1ULL << (x % 64);
+        uint64_t written = 0;
+        for (int y = y0; y <= y1; y++, p += row_bytes_, mask += coverage_stride_)
+        {
+            if (!(*mask & bit))
+            {
+                *mask |= bit;
+                *(Color *)p = c;
+                written++;
+            }
+        }
+        if (profiler_ != nullptr)
+        {
+            pixels_written_ += written;
+        }
     }
     Color &PNGImage::at(int x, int y)
     {
         assert(x >= 0 && x < width_);
         assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        touch(y, x, x);     // the caller may write the pixel
+        return row_at(y)[x];
     }
     Color PNGImage::at(int x, int y) const
     {
         assert(x >= 0 && x < width_);
         assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        return row_at(y)[x];
     }
     void PNGImage::draw_line(const Point &a, const Point &b, const Color &c)
     {
-        //  Bresenham Algorithm.
-        int x_from = a.x;
-        int y_from = a.y;
-        int x_to = b.x;
-        int y_to = b.y;
-        int dy = y_to - y_from;
-        int dx = x_to - x_from;
-        int step_x = 1, step_y = 1;
-        if (dy < 0)
+        if (profiler_ != nullptr)
+        {
+            vertices_ += 2;
+        }
+        device_line(to_device(a), to_device(b), c);
+    }
+
+    void PNGImage::device_line(const Point &a, const Point &b, const Color &c)
+    {
+        BoundingBox box = BoundingBox::none();
+        box.extend(a);
+        box.extend(b);
+        if (!box.intersects(device_bounds()))
+        {
+            return;
+        }
+        if (a.y == b.y)
         {
-            dy = -dy;
-            step_y = -1;
+            // Horizontal span (e.g. a polygon or ellipse row): clip it
+            // instead of stepping through the pixels outside the image.
+            int y = a.y - origin_.y;
+            int x0 = std::max(box.min.x, origin_.x) - origin_.x;
+            int x1 = std::min(box.max.x, origin_.x + width_ - 1) - origin_.x;
+            fill_span(x0, x1, y, c);
+            return;
         }
-        if (dx < 0)
+        if (a.x == b.x)
         {
-            dx = -dx;
-            step_x = -1;
+            int x = a.x - origin_.x;
+            int y0 = std::max(box.min.y, origin_.y) - origin_.y;
+            int y1 = std::min(box.max.y, origin_.y + height_ - 1) - origin_.y;
+            fill_column(x, y0, y1, c);
+            return;
         }
-        dy *= 2;
-        dx *= 2;
-        at(x_from, y_from) = c;
-        if (dx > dy)
+        // Run-slice Bresenham: the pixels of a mostly horizontal line come
+        // in horizontal runs, one per row (vertical runs for a mostly
+        // vertical line), and the length of each run follows from the
+        // error term with one division. The error term and its tie rule
+        // are those of the pixel-stepping algorithm, so both draw the
+        // same pixels. Runs are clipped to the image and written a row
+        // (or column) at a time.
+        bool x_major = std::abs((long)b.x - a.x) > std::abs((long)b.y - a.y);
+        // Major and minor axes, in image coordinates.
+        long major = (x_major ? a.x - origin_.x : a.y - origin_.y);
+        long minor = (x_major ? a.y - origin_.y : a.x - origin_.x);
+        long d_major = (x_major ? (long)b.x - a.x : (long)b.y - a.y);
+        long d_minor = (x_major ? (long)b.y - a.y : (long)b.x - a.x);
+        long major_size = x_major ? width_ : height_;
+        long minor_size = x_major ? height_ : width_;
+        int step_major = d_major < 0 ? -1 : 1;
+        int step_minor = d_minor < 0 ? -1 : 1;
+        long remaining = std::abs(d_major);
+        long dmaj = 2 * remaining;
+        long dmin = 2 * std::abs(d_minor);
+        long fraction = dmin - dmaj / 2;
+        for (;;)
         {
-            int fraction = dy - (dx / 2);
-            while (x_from != x_to)
+            // Steps staying on this row (or column): those with a negative
+            // error term at the time of the check.
+            long run = fraction >= 0 ? 0 : fraction + dmin >= 0 ? 1 : (-fraction + dmin - 1) / dmin;
+            run = std::min(run, remaining);
+            long end = major + step_major * run;
+            if (minor >= 0 && minor < minor_size)
             {
-                if (fraction >= 0)
+                long lo = std::max(0L, std::min(major, end));
+                long hi = std::min(major_size - 1, std::max(major, end));
+                if (lo <= hi)
                 {
-                    y_from += step_y;
-                    fraction -= dx;
+                    if (x_major)
+                    {
+                        fill_span((int)lo, (int)hi, (int)minor, c);
+                    }
+                    else
+                    {
+                        fill_column((int)minor, (int)lo, (int)hi, c);
+                    }
                 }
-                x_from += step_x;
-                fraction += dy;
-                at(x_from, y_from) = c;
             }
+            else if ((step_minor > 0) == (minor >= minor_size))
+            {
+                break;   // left the image for good
+            }
+            major = end;
+            remaining -= run;
+            fraction += run * dmin;
+            if (remaining == 0)
+            {
+                break;
+            }
+            minor += step_minor;
+            major += step_major;
+            fraction += dmin - dmaj;
+            remaining--;
         }
-        else
+    }
+
+    void PNGImage::draw_polygon(const std::vector<Point> &points, const Color &c)
+    {
+        draw_polygon(points.data(), points.size(), c);
+    }
+
+    void PNGImage::draw_polygon(const Point *points, size_t count, const Color &c)
+    {
+        if (scale_ == 1.0 && lod_tolerance_ == 0)
+        {
+            if (profiler_ != nullptr)
+            {
+                vertices_ += count;
+            }
+            device_polygon(points, count, c);
+            return;
+        }
+        // Only the vertices left after simplification count.
+        count = device_points(points, count, true, c);
+        if (profiler_ != nullptr)
+        {
+            vertices_ += count;
+        }
+        device_polygon(scratch_.data(), count, c);
+    }
+
+    void PNGImage::draw_polyline(const Point *points, size_t count, const Color &c)
+    {
+        if (scale_ == 1.0 && lod_tolerance_ == 0)
+        {
+            if (profiler_ != nullptr)
+            {
+                vertices_ += count;
+            }
+            for (size_t i = 0; i + 1 < count; i++)
+            {
+                device_line(points[i], points[i + 1], c);
+            }
+            return;
+        }
+        count = device_points(points, count, false, c);
+        if (profiler_ != nullptr)
+        {
+            vertices_ += count;
+        }
+        for (size_t i = 0; i + 1 < count; i++)
+        {
+            device_line(scratch_[i], scratch_[i + 1], c);
+        }
+    }
+
+    size_t PNGImage::device_points(const Point *points, size_t count, bool closed, const Color &c)
+    {
+        scratch_.resize(count);
+        if (lod_tolerance_ == 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                scratch_[i] = to_device(points[i]);
+            }
+            return count;
+        }
+        // Vertices that round to the same pixel as the previous one go first.
+        BoundingBox box = BoundingBox::none();
+        size_t unique = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            Point p = to_device(points[i]);
+            if (unique == 0 || p.x != scratch_[unique - 1].x || p.y != scratch_[unique - 1].y)
+            {
+                scratch_[unique++] = p;
+                box.extend(p);
+            }
+        }
+        count = unique;
+        if (count > 0 && collapse(box, c))
+        {
+            return 0;
+        }
+        if (count <= DOUGLAS_PEUCKER_MIN)
         {
-            int fraction = dx - (dy >> 1);
-            while (y_from != y_to)
+            return count;
+        }
+        // Douglas-Peucker: keep the farthest vertex from each chord while
+        // it lies beyond the tolerance. A closed ring is split at its
+        // first vertex and the one farthest from it.
+        std::vector<char> &keep = lod_keep_;
+        std::vector<std::pair<size_t, size_t>> &todo = lod_todo_;
+        keep.assign(count, 0);
+        size_t last = count - 1;
+        if (closed)
+        {
+            double far = -1;
+            for (size_t i = 1; i < count; i++)
+            {
+                double dx = scratch_[i].x - scratch_[0].x, dy = scratch_[i].y - scratch_[0].y;
+                if (dx * dx + dy * dy > far)
+                {
+                    far = dx * dx + dy * dy;
+                    last = i;
+                }
+            }
+            todo.push_back({last, count});
+        }
+        keep[0] = keep[last] = 1;
+        todo.push_back({0, last});
+        double limit = lod_tolerance_ * lod_tolerance_;
+        while (!todo.empty())
+        {
+            size_t a = todo.back().first, b = todo.back().second;
+            todo.pop_back();
+            const Point &pa = scratch_[a], &pb = scratch_[b % count];
+            double dx = pb.x - pa.x, dy = pb.y - pa.y;
+            double len2 = dx * dx + dy * dy;
+            double worst = 0;
+            size_t worst_i = a;
+            for (size_t i = a + 1; i < b; i++)
             {
-                if (fraction >= 0)
+                // Squared distance to the chord (a segment).
+                double px = scratch_[i].x - pa.x, py = scratch_[i].y - pa.y;
+                double t = len2 == 0 ? 0 : std::max(0.0, std::min(1.0, (px * dx + py * dy) / len2));
+                double ex = px - t * dx, ey = py - t * dy;
+                double d2 = ex * ex + ey * ey;
+                if (d2 > worst)
                 {
-                    x_from += step_x;
-                    fraction -= dy;
+                    worst = d2;
+                    worst_i = i;
                 }
-                y_from += step_y;
-                fraction += dx;
-                at(x_from, y_from) = c;
+            }
+            if (worst > limit)
+            {
+                keep[worst_i] = 1;
+                todo.push_back({a, worst_i});
+                todo.push_back({worst_i, b});
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (keep[i])
+            {
+                scratch_[kept++] = scratch_[i];
             }
         }
+        return kept;
     }
 
-    void PNGImage::draw_polygon(const std::vector<Point> &points, const Color &c)
+    bool PNGImage::collapse(const BoundingBox &box, const Color &c)
+    {
+        if (lod_tolerance_ == 0 || box.max.x - box.min.x > 1 || box.max.y - box.min.y > 1)
+        {
+            return false;
+        }
+        plot(box.min.x + (box.max.x - box.min.x) / 2, box.min.y + (box.max.y - box.min.y) / 2, c);
+        return true;
+    }
+
+    void PNGImage::device_polygon(const Point *points, size_t count, const Color &c)
     {
-        int x_min = width(), x_max = 0, y_min = height(), y_max = 0;
-        for (const Point &p : points)
+        BoundingBox box = BoundingBox::none();
+        for (size_t i = 0; i < count; i++)
         {
-            x_min = std::min(x_min, p.x);
-            x_max = std::max(x_max, p.x);
-            y_min = std::min(y_min, p.y);
-            y_max = std::max(y_max, p.y);
+            box.extend(points[i]);
         }
+        if (!box.intersects(device_bounds()))
+        {
+            return;
+        }
+        // Only scan the rows that fall inside the image.
+        int y_min = std::max(box.min.y, origin_.y);
+        int y_max = std::min(box.max.y, origin_.y + height_);
 
         std::vector<double> seg;
         for (int y = y_min; y < y_max; y++)
         {
-            for (size_t i = 0; i < points.size(); i++)
+            for (size_t i = 0; i < count; i++)
             {
                 Point a = points[i];
-                Point b = points[(i + 1) % points.size()];
+                Point b = points[(i + 1) % count];
                 if (y < std::min(a.y, b.y) || y > std::max(a.y, b.y))
                 {
                     continue;
@@ -164,21 +1502,191 @@ namespace svg
                 }
                 else
                 {
-                    draw_line(a, b, c);
+                    device_line(a, b, c);
                     i_s += 2;
                 }
             }
             seg.clear();
         }
-        for (size_t i = 0; i < points.size(); i++)
+        for (size_t i = 0; i < count; i++)
+        {
+            device_line(points[i], points[(i + 1) % count], c);
+        }
+    }
+
+    void PNGImage::draw_rings(const Point *points, const size_t *ring_ends, size_t rings,
+                              bool even_odd, bool outline, const Color &c)
+    {
+        if (rings == 0)
+        {
+            return;
+        }
+        size_t count = ring_ends[rings - 1];
+        if (scale_ == 1.0)
+        {
+            draw_device_rings(points, ring_ends, rings, even_odd, outline, c);
+            return;
+        }
+        scratch_.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            scratch_[i] = to_device(points[i]);
+        }
+        draw_device_rings(scratch_.data(), ring_ends, rings, even_odd, outline, c);
+    }
+
+    void PNGImage::draw_device_line(const Point &a, const Point &b, const Color &c)
+    {
+        if (profiler_ != nullptr)
+        {
+            vertices_ += 2;
+        }
+        device_line(a, b, c);
+    }
+
+    void PNGImage::draw_device_rings(const Point *points, const size_t *ring_ends, size_t rings,
+                                     bool even_odd, bool outline, const Color &c)
+    {
+        if (rings == 0)
+        {
+            return;
+        }
+        size_t count = ring_ends[rings - 1];
+        if (profiler_ != nullptr)
+        {
+            vertices_ += count;
+        }
+        BoundingBox box = BoundingBox::none();
+        for (size_t i = 0; i < count; i++)
+        {
+            box.extend(points[i]);
+        }
+        if (!box.intersects(device_bounds()) || collapse(box, c))
+        {
+            return;
+        }
+
+        // Edges sorted by their top row; each covers rows [top, bottom).
+        struct Edge
+        {
+            int top, bottom;
+            double x, slope;
+            int winding;
+        };
+        std::vector<Edge> edges;
+        size_t start = 0;
+        for (size_t r = 0; r < rings; r++)
+        {
+            size_t end = ring_ends[r];
+            for (size_t i = start; i < end; i++)
+            {
+                Point a = points[i];
+                Point b = points[i + 1 < end ? i + 1 : start];
+                if (a.y == b.y)
+                {
+                    continue;
+                }
+                int winding = 1;
+                if (a.y > b.y)
+                {
+                    std::swap(a, b);
+                    winding = -1;
+                }
+                edges.push_back({a.y, b.y, (double)a.x, (double)(b.x - a.x) / (b.y - a.y), winding});
+            }
+            start = end;
+        }
+        std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+            return a.top < b.top;
+        });
+
+        // Only scan the rows that fall inside the image, keeping the
+        // edges that cross the current row in an active list.
+        int y_min = std::max(box.min.y, origin_.y);
+        int y_max = std::min(box.max.y, origin_.y + height_ - 1);
+        std::vector<const Edge *> active;
+        std::vector<std::pair<double, int>> crossings;
+        size_t next = 0;
+        for (int y = y_min; y <= y_max; y++)
+        {
+            for (; next < edges.size() && edges[next].top <= y; next++)
+            {
+                active.push_back(&edges[next]);
+            }
+            crossings.clear();
+            size_t kept = 0;
+            for (const Edge *e : active)
+            {
+                if (e->bottom <= y)
+                {
+                    continue;
+                }
+                active[kept++] = e;
+                crossings.push_back({e->x + (y - e->top) * e->slope, e->winding});
+            }
+            active.resize(kept);
+            std::sort(crossings.begin(), crossings.end());
+            int winding = 0;
+            double span_start = 0;
+            for (const std::pair<double, int> &x : crossings)
+            {
+                bool inside = even_odd ? (winding & 1) : winding != 0;
+                winding += x.second;
+                bool now_inside = even_odd ? (winding & 1) : winding != 0;
+                if (!inside && now_inside)
+                {
+                    span_start = x.first;
+                }
+                else if (inside && !now_inside)
+                {
+                    // Pixels whose center lies in [span_start, x).
+                    int x0 = (int)std::ceil(span_start);
+                    int x1 = (int)std::ceil(x.first) - 1;
+                    if (x0 <= x1)
+                    {
+                        device_line({x0, y}, {x1, y}, c);
+                    }
+                }
+            }
+        }
+
+        if (!outline)
+        {
+            return;
+        }
+        start = 0;
+        for (size_t r = 0; r < rings; r++)
         {
-            draw_line(points[i], points[(i + 1) % points.size()], c);
+            size_t end = ring_ends[r];
+            for (size_t i = start; i < end; i++)
+            {
+                device_line(points[i], points[i + 1 < end ? i + 1 : start], c);
+            }
+            start = end;
         }
     }
 
     void PNGImage::draw_ellipse(const Point &center, const Point &radius, const Color &fill)
     {
-        draw_line(center.translate({-radius.x, 0}),
+        if (scale_ == 1.0)
+        {
+            device_ellipse(center, radius, fill);
+            return;
+        }
+        device_ellipse(to_device(center),
+                       {(int)::lround(radius.x * scale_), (int)::lround(radius.y * scale_)},
+                       fill);
+    }
+
+    void PNGImage::device_ellipse(const Point &center, const Point &radius, const Color &fill)
+    {
+        BoundingBox box = {{center.x - radius.x, center.y - radius.y},
+                           {center.x + radius.x, center.y + radius.y}};
+        if (!box.intersects(device_bounds()))
+        {
+            return;
+        }
+        device_line(center.translate({-radius.x, 0}),
                   center.translate({+radius.x, 0}),
                   fill);
         int x0 = radius.x;
@@ -199,13 +1707,64 @@ namespace svg
             }
             dx = x0 - x1;
             x0 = x1;
-            draw_line(center.translate({-x0, -y}),
+            device_line(center.translate({-x0, -y}),
                       center.translate({+x0, -y}),
                       fill);
-            draw_line(center.translate({-x0, +y}),
+            device_line(center.translate({-x0, +y}),
                       center.translate({+x0, +y}),
                       fill);
         }
     }
 
+
+    PNGStreamWriter::PNGStreamWriter(const std::string &png_file_name, int w, int h)
+        : file_(::fopen(png_file_name.c_str(), "wb")),
+          width_(w), height_(h), rows_written_(0), deflater_(new PNGRowDeflater(w))
+    {
+        if (file_ == nullptr)
+        {
+            throw std::runtime_error(png_file_name + ": could not open for writing!");
+        }
+        write_header(write_to_file, file_, w, h);
+    }
+
+    PNGStreamWriter::~PNGStreamWriter()
+    {
+        if (file_ != nullptr)
+        {
+            ::fclose(file_);
+        }
+    }
+
+    void PNGStreamWriter::write_chunk(const char *tag, const unsigned char *data, size_t len)
+    {
+        svg::write_chunk(write_to_file, file_, tag, data, len);
+    }
+
+    void PNGStreamWriter::write(const PNGImage &rows)
+    {
+        assert(rows.width() == width_);
+        int n = rows.height();
+        if (rows_written_ + n > height_)
+        {
+            throw std::runtime_error("PNG stream: too many rows!");
+        }
+        deflater_->add_image(rows);
+        write_chunk("IDAT", deflater_->out.data(), deflater_->out.size());
+        deflater_->out.clear();
+        rows_written_ += n;
+    }
+
+    void PNGStreamWriter::finish()
+    {
+        if (rows_written_ != height_)
+        {
+            throw std::runtime_error("PNG stream: missing rows!");
+        }
+        deflater_->finish();
+        write_chunk("IDAT", deflater_->out.data(), deflater_->out.size());
+        write_chunk("IEND", nullptr, 0);
+        ::fclose(file_);
+        file_ = nullptr;
+    }
 }
@@ -3,13 +3,43 @@
 #define __svg_png_image_hpp__
 
 #include "Color.hpp"
+#include "Gradient.hpp"
 #include "Point.hpp"
 
+#include <cstdint>
+#include <cstdio>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace svg
 {
+    class Profiler;
+    class PNGRowDeflater;
+
+    //! Pixels drawn by an element, stored as runs per row so that they can
+    //! be copied to other positions (see PNGImage::capture and blit).
+    struct Sprite
+    {
+        //! A run of consecutive drawn pixels in a row.
+        struct Run
+        {
+            //! Position of the first pixel, relative to the sprite origin.
+            int x, y;
+            //! Number of pixels.
+            int length;
+            //! Index of the first pixel's color in colors.
+            size_t first;
+        };
+        //! Device position the element was drawn at.
+        Point origin;
+        //! Runs, in row order.
+        std::vector<Run> runs;
+        //! Colors of all runs.
+        std::vector<Color> colors;
+    };
+
     //! PNG image.
     class PNGImage
     {
@@ -21,7 +51,25 @@ namespace svg
         //! Initally, all pixels will be white.
         //! @param w Image width.
         //! @param h Image height.
-        PNGImage(int w, int h);
+        //! @param origin Position of the image's top-left pixel on the scaled canvas.
+        //! @param scale Scale applied to canvas coordinates.
+        //! Drawing operations take canvas coordinates, scale them and are
+        //! clipped to the image, so a small image can hold one window (e.g.
+        //! a band of rows) of a much larger canvas, at any resolution.
+        PNGImage(int w, int h, const Point &origin = {0, 0}, double scale = 1.0);
+        //! Constructor of an image drawing into a caller-owned buffer of
+        //! RGB pixels, which is neither cleared (see reset) nor freed.
+        //! Throws std::invalid_argument if pixels is null, the size is not
+        //! positive or the rows are shorter than the width.
+        //! @param pixels First pixel of the top row.
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param row_bytes Distance between the starts of two rows, in
+        //! bytes, at least 3 * w.
+        //! @param origin Position of the image's top-left pixel on the scaled canvas.
+        //! @param scale Scale applied to canvas coordinates.
+        PNGImage(Color *pixels, int w, int h, size_t row_bytes,
+                 const Point &origin = {0, 0}, double scale = 1.0);
         //! Destructor.
         ~PNGImage();
         //! Get image width.
@@ -30,6 +78,94 @@ namespace svg
         //! Get image height.
         //! @return The image height.
         int height() const;
+        //! Get the position of the image's top-left pixel on the scaled canvas.
+        //! @return The image origin.
+        Point origin() const;
+        //! Get the scale applied to canvas coordinates.
+        //! @return The scale.
+        double scale() const;
+        //! Get the canvas area covered by the image (conservative when scaled).
+        //! @return The image bounds, in canvas coordinates.
+        BoundingBox bounds() const;
+        //! Move the image to another position and clear it to white.
+        //! @param origin New position of the top-left pixel on the scaled canvas.
+        void reset(const Point &origin);
+        //! Enable or disable front-to-back drawing.
+        //! In this mode elements are drawn topmost first and the image keeps
+        //! a coverage bitmask: a pixel is written only by the first (i.e.
+        //! topmost) element that reaches it. Since all fills are opaque the
+        //! result is the same as painting back to front.
+        //! @param enable True to enable.
+        void set_front_to_back(bool enable);
+        //! Check if front-to-back drawing is enabled.
+        //! @return True if enabled.
+        bool front_to_back() const;
+        //! Enable or disable level-of-detail simplification.
+        //! Polygons, polylines and rings whose device bounding box is at
+        //! most one pixel across become a single pixel at its center, and
+        //! vertices are dropped (Douglas-Peucker) as long as the remaining
+        //! outline stays within the tolerance of every dropped vertex.
+        //! Drawn geometry is thus off by at most the tolerance, or by one
+        //! pixel for collapsed shapes.
+        //! @param pixels Tolerance, in device pixels (0 to disable).
+        void set_lod_tolerance(double pixels);
+        //! Get the level-of-detail tolerance.
+        //! @return Tolerance in device pixels, 0 when disabled.
+        double lod_tolerance() const;
+        //! Set the profiler that elements drawn to the image report to
+        //! (see draw_element).
+        //! @param profiler Profiler, or nullptr to disable profiling.
+        void set_profiler(Profiler *profiler);
+        //! Set the gradient that fills are drawn with, instead of their
+        //! color: every pixel the next drawing operations write takes the
+        //! gradient's color at that pixel.
+        //! @param gradient Gradient (which must outlive its use), or
+        //! nullptr to draw with plain colors again.
+        void set_gradient(const Gradient *gradient);
+        //! Start recording a clip region: until end_clip, the pixels that
+        //! drawing operations would write (in any color, and whatever the
+        //! clips already set) are added to the region instead.
+        void begin_clip();
+        //! Finish the clip region and clip all drawing to it, intersected
+        //! with the clips already set, until pop_clip. The region is kept
+        //! as sorted spans per row, so it takes memory in proportion to its
+        //! spans within the image rather than to the image area.
+        void end_clip();
+        //! Remove the clip region last set by end_clip.
+        void pop_clip();
+        //! Get the profiler elements report to.
+        //! @return Profiler, or nullptr.
+        Profiler *profiler() const;
+        //! Get the number of pixels written so far, while a profiler was
+        //! set (drawing without one does not count, to stay free of cost).
+        //! @return Pixel count.
+        uint64_t pixels_written() const;
+        //! Get the number of vertices drawn so far, while a profiler was set
+        //! (after level-of-detail simplification, for polygons and polylines).
+        //! @return Vertex count.
+        uint64_t vertices_processed() const;
+        //! Check if drawing within a box can no longer change the image,
+        //! because every pixel it covers was already written in
+        //! front-to-back mode (or it lies outside the image).
+        //! @param box Box, in canvas coordinates.
+        //! @return True if the box is fully covered.
+        bool covered(const BoundingBox &box) const;
+        //! Get a row of pixels.
+        //! @param y Row, in image coordinates.
+        //! @return Pointer to the first pixel of the row.
+        const Color *row(int y) const;
+        //! Get the span of a row that may differ from white. The image
+        //! tracks the leftmost and rightmost pixel drawn on each row since
+        //! it was cleared; pixels outside that span are known to be white.
+        //! Images loaded from a file or drawing into a caller-owned buffer
+        //! start with every pixel in the span (see trim_dirty_spans).
+        //! @param y Row, in image coordinates.
+        //! @param x0 Receives the first pixel of the span.
+        //! @param x1 Receives the last pixel of the span.
+        //! @return False, leaving x0 and x1 unchanged, if the whole row is white.
+        bool dirty_span(int y, int &x0, int &x1) const;
+        //! Shrink each row's span to its pixels that are not white.
+        void trim_dirty_spans();
         //! Get mutable reference to image pixel.
         //! @param x X position
         //! @param y Y position.
@@ -43,30 +179,234 @@ namespace svg
         //! Save to output file.
         //! @param png_file_name Output file name.
         void save(const std::string &png_file_name) const;
+        //! Encode as PNG into memory.
+        //! @param out Receives the PNG file contents.
+        void encode(std::vector<char> &out) const;
+        //! Encode as PNG through a write function, which is called with
+        //! each piece of the file as it is produced (the header, then each
+        //! chunk's header, data and CRC), without copying the compressed
+        //! data. Throws std::runtime_error if encoding fails.
+        //! @param write Called with the context and the encoded bytes.
+        //! @param context Passed to write.
+        void encode(void (*write)(void *context, const void *data, size_t size), void *context) const;
         //! Draw a line defined by 2 points.
         //! @param a First point.
         //! @param b Second point.
         //! @param c Color to use for the line.
         void draw_line(const Point &a, const Point &b, const Color &c);
+        //! Draw a polyline, one line per pair of consecutive points.
+        //! @param points Array of points.
+        //! @param count Number of points.
+        //! @param c Color to use for the lines.
+        void draw_polyline(const Point *points, size_t count, const Color &c);
         //! Draw a polygon.
         //! @param points Vector of points defining the polygon.
         //! @param fill Color to use for the polygon fill.
         void draw_polygon(const std::vector<Point> &points, const Color &fill);
+        //! Draw a polygon.
+        //! @param points Array of points defining the polygon.
+        //! @param count Number of points.
+        //! @param fill Color to use for the polygon fill.
+        void draw_polygon(const Point *points, size_t count, const Color &fill);
         //! Draw an ellipse.
         //! @param center Coordinates for the ellipse center.
         //! @param radius Radius in X and Y axis.
         //! @param fill Color to use for the ellipse fill.
         //! @param orientation ellipse orientation.
         void draw_ellipse(const Point &center, const Point &radius, const Color &fill);
+        //! Draw a polygon made of several rings, e.g. a shape with holes.
+        //! Pixels are filled where the rings' winding number at their
+        //! center is nonzero (or odd), each pixel once.
+        //! @param points Vertices of all rings, one ring after the other.
+        //! @param ring_ends Index one past the last vertex of each ring.
+        //! @param rings Number of rings.
+        //! @param even_odd Use the even-odd rule instead of nonzero.
+        //! @param outline Also draw the rings' edges, as draw_polygon does.
+        //! @param fill Color to use for the fill.
+        void draw_rings(const Point *points, const size_t *ring_ends, size_t rings,
+                        bool even_odd, bool outline, const Color &fill);
+        //! draw_rings, taking device coordinates (canvas coordinates
+        //! already multiplied by scale()), so that curved outlines can be
+        //! flattened and rounded at the output resolution.
+        void draw_device_rings(const Point *points, const size_t *ring_ends, size_t rings,
+                               bool even_odd, bool outline, const Color &fill);
+        //! draw_line, taking device coordinates (see draw_device_rings).
+        void draw_device_line(const Point &a, const Point &b, const Color &c);
+
+        //! Capture the pixels written so far in front-to-back mode.
+        //! @return Sprite holding the covered pixels, with the image origin.
+        Sprite capture() const;
+        //! Copy a sprite's pixels, moved by an offset, row by row.
+        //! In front-to-back mode only pixels not covered yet are written.
+        //! @param sprite Sprite.
+        //! @param offset Device offset added to the sprite origin.
+        void blit(const Sprite &sprite, const Point &offset);
+        //! Produce a smaller copy of an image with a box filter: each pixel
+        //! is the average of the source pixels it covers.
+        //! @param w Width of the copy, at most the image width.
+        //! @param h Height of the copy, at most the image height.
+        //! @return The downscaled image.
+        PNGImage downscale(int w, int h) const;
+        //! Move constructor.
+        PNGImage(PNGImage &&other);
 
     private:
+        PNGImage(const PNGImage &) = delete;
+        PNGImage &operator=(const PNGImage &) = delete;
+        //! Canvas bounds of the image in device (scaled) coordinates.
+        BoundingBox device_bounds() const;
+        //! Map a canvas point to device (scaled) coordinates.
+        Point to_device(const Point &p) const;
+        //! draw_line, in device coordinates.
+        void device_line(const Point &a, const Point &b, const Color &c);
+        //! draw_polygon, in device coordinates.
+        void device_polygon(const Point *points, size_t count, const Color &fill);
+        //! draw_ellipse, in device coordinates.
+        void device_ellipse(const Point &center, const Point &radius, const Color &fill);
+        //! Map points to device coordinates into scratch_, simplified when
+        //! level-of-detail is enabled (a collapsed shape is drawn with c
+        //! and leaves no points).
+        //! @return Number of points in scratch_.
+        size_t device_points(const Point *points, size_t count, bool closed, const Color &c);
+        //! Draw a shape spanning at most one pixel across as a single
+        //! pixel, when level-of-detail is enabled.
+        //! @param box Device bounding box of the shape.
+        //! @param c Color.
+        //! @return True if the shape was drawn.
+        bool collapse(const BoundingBox &box, const Color &c);
+        //! Fill a clipped horizontal span, in image coordinates.
+        void fill_span(int x0, int x1, int y, const Color &c);
+        //! fill_span, ignoring the clip regions.
+        void write_span(int x0, int x1, int y, const Color &c);
+        //! Copy pixels to a clipped horizontal span, in image coordinates,
+        //! ignoring the clip regions.
+        void copy_span(int x0, int x1, int y, const Color *src);
+        //! Fill a clipped vertical span, in image coordinates.
+        void fill_column(int x, int y0, int y1, const Color &c);
+        //! Get a row of pixels, in image coordinates.
+        Color *row_at(int y) const;
+        //! Add pixels x0 to x1 of row y, in image coordinates, to its span.
+        void touch(int y, int x0, int x1);
+        //! Set every row's span to the whole row (clean is false) or to
+        //! nothing (clean is true).
+        void reset_spans(bool clean);
+        //! Set a pixel given in device coordinates, if it lies in the image.
+        //! @param x X position.
+        //! @param y Y position.
+        //! @param c Color.
+        void plot(int x, int y, const Color &c);
+
         //! Width.
         int width_;
         //! Height.
         int height_;
+        //! Position of the top-left pixel on the scaled canvas.
+        Point origin_;
+        //! Scale applied to canvas coordinates.
+        double scale_;
+        //! Level-of-detail tolerance, in device pixels (0 when disabled).
+        double lod_tolerance_;
+        //! Scaled polygon vertices.
+        std::vector<Point> scratch_;
+        //! Douglas-Peucker work lists: kept vertices and chords to check.
+        std::vector<char> lod_keep_;
+        std::vector<std::pair<size_t, size_t>> lod_todo_;
+        //! Front-to-back coverage bitmask, one bit per pixel, rows padded
+        //! to 64 bits (empty when front-to-back drawing is disabled).
+        std::vector<uint64_t> coverage_;
+        //! 64-bit words per coverage row.
+        size_t coverage_stride_;
+        //! Profiler elements report to (nullptr when disabled).
+        Profiler *profiler_;
+        //! Pixels written and vertices drawn, counted only while a profiler
+        //! is set.
+        uint64_t pixels_written_;
+        uint64_t vertices_;
+        //! Distance between the starts of two rows, in bytes.
+        size_t row_bytes_;
+        //! False for a caller-owned buffer.
+        bool owned_;
+        //! Pixels drawn on a row since the image was cleared, from x0 to
+        //! x1 (empty when x0 > x1).
+        struct Span
+        {
+            int x0, x1;
+        };
+        std::vector<Span> spans_;
+        //! Shader of the current gradient (inactive when colors is null),
+        //! and a span it shaded in front-to-back mode.
+        SpanShader shader_;
+        std::vector<Color> shaded_;
+        //! A clip region, in image coordinates: the spans of row y0 + k
+        //! are spans[rows[k]] to spans[rows[k + 1]], sorted and disjoint.
+        struct ClipRegion
+        {
+            int y0;
+            std::vector<size_t> rows;
+            std::vector<Span> spans;
+
+            //! Get the spans of a row that end at x0 or after it (none
+            //! outside the region's rows).
+            void row(int y, int x0, const Span *&begin, const Span *&end) const;
+            //! Check if the region holds a pixel.
+            bool contains(int x, int y) const;
+        };
+        //! Clip regions set, innermost (already intersected with the
+        //! others) last.
+        std::vector<ClipRegion> clips_;
+        //! A span recorded for a clip region.
+        struct RowSpan
+        {
+            int y, x0, x1;
+        };
+        //! True between begin_clip and end_clip, and the spans recorded.
+        bool recording_;
+        std::vector<RowSpan> recorded_;
         //! Pixels.
         Color *pixels_;
     };
+
+    //! Incremental PNG encoder.
+    //! Rows are filtered and deflated as they arrive and written out
+    //! as separate IDAT chunks, so only the rows of the current call
+    //! need to be held in memory. White rows below white rows (see
+    //! PNGImage::dirty_span) are written from a precomputed encoding.
+    class PNGStreamWriter
+    {
+    public:
+        //! Constructor. Writes the PNG header.
+        //! @param png_file_name Output file name.
+        //! @param w Image width.
+        //! @param h Image height.
+        PNGStreamWriter(const std::string &png_file_name, int w, int h);
+        //! Destructor. Closes the file.
+        ~PNGStreamWriter();
+        //! Append all rows of an image, which must have the PNG width.
+        //! @param rows Image holding the next rows.
+        void write(const PNGImage &rows);
+        //! Finish the PNG stream, once all rows were written.
+        void finish();
+
+    private:
+        PNGStreamWriter(const PNGStreamWriter &) = delete;
+        PNGStreamWriter &operator=(const PNGStreamWriter &) = delete;
+        //! Write a PNG chunk.
+        //! @param tag Chunk type.
+        //! @param data Chunk data.
+        //! @param len Data length.
+        void write_chunk(const char *tag, const unsigned char *data, size_t len);
+
+        //! Output file.
+        FILE *file_;
+        //! Width.
+        int width_;
+        //! Height.
+        int height_;
+        //! Rows written so far.
+        int rows_written_;
+        //! Compressed stream of the rows written so far.
+        std::unique_ptr<PNGRowDeflater> deflater_;
+    };
 }
 
 #endif
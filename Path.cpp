@@ -0,0 +1,472 @@
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include "SVGElements.hpp"
+#include "BinaryScene.hpp"
+
+namespace svg
+{
+    namespace
+    {
+        typedef Path::Vertex Vertex;
+        typedef Path::Segment Segment;
+
+        //! Largest distance, in device pixels, between a curve and its
+        //! flattened polyline (unless level-of-detail allows more).
+        const double TOLERANCE = 0.25;
+        //! Upper bound on the segments a single curve is flattened into.
+        const int MAX_CURVE_SEGMENTS = 1024;
+
+        /**
+         * @brief Reads the 'd' attribute into normalized segments.
+         *
+         * Relative coordinates are resolved, H/V become lines, S/T
+         * reflect the previous control point, quadratic curves are
+         * raised to cubic ones and arcs are split into cubic curves of
+         * at most 90 degrees. As in SVG, the path is kept up to the first
+         * error in the data.
+         */
+        class PathParser
+        {
+        public:
+            PathParser(const string &d, vector<Segment> &segments)
+                : s(d.c_str()), out(segments), cur{0, 0}, start{0, 0},
+                  control{0, 0}, open(false) {}
+
+            void parse()
+            {
+                char cmd = 0;
+                char prev = 0;
+                while (skip())
+                {
+                    if (isalpha((unsigned char)*s)) {
+                        cmd = *s++;
+                    } else if (cmd == 0 || cmd == 'Z' || cmd == 'z') {
+                        return;             // numbers without a command
+                    }
+                    bool rel = islower((unsigned char)cmd) != 0;
+                    Vertex base = rel ? cur : Vertex{0, 0};
+                    double v[7];
+                    switch (toupper((unsigned char)cmd))
+                    {
+                    case 'M':
+                        if (!numbers(v, 2)) return;
+                        cur = {base.x + v[0], base.y + v[1]};
+                        start = cur;
+                        out.push_back({Segment::MOVE, {cur, cur, cur}});
+                        open = true;
+                        cmd = rel ? 'l' : 'L';   // further pairs are lines
+                        break;
+                    case 'Z':
+                        if (open) {
+                            out.push_back({Segment::CLOSE, {start, start, start}});
+                            open = false;
+                        }
+                        cur = start;
+                        break;
+                    case 'L':
+                        if (!numbers(v, 2)) return;
+                        line_to({base.x + v[0], base.y + v[1]});
+                        break;
+                    case 'H':
+                        if (!numbers(v, 1)) return;
+                        line_to({base.x + v[0], cur.y});
+                        break;
+                    case 'V':
+                        if (!numbers(v, 1)) return;
+                        line_to({cur.x, base.y + v[0]});
+                        break;
+                    case 'C':
+                        if (!numbers(v, 6)) return;
+                        cubic_to({base.x + v[0], base.y + v[1]},
+                                 {base.x + v[2], base.y + v[3]},
+                                 {base.x + v[4], base.y + v[5]});
+                        break;
+                    case 'S':
+                        if (!numbers(v, 4)) return;
+                        cubic_to(reflect(prev, "CcSs"),
+                                 {base.x + v[0], base.y + v[1]},
+                                 {base.x + v[2], base.y + v[3]});
+                        break;
+                    case 'Q':
+                        if (!numbers(v, 4)) return;
+                        quad_to({base.x + v[0], base.y + v[1]},
+                                {base.x + v[2], base.y + v[3]});
+                        break;
+                    case 'T':
+                        if (!numbers(v, 2)) return;
+                        quad_to(reflect(prev, "QqTt"), {base.x + v[0], base.y + v[1]});
+                        break;
+                    case 'A':
+                        if (!numbers(v, 3) || !flag(v[3]) || !flag(v[4]) || !numbers(v + 5, 2)) return;
+                        arc_to(v[0], v[1], v[2], v[3] != 0, v[4] != 0,
+                               {base.x + v[5], base.y + v[6]});
+                        break;
+                    default:
+                        return;
+                    }
+                    prev = cmd;
+                }
+            }
+
+        private:
+            //! Skip whitespace and commas; false at the end of the data.
+            bool skip()
+            {
+                while (*s == ',' || isspace((unsigned char)*s)) {
+                    s++;
+                }
+                return *s != 0;
+            }
+
+            bool numbers(double *v, int count)
+            {
+                for (int i = 0; i < count; i++) {
+                    if (!skip()) return false;
+                    char c = *s;
+                    if (!isdigit((unsigned char)c) && c != '.' && c != '-' && c != '+') return false;
+                    char *end;
+                    v[i] = strtod(s, &end);
+                    if (end == s) return false;
+                    s = end;
+                }
+                return true;
+            }
+
+            //! Arc flags are single digits, possibly not separated.
+            bool flag(double &v)
+            {
+                if (!skip() || (*s != '0' && *s != '1')) return false;
+                v = *s++ - '0';
+                return true;
+            }
+
+            //! Control point implied by S and T: the reflection of the
+            //! previous one, if the previous command was of the same family.
+            Vertex reflect(char prev, const char *family) const
+            {
+                if (prev != 0 && strchr(family, prev)) {
+                    return {2 * cur.x - control.x, 2 * cur.y - control.y};
+                }
+                return cur;
+            }
+
+            //! A drawing command right after Z starts a new subpath at the same point.
+            void begin()
+            {
+                if (!open) {
+                    out.push_back({Segment::MOVE, {cur, cur, cur}});
+                    open = true;
+                }
+            }
+
+            void line_to(const Vertex &p)
+            {
+                begin();
+                out.push_back({Segment::LINE, {p, p, p}});
+                cur = control = p;
+            }
+
+            void cubic_to(const Vertex &c1, const Vertex &c2, const Vertex &p)
+            {
+                begin();
+                out.push_back({Segment::CUBIC, {c1, c2, p}});
+                control = c2;
+                cur = p;
+            }
+
+            void quad_to(const Vertex &q, const Vertex &p)
+            {
+                begin();
+                out.push_back({Segment::CUBIC, {{cur.x + 2.0 / 3 * (q.x - cur.x), cur.y + 2.0 / 3 * (q.y - cur.y)},
+                                                {p.x + 2.0 / 3 * (q.x - p.x), p.y + 2.0 / 3 * (q.y - p.y)},
+                                                p}});
+                control = q;
+                cur = p;
+            }
+
+            //! Endpoint to center parameterization (SVG 1.1, appendix F.6).
+            void arc_to(double rx, double ry, double angle, bool large, bool sweep, const Vertex &p)
+            {
+                if (p.x == cur.x && p.y == cur.y) {
+                    return;
+                }
+                rx = std::fabs(rx);
+                ry = std::fabs(ry);
+                if (rx == 0 || ry == 0) {
+                    line_to(p);
+                    return;
+                }
+                double phi = angle * M_PI / 180;
+                double cs = std::cos(phi), sn = std::sin(phi);
+                double hx = (cur.x - p.x) / 2, hy = (cur.y - p.y) / 2;
+                double x1 = cs * hx + sn * hy;
+                double y1 = -sn * hx + cs * hy;
+                double lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+                if (lambda > 1) {
+                    rx *= std::sqrt(lambda);
+                    ry *= std::sqrt(lambda);
+                }
+                double num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+                double den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+                double k = std::sqrt(std::max(0.0, num / den));
+                if (large == sweep) {
+                    k = -k;
+                }
+                double cx1 = k * rx * y1 / ry;
+                double cy1 = -k * ry * x1 / rx;
+                double cx = cs * cx1 - sn * cy1 + (cur.x + p.x) / 2;
+                double cy = sn * cx1 + cs * cy1 + (cur.y + p.y) / 2;
+                double theta = std::atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+                double delta = std::atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx) - theta;
+                if (sweep && delta < 0) {
+                    delta += 2 * M_PI;
+                } else if (!sweep && delta > 0) {
+                    delta -= 2 * M_PI;
+                }
+
+                // One cubic curve per quarter turn at most.
+                int pieces = std::max(1, (int)std::ceil(std::fabs(delta) / (M_PI / 2) - 1e-9));
+                double step = delta / pieces;
+                double t = 4.0 / 3 * std::tan(step / 4);
+                Vertex from = cur;
+                for (int i = 0; i < pieces; i++) {
+                    double a0 = theta + i * step, a1 = a0 + step;
+                    double dx0 = -rx * std::sin(a0), dy0 = ry * std::cos(a0);
+                    double dx1 = -rx * std::sin(a1), dy1 = ry * std::cos(a1);
+                    Vertex to = {cx + cs * rx * std::cos(a1) - sn * ry * std::sin(a1),
+                                 cy + sn * rx * std::cos(a1) + cs * ry * std::sin(a1)};
+                    if (i == pieces - 1) {
+                        to = p;
+                    }
+                    cubic_to({from.x + t * (cs * dx0 - sn * dy0), from.y + t * (sn * dx0 + cs * dy0)},
+                             {to.x - t * (cs * dx1 - sn * dy1), to.y - t * (sn * dx1 + cs * dy1)},
+                             to);
+                    from = to;
+                }
+            }
+
+            const char *s;
+            vector<Segment> &out;
+            Vertex cur;         // current point
+            Vertex start;       // start of the current subpath
+            Vertex control;     // last control point, for S and T
+            bool open;          // a subpath was started and not closed
+        };
+
+        //! Append a device point, skipping repeats. Halves round up on
+        //! both sides of 0, so an integer translation moves every rounded
+        //! vertex by exactly that translation (see Use::draw).
+        void emit(vector<Point> &points, size_t ring_start, double x, double y)
+        {
+            Point p = {(int)std::floor(x + 0.5), (int)std::floor(y + 0.5)};
+            if (points.size() == ring_start || points.back().x != p.x || points.back().y != p.y) {
+                points.push_back(p);
+            }
+        }
+    }
+
+    // Path
+    Path::Path(const string &d, const Color &fill, bool filled,
+               const Color &stroke, bool stroked, bool even_odd, const StrokeStyle &style)
+        : fill(fill), stroke(stroke), filled(filled), stroked(stroked), even_odd(even_odd),
+          style(style) {
+        PathParser(d, segments).parse();
+    }
+
+    void Path::flatten(double scale, double tolerance, vector<Point> &points,
+                       vector<size_t> &ring_ends, vector<bool> &closed) const {
+        Vertex cur = {0, 0};
+        size_t ring_start = 0;
+        for (const Segment &seg : segments) {
+            Vertex end = {seg.p[2].x * scale, seg.p[2].y * scale};
+            switch (seg.kind) {
+            case Segment::MOVE:
+                if (points.size() > ring_start + 1) {
+                    ring_ends.push_back(points.size());
+                    closed.push_back(false);
+                    ring_start = points.size();
+                }
+                points.resize(ring_start);      // a lone move draws nothing
+                emit(points, ring_start, end.x, end.y);
+                break;
+            case Segment::LINE:
+                emit(points, ring_start, end.x, end.y);
+                break;
+            case Segment::CUBIC: {
+                // Wang's formula: n uniform steps keep a cubic within the
+                // tolerance, n = sqrt(3/4 * max |second difference| / tolerance).
+                Vertex c1 = {seg.p[0].x * scale, seg.p[0].y * scale};
+                Vertex c2 = {seg.p[1].x * scale, seg.p[1].y * scale};
+                double d1 = std::hypot(cur.x - 2 * c1.x + c2.x, cur.y - 2 * c1.y + c2.y);
+                double d2 = std::hypot(c1.x - 2 * c2.x + end.x, c1.y - 2 * c2.y + end.y);
+                double n = std::ceil(std::sqrt(0.75 * std::max(d1, d2) / tolerance));
+                int steps = (int)std::min((double)MAX_CURVE_SEGMENTS, std::max(1.0, n));
+                // Power basis, evaluated with Horner's rule.
+                double ax = end.x - cur.x + 3 * (c1.x - c2.x), ay = end.y - cur.y + 3 * (c1.y - c2.y);
+                double bx = 3 * (cur.x - 2 * c1.x + c2.x), by = 3 * (cur.y - 2 * c1.y + c2.y);
+                double cx = 3 * (c1.x - cur.x), cy = 3 * (c1.y - cur.y);
+                for (int i = 1; i < steps; i++) {
+                    double t = (double)i / steps;
+                    emit(points, ring_start, ((ax * t + bx) * t + cx) * t + cur.x,
+                                             ((ay * t + by) * t + cy) * t + cur.y);
+                }
+                emit(points, ring_start, end.x, end.y);
+                break;
+            }
+            case Segment::CLOSE:
+                ring_ends.push_back(points.size());
+                closed.push_back(true);
+                ring_start = points.size();
+                break;
+            }
+            cur = end;
+        }
+        if (points.size() > ring_start + 1) {
+            ring_ends.push_back(points.size());
+            closed.push_back(false);
+        } else {
+            points.resize(ring_start);
+        }
+    }
+
+    void Path::draw(PNGImage &img) const {
+        vector<Point> points;
+        vector<size_t> ring_ends;
+        vector<bool> closed;
+        flatten(img.scale(), std::max(TOLERANCE, img.lod_tolerance()), points, ring_ends, closed);
+        // The stroke is painted over the fill; in front-to-back mode the
+        // first write wins, so it has to come first.
+        if (filled && !img.front_to_back()) {
+            img.set_gradient(gradient.empty() ? nullptr : &gradient);
+            img.draw_device_rings(points.data(), ring_ends.data(), ring_ends.size(), even_odd, true, fill);
+            img.set_gradient(nullptr);
+        }
+        if (stroked && style.thin(img.scale())) {
+            size_t start = 0;
+            for (size_t r = 0; r < ring_ends.size(); r++) {
+                size_t end = ring_ends[r];
+                for (size_t i = start; i + 1 < end; i++) {
+                    img.draw_device_line(points[i], points[i + 1], stroke);
+                }
+                if (closed[r]) {
+                    img.draw_device_line(points[end - 1], points[start], stroke);
+                }
+                start = end;
+            }
+        } else if (stroked) {
+            vector<Point> outline;
+            vector<size_t> outline_ends;
+            outline_stroke(points, ring_ends, closed, img.scale(), outline, outline_ends);
+            img.draw_device_rings(outline.data(), outline_ends.data(), outline_ends.size(), false, false, stroke);
+        }
+        if (filled && img.front_to_back()) {
+            img.set_gradient(gradient.empty() ? nullptr : &gradient);
+            img.draw_device_rings(points.data(), ring_ends.data(), ring_ends.size(), even_odd, true, fill);
+            img.set_gradient(nullptr);
+        }
+    }
+
+    void Path::outline_stroke(const vector<Point> &points, const vector<size_t> &ring_ends,
+                              const vector<bool> &closed, double scale,
+                              vector<Point> &outline, vector<size_t> &outline_ends) const {
+        // The subpaths are already in device coordinates.
+        StrokeStyle device = style;
+        device.width *= scale;
+        size_t start = 0;
+        for (size_t r = 0; r < ring_ends.size(); r++) {
+            stroke_outline(points.data() + start, ring_ends[r] - start, closed[r], device, 1.0,
+                           outline, outline_ends);
+            start = ring_ends[r];
+        }
+    }
+
+    void Path::translate(const Point &t) {
+        for (Segment &seg : segments) {
+            for (Vertex &v : seg.p) {
+                v = {v.x + t.x, v.y + t.y};
+            }
+        }
+        gradient.translate(t);
+    }
+
+    void Path::rotate(int degrees,Point &t) {
+        double angle = M_PI * degrees / 180.0;
+        double s = ::sin(angle);
+        double c = ::cos(angle);
+        for (Segment &seg : segments) {
+            for (Vertex &v : seg.p) {
+                double dx = v.x - t.x;
+                double dy = v.y - t.y;
+                v = {t.x + c * dx - s * dy, t.y + s * dx + c * dy};
+            }
+        }
+        gradient.rotate(degrees, t);
+    }
+
+    void Path::scale(int v,Point &t) {
+        for (Segment &seg : segments) {
+            for (Vertex &p : seg.p) {
+                p = {t.x + (p.x - t.x) * v, t.y + (p.y - t.y) * v};
+            }
+        }
+        style.scale(v);
+        gradient.scale(v, t);
+    }
+
+    void Path::set_gradient(const Gradient &g) {
+        gradient = g;
+    }
+
+    Path* Path::clone() const {
+        return new Path(*this);
+    }
+
+    BoundingBox Path::bounding_box() const {
+        // Curves lie within the hull of their control points.
+        BoundingBox box = BoundingBox::none();
+        for (const Segment &seg : segments) {
+            for (const Vertex &v : seg.p) {
+                box.extend(Point{(int)::floor(v.x), (int)::floor(v.y)});
+                box.extend(Point{(int)::ceil(v.x), (int)::ceil(v.y)});
+            }
+        }
+        if (stroked && !box.empty() && !style.thin(1.0)) {
+            int e = style.extent();
+            box.extend(box.min.translate({-e, -e}));
+            box.extend(box.max.translate({e, e}));
+        }
+        return box;
+    }
+
+    void Path::serialize(SceneWriter &out) const {
+        vector<Point> points;
+        vector<size_t> ring_ends;
+        vector<bool> closed;
+        flatten(1.0, TOLERANCE, points, ring_ends, closed);
+        if (filled) {
+            if (!gradient.empty()) {
+                out.add_gradient(gradient);
+            }
+            out.add_rings(points, ring_ends, even_odd, true, fill);
+        }
+        if (stroked && !style.thin(1.0)) {
+            vector<Point> outline;
+            vector<size_t> outline_ends;
+            outline_stroke(points, ring_ends, closed, 1.0, outline, outline_ends);
+            out.add_rings(outline, outline_ends, false, false, stroke);
+        } else if (stroked) {
+            size_t start = 0;
+            for (size_t r = 0; r < ring_ends.size(); r++) {
+                vector<Point> line(points.begin() + start, points.begin() + ring_ends[r]);
+                if (closed[r]) {
+                    line.push_back(points[start]);
+                }
+                out.add_polyline(line, stroke);
+                start = ring_ends[r];
+            }
+        }
+    }
+}
@@ -1,5 +1,7 @@
 //! @file point.cpp
 #include <cmath>
+#include <climits>
+#include <algorithm>
 #include "Point.hpp"
 
 namespace svg
@@ -27,4 +29,37 @@ namespace svg
                 origin.y + (y - origin.y) * v};
     }
 
+    bool BoundingBox::empty() const
+    {
+        return min.x > max.x || min.y > max.y;
+    }
+
+    bool BoundingBox::intersects(const BoundingBox &other) const
+    {
+        return !empty() && !other.empty() &&
+               min.x <= other.max.x && other.min.x <= max.x &&
+               min.y <= other.max.y && other.min.y <= max.y;
+    }
+
+    void BoundingBox::extend(const Point &p)
+    {
+        min.x = std::min(min.x, p.x);
+        min.y = std::min(min.y, p.y);
+        max.x = std::max(max.x, p.x);
+        max.y = std::max(max.y, p.y);
+    }
+
+    void BoundingBox::extend(const BoundingBox &other)
+    {
+        if (!other.empty())
+        {
+            extend(other.min);
+            extend(other.max);
+        }
+    }
+
+    BoundingBox BoundingBox::none()
+    {
+        return {{INT_MAX, INT_MAX}, {INT_MIN, INT_MIN}};
+    }
 }
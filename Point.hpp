@@ -27,5 +27,32 @@ namespace svg
         //! @return Scaling result.
         Point scale(const Point &origin, int v) const;
     };
+
+    //! Axis-aligned bounding box, with inclusive corners.
+    //! A box with min.x > max.x or min.y > max.y is empty.
+    struct BoundingBox
+    {
+        //! Top-left corner.
+        Point min;
+        //! Bottom-right corner.
+        Point max;
+
+        //! Check if the box is empty.
+        //! @return True if the box contains no points.
+        bool empty() const;
+        //! Check if two boxes overlap.
+        //! @param other Other box.
+        //! @return True if at least one point lies in both boxes.
+        bool intersects(const BoundingBox &other) const;
+        //! Grow the box so that it also covers a point.
+        //! @param p Point.
+        void extend(const Point &p);
+        //! Grow the box so that it also covers another box.
+        //! @param other Other box.
+        void extend(const BoundingBox &other);
+        //! Build an empty box, ready to be extended.
+        //! @return Empty box.
+        static BoundingBox none();
+    };
 }
 #endif
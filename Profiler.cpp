@@ -0,0 +1,197 @@
+//! @file Profiler.cpp
+#include "Profiler.hpp"
+#include "SVGElements.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+
+namespace svg
+{
+    namespace
+    {
+        const char *const PHASE_NAMES[] = {"parse", "transform", "draw"};
+
+        //! Costs of one element over all its events.
+        struct Row
+        {
+            int index;
+            //! Self time per phase, in microseconds.
+            double self[3];
+            //! Draw time including the nested draws.
+            double draw_total;
+            size_t draws;
+            uint64_t pixels, vertices;
+
+            double cost() const
+            {
+                return self[Profiler::PARSE] + self[Profiler::TRANSFORM] + self[Profiler::DRAW];
+            }
+        };
+
+        //! Write a JSON string literal.
+        void write_json_string(std::ostream &out, const std::string &s)
+        {
+            out << '"';
+            for (char c : s)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out << '\\' << c;
+                }
+                else if ((unsigned char)c < 0x20)
+                {
+                    char escape[8];
+                    snprintf(escape, sizeof escape, "\\u%04x", (unsigned)c);
+                    out << escape;
+                }
+                else
+                {
+                    out << c;
+                }
+            }
+            out << '"';
+        }
+    }
+
+    Profiler::Profiler() : origin_(std::chrono::steady_clock::now())
+    {
+    }
+
+    double Profiler::now() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin_).count();
+    }
+
+    void Profiler::begin(Phase phase, int line, int index, const char *tag, const char *id)
+    {
+        if (tag != nullptr && elements_.find(index) == elements_.end())
+        {
+            elements_[index] = {line, tag, id != nullptr ? id : ""};
+        }
+        stack_.push_back({events_.size(), 0, 0, 0});
+        events_.push_back({phase, index, now(), 0, 0, 0, 0, (int)stack_.size() - 1});
+    }
+
+    void Profiler::end()
+    {
+        end(0, 0);
+    }
+
+    void Profiler::end(uint64_t pixels, uint64_t vertices)
+    {
+        if (stack_.empty())
+        {
+            return;
+        }
+        Frame frame = stack_.back();
+        stack_.pop_back();
+        Event &e = events_[frame.event];
+        e.duration = now() - e.start;
+        e.self = std::max(0.0, e.duration - frame.child_time);
+        e.pixels = pixels - std::min(pixels, frame.child_pixels);
+        e.vertices = vertices - std::min(vertices, frame.child_vertices);
+        if (!stack_.empty())
+        {
+            stack_.back().child_time += e.duration;
+            stack_.back().child_pixels += pixels;
+            stack_.back().child_vertices += vertices;
+        }
+    }
+
+    void Profiler::draw(const SVGElement &e, PNGImage &img)
+    {
+        uint64_t pixels = img.pixels_written(), vertices = img.vertices_processed();
+        begin(DRAW, e.source_line(), e.source_index());
+        e.draw(img);
+        end(img.pixels_written() - pixels, img.vertices_processed() - vertices);
+    }
+
+    std::string Profiler::label(int index) const
+    {
+        auto it = elements_.find(index);
+        if (index == 0 || it == elements_.end())
+        {
+            return "(unknown element)";
+        }
+        const Element &e = it->second;
+        std::string name = "<" + e.tag + "> line " + std::to_string(e.line);
+        if (!e.id.empty())
+        {
+            name += " #" + e.id;
+        }
+        return name;
+    }
+
+    void Profiler::print_top(std::ostream &out, size_t n) const
+    {
+        std::unordered_map<int, size_t> row_of;
+        std::vector<Row> rows;
+        double totals[3] = {0, 0, 0};
+        for (const Event &e : events_)
+        {
+            auto it = row_of.find(e.index);
+            if (it == row_of.end())
+            {
+                it = row_of.insert({e.index, rows.size()}).first;
+                rows.push_back({e.index, {0, 0, 0}, 0, 0, 0, 0});
+            }
+            Row &row = rows[it->second];
+            row.self[e.phase] += e.self;
+            totals[e.phase] += e.self;
+            if (e.phase == DRAW)
+            {
+                row.draw_total += e.duration;
+                row.draws++;
+                row.pixels += e.pixels;
+                row.vertices += e.vertices;
+            }
+        }
+        n = std::min(n, rows.size());
+        std::partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+                          [](const Row &a, const Row &b) { return a.cost() > b.cost(); });
+
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(3);
+        out << "profile: " << rows.size() << " elements, parse " << totals[PARSE] / 1000
+            << " ms, transform " << totals[TRANSFORM] / 1000 << " ms, draw " << totals[DRAW] / 1000 << " ms\n";
+        out << std::setw(10) << "self ms" << std::setw(10) << "parse ms" << std::setw(10) << "xform ms"
+            << std::setw(10) << "draw ms" << std::setw(10) << "incl ms" << std::setw(7) << "draws"
+            << std::setw(12) << "pixels" << std::setw(11) << "vertices" << "  element\n";
+        for (size_t i = 0; i < n; i++)
+        {
+            const Row &r = rows[i];
+            out << std::setw(10) << r.cost() / 1000 << std::setw(10) << r.self[PARSE] / 1000
+                << std::setw(10) << r.self[TRANSFORM] / 1000 << std::setw(10) << r.self[DRAW] / 1000
+                << std::setw(10) << r.draw_total / 1000 << std::setw(7) << r.draws
+                << std::setw(12) << r.pixels << std::setw(11) << r.vertices << "  " << label(r.index) << '\n';
+        }
+        out.flags(flags);
+    }
+
+    void Profiler::write_trace(std::ostream &out) const
+    {
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(3);
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < events_.size(); i++)
+        {
+            const Event &e = events_[i];
+            auto element = elements_.find(e.index);
+            out << (i > 0 ? ",\n" : "\n") << "{\"name\":";
+            write_json_string(out, label(e.index));
+            out << ",\"cat\":\"" << PHASE_NAMES[e.phase] << "\",\"ph\":\"X\",\"ts\":" << e.start
+                << ",\"dur\":" << e.duration << ",\"pid\":1,\"tid\":1,\"args\":{\"line\":"
+                << (element != elements_.end() ? element->second.line : 0) << ",\"pixels\":" << e.pixels
+                << ",\"vertices\":" << e.vertices << ",\"self_us\":" << e.self << "}}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        out.flags(flags);
+    }
+
+    size_t Profiler::events() const
+    {
+        return events_.size();
+    }
+}
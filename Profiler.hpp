@@ -0,0 +1,114 @@
+//! @file Profiler.hpp
+#ifndef __svg_Profiler_hpp__
+#define __svg_Profiler_hpp__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace svg
+{
+    class PNGImage;
+    class SVGElement;
+
+    //! Per-element cost profile of a conversion: the time spent parsing,
+    //! transforming and drawing each element, and the pixels and vertices
+    //! its drawing processed. Phases nest (a group's draw holds its
+    //! children's draws), and each element is charged its self cost, i.e.
+    //! without its children's. Elements are named by tag, source line and
+    //! id. A profiler is used by one conversion, on one thread, at a time;
+    //! without one, conversions pay a null pointer check per element, and
+    //! images one per span or shape drawn (pixels and vertices are only
+    //! counted while a profiler is set).
+    class Profiler
+    {
+    public:
+        //! What an event measured.
+        enum Phase
+        {
+            PARSE,      //!< Reading the element from the document.
+            TRANSFORM,  //!< Applying its transform attribute.
+            DRAW        //!< Drawing it.
+        };
+
+        //! Constructor. Event times are relative to its creation.
+        Profiler();
+        //! Start timing a phase of an element; phases nest.
+        //! @param phase Phase.
+        //! @param line Source line of the element (0 if unknown).
+        //! @param index Position of the element in document order, which
+        //! identifies it (0 for elements not read from a document).
+        //! @param tag Element tag, recorded the first time it is given.
+        //! @param id Value of the element's id attribute, or nullptr.
+        void begin(Phase phase, int line, int index, const char *tag = nullptr, const char *id = nullptr);
+        //! End the innermost phase.
+        void end();
+        //! Draw an element, timing it and counting the pixels and vertices
+        //! the image processed meanwhile.
+        //! @param e Element.
+        //! @param img Image.
+        void draw(const SVGElement &e, PNGImage &img);
+        //! Print the costliest elements, by self time over all phases.
+        //! @param out Output stream.
+        //! @param n Number of elements to print.
+        void print_top(std::ostream &out, size_t n) const;
+        //! Write all events as a Chrome trace (trace event format JSON, to
+        //! load in chrome://tracing or Perfetto).
+        //! @param out Output stream.
+        void write_trace(std::ostream &out) const;
+        //! Get the number of recorded events.
+        //! @return Number of events.
+        size_t events() const;
+
+    private:
+        //! A timed phase.
+        struct Event
+        {
+            Phase phase;
+            int index;
+            //! Microseconds since the profiler was created.
+            double start, duration;
+            //! Duration without the nested events.
+            double self;
+            //! Pixels written and vertices processed, without the nested events.
+            uint64_t pixels, vertices;
+            //! Number of enclosing events.
+            int depth;
+        };
+        //! An element seen by the profiler.
+        struct Element
+        {
+            int line;
+            std::string tag;
+            std::string id;
+        };
+        //! An event in progress.
+        struct Frame
+        {
+            size_t event;
+            //! Totals of the nested events.
+            double child_time;
+            uint64_t child_pixels, child_vertices;
+        };
+
+        Profiler(const Profiler &) = delete;
+        Profiler &operator=(const Profiler &) = delete;
+
+        //! Microseconds since the profiler was created.
+        double now() const;
+        //! End the innermost phase, charging it pixels and vertices.
+        void end(uint64_t pixels, uint64_t vertices);
+        //! Name an element, e.g. "<rect> line 12 #door".
+        std::string label(int index) const;
+
+        std::chrono::steady_clock::time_point origin_;
+        std::vector<Event> events_;
+        std::vector<Frame> stack_;
+        std::unordered_map<int, Element> elements_;
+    };
+}
+#endif
@@ -1,4 +1,8 @@
 #include "SVGElements.hpp"
+#include "BinaryScene.hpp"
+#include "Profiler.hpp"
+#include <algorithm>
+#include <cstdlib>
 
 namespace svg
 {
@@ -6,10 +10,23 @@ namespace svg
     SVGElement::SVGElement(): id("id") {}
     SVGElement::~SVGElement() {}
     SVGElement::SVGElement(string id_): id(id_) {}
-    string SVGElement::get_id() {return id;}
+    string SVGElement::get_id() const {return id;}
+    void SVGElement::set_id(const string &id_) {id = id_;}
+    void SVGElement::set_source(int line_, int index_) {line = line_; index = index_;}
+    int SVGElement::source_line() const {return line;}
+    int SVGElement::source_index() const {return index;}
+
+    void draw_element(const SVGElement &e, PNGImage &img) {
+        Profiler *profiler = img.profiler();
+        if (profiler) {
+            profiler->draw(e, img);
+        } else {
+            e.draw(img);
+        }
+    }
     
 
-    Group::Group(vector<SVGElement*> elements): elements(elements) {}
+    Group::Group(vector<SVGElement*> elements): elements(std::move(elements)) {}
     Group::~Group() {
         for (SVGElement* element : elements) {
             delete element; 
@@ -18,13 +35,36 @@ namespace svg
     void Group::addElement(SVGElement* e) {
             elements.push_back(e);
     }
-    vector<SVGElement*> Group::getElements() {
+    const vector<SVGElement*> &Group::getElements() const {
         return elements;
     }
     void Group::draw(PNGImage &img) const {
+        if (img.front_to_back()) {
+            // Topmost first, skipping children that can no longer show.
+            for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+                if (!img.covered((*it)->bounding_box())) {
+                    draw_element(**it, img);
+                }
+            }
+            return;
+        }
+        for (SVGElement* e: elements) {
+            draw_element(*e, img);
+        }
+    }
+    BoundingBox Group::bounding_box() const {
+        BoundingBox box = BoundingBox::none();
+        for (SVGElement* e: elements) {
+            box.extend(e->bounding_box());
+        }
+        return box;
+    }
+    void Group::serialize(SceneWriter &out) const {
+        size_t g = out.begin_group();
         for (SVGElement* e: elements) {
-            e->draw(img);
+            e->serialize(out);
         }
+        out.end_group(g);
     }
     void Group::translate(const Point &t) {
         for (SVGElement* e: elements) {
@@ -42,7 +82,175 @@ namespace svg
         }
     }
     Group* Group::clone() const {
-        return new Group(*this); 
+        vector<SVGElement*> copies;
+        copies.reserve(elements.size());
+        for (SVGElement* e: elements) {
+            copies.push_back(e->clone());   // each group owns its children
+        }
+        return new Group(std::move(copies));
+    }
+
+    // Use
+    namespace {
+        // Sources larger than this (in pixels) are never cached as sprites.
+        const long long MAX_SPRITE_AREA = 1 << 22;
+    }
+    Use::Source::Source(SVGElement* element)
+        : element(element), box(element->bounding_box()),
+          sprite_done(false), sprite_usable(false) {}
+    Use::Source::~Source() {
+        delete element;
+    }
+    const Sprite* Use::Source::get_sprite() {
+        lock_guard<mutex> guard(lock);
+        if (!sprite_done) {
+            sprite_done = true;
+            long long w = (long long)box.max.x - box.min.x + 1;
+            long long h = (long long)box.max.y - box.min.y + 1;
+            if (!box.empty() && w * h <= MAX_SPRITE_AREA) {
+                // Front-to-back coverage records exactly which pixels get drawn.
+                PNGImage canvas((int)w, (int)h, box.min);
+                canvas.set_front_to_back(true);
+                element->draw(canvas);
+                sprite = canvas.capture();
+                sprite_usable = true;
+            }
+        }
+        return sprite_usable ? &sprite : nullptr;
+    }
+
+    Use::Use(shared_ptr<Source> source)
+        : source(source), offset({0, 0}), copy(nullptr) {}
+    Use::Use(const Use &other)
+        : SVGElement(other), source(other.source), offset(other.offset),
+          copy(other.copy ? other.copy->clone() : nullptr) {}
+    Use::~Use() {
+        delete copy;
+    }
+    SVGElement* Use::translated_copy() const {
+        SVGElement* e = source->element->clone();
+        e->translate(offset);
+        return e;
+    }
+    void Use::draw(PNGImage &img) const {
+        if (copy) {
+            copy->draw(img);
+            return;
+        }
+        // Rasterization is invariant under integer translation at scale 1
+        // (path and stroke vertices round halves up on both sides of 0),
+        // except for polygon span ends rounded on either side of x = 0.
+        if (img.scale() == 1.0 && source->box.min.x >= 0 && source->box.min.x + offset.x >= 0) {
+            const Sprite* sprite = source->get_sprite();
+            if (sprite) {
+                img.blit(*sprite, offset);
+                return;
+            }
+        }
+        SVGElement* e = translated_copy();
+        e->draw(img);
+        delete e;
+    }
+    void Use::translate(const Point &t) {
+        if (copy) {
+            copy->translate(t);
+        } else {
+            offset = offset.translate(t);
+        }
+    }
+    void Use::rotate(int degrees,Point &t) {
+        if (!copy && degrees % 360 == 0) {
+            return;
+        }
+        if (!copy) {
+            copy = translated_copy();
+        }
+        copy->rotate(degrees, t);
+    }
+    void Use::scale(int v,Point &t) {
+        if (!copy && v == 1) {
+            return;
+        }
+        if (!copy) {
+            copy = translated_copy();
+        }
+        copy->scale(v, t);
+    }
+    Use* Use::clone() const {
+        return new Use(*this);
+    }
+    BoundingBox Use::bounding_box() const {
+        if (copy) {
+            return copy->bounding_box();
+        }
+        BoundingBox box = source->box;
+        if (!box.empty()) {
+            box.min = box.min.translate(offset);
+            box.max = box.max.translate(offset);
+        }
+        return box;
+    }
+    void Use::serialize(SceneWriter &out) const {
+        if (copy) {
+            copy->serialize(out);
+            return;
+        }
+        SVGElement* e = translated_copy();
+        e->serialize(out);
+        delete e;
+    }
+
+    // Clip
+    Clip::Clip(SVGElement* element, Group* region): element(element), region(region) {}
+    Clip::Clip(const Clip &other)
+        : SVGElement(other), element(other.element->clone()), region(other.region->clone()) {}
+    Clip::~Clip() {
+        delete element;
+        delete region;
+    }
+    SVGElement* Clip::getElement() const {
+        return element;
+    }
+    void Clip::draw(PNGImage &img) const {
+        img.begin_clip();
+        region->draw(img);
+        img.end_clip();
+        element->draw(img);
+        img.pop_clip();
+    }
+    void Clip::translate(const Point &t) {
+        element->translate(t);
+        region->translate(t);
+    }
+    void Clip::rotate(int degrees,Point &t) {
+        element->rotate(degrees, t);
+        region->rotate(degrees, t);
+    }
+    void Clip::scale(int v,Point &t) {
+        element->scale(v, t);
+        region->scale(v, t);
+    }
+    Clip* Clip::clone() const {
+        return new Clip(*this);
+    }
+    BoundingBox Clip::bounding_box() const {
+        // Nothing is drawn outside the region.
+        BoundingBox box = element->bounding_box(), limit = region->bounding_box();
+        if (!box.intersects(limit)) {
+            return BoundingBox::none();
+        }
+        box.min = {max(box.min.x, limit.min.x), max(box.min.y, limit.min.y)};
+        box.max = {min(box.max.x, limit.max.x), min(box.max.y, limit.max.y)};
+        return box;
+    }
+    void Clip::serialize(SceneWriter &out) const {
+        size_t clip = out.begin_clip();
+        for (SVGElement* e: region->getElements()) {
+            e->serialize(out);
+        }
+        out.end_clip_region(clip);
+        element->serialize(out);
+        out.end_clip(clip);
     }
 
     // Ellipse
@@ -51,24 +259,42 @@ namespace svg
                      const Point &radius)
         : fill(fill), center(center), radius(radius) {}
     void Ellipse::draw(PNGImage &img) const {
+        img.set_gradient(gradient.empty() ? nullptr : &gradient);
         img.draw_ellipse(center, radius, fill);
+        img.set_gradient(nullptr);
     }
     void Ellipse::translate(const Point &t) {
         center = center.translate(t);
+        gradient.translate(t);
     }
 
     void Ellipse::rotate(int degrees,Point &t){
         center = center.rotate(t, degrees);
+        gradient.rotate(degrees, t);
     }
     Ellipse* Ellipse::clone() const {
         return new Ellipse(*this); 
     }
+    BoundingBox Ellipse::bounding_box() const {
+        return {{center.x - abs(radius.x), center.y - abs(radius.y)},
+                {center.x + abs(radius.x), center.y + abs(radius.y)}};
+    }
+    void Ellipse::serialize(SceneWriter &out) const {
+        if (!gradient.empty()) {
+            out.add_gradient(gradient);
+        }
+        out.add_ellipse(center, radius, fill);
+    }
+    void Ellipse::set_gradient(const Gradient &g) {
+        gradient = g;
+    }
 
 
     void Ellipse::scale(int v,Point &t) {
         center = center.translate({-t.x, -t.y}).scale({0, 0}, v);
         center = center.translate(t);
         radius = radius.scale({0, 0}, v);
+        gradient.scale(v, t);
     }
 
 
@@ -84,12 +310,18 @@ namespace svg
     }
 
     // Polyline
-    Polyline::Polyline(const std::vector<Point>& _points, Color _stroke)
-        : points(_points), stroke(_stroke) {}
+    Polyline::Polyline(std::vector<Point> _points, Color _stroke, const StrokeStyle &_style)
+        : points(std::move(_points)), stroke(_stroke), style(_style) {}
     void Polyline::draw(PNGImage& img) const {
-        for (size_t i=0; i<points.size()-1; i++) {
-            img.draw_line(points[i], points[i+1], stroke);
+        if (style.thin(img.scale())) {
+            img.draw_polyline(points.data(), points.size(), stroke);
+            return;
         }
+        // Wide lines are filled as a single outline.
+        vector<Point> outline;
+        vector<size_t> outline_ends;
+        stroke_outline(points.data(), points.size(), false, style, img.scale(), outline, outline_ends);
+        img.draw_device_rings(outline.data(), outline_ends.data(), outline_ends.size(), false, false, stroke);
     }
     void Polyline::translate(const Point &t) {
         for (auto &point : points) {
@@ -107,49 +339,93 @@ namespace svg
         for (auto &point : points) {
             point = point.scale(t, v);
         }
+        style.scale(v);
     }
 
     Polyline* Polyline::clone() const {
         return new Polyline(*this); 
     }
+    BoundingBox Polyline::bounding_box() const {
+        BoundingBox box = BoundingBox::none();
+        for (const Point &point : points) {
+            box.extend(point);
+        }
+        if (!box.empty() && !style.thin(1.0)) {
+            int e = style.extent();
+            box.extend(box.min.translate({-e, -e}));
+            box.extend(box.max.translate({e, e}));
+        }
+        return box;
+    }
+    void Polyline::serialize(SceneWriter &out) const {
+        if (style.thin(1.0)) {
+            out.add_polyline(points, stroke);
+            return;
+        }
+        vector<Point> outline;
+        vector<size_t> outline_ends;
+        stroke_outline(points.data(), points.size(), false, style, 1.0, outline, outline_ends);
+        out.add_rings(outline, outline_ends, false, false, stroke);
+    }
 
     // Line
-    Line::Line(int _x1, int _y1, int _x2, int _y2, Color _stroke) 
-        : Polyline({{_x1,_y1},{_x2,_y2}},_stroke) {}
+    Line::Line(int _x1, int _y1, int _x2, int _y2, Color _stroke, const StrokeStyle &_style) 
+        : Polyline({{_x1,_y1},{_x2,_y2}},_stroke,_style) {}
     Line* Line::clone() const {
         return new Line(*this); 
     }
 
 
     // Polygon
-    Polygon::Polygon(const std::vector<Point>& _points, Color _fill) 
-        : points(_points), fill(_fill) {}
+    Polygon::Polygon(std::vector<Point> _points, Color _fill) 
+        : points(std::move(_points)), fill(_fill) {}
         
     void Polygon::draw(PNGImage& img) const {
+        img.set_gradient(gradient.empty() ? nullptr : &gradient);
         img.draw_polygon(points, fill);
+        img.set_gradient(nullptr);
     }
 
     void Polygon::translate(const Point &t) {
         for (auto &point : points) {
             point = point.translate(t);
         }
+        gradient.translate(t);
     }
 
     void Polygon::rotate(int degrees,Point &t) {
         for (auto &point : points) {
             point = point.rotate(t, degrees);
         }
+        gradient.rotate(degrees, t);
     }
 
     void Polygon::scale(int v,Point &t) {
         for (Point &point : points) {
             point = point.scale(t, v);
         }
+        gradient.scale(v, t);
     }
 
     Polygon* Polygon::clone() const {
         return new Polygon(*this);
     }
+    BoundingBox Polygon::bounding_box() const {
+        BoundingBox box = BoundingBox::none();
+        for (const Point &point : points) {
+            box.extend(point);
+        }
+        return box;
+    }
+    void Polygon::serialize(SceneWriter &out) const {
+        if (!gradient.empty()) {
+            out.add_gradient(gradient);
+        }
+        out.add_polygon(points, fill);
+    }
+    void Polygon::set_gradient(const Gradient &g) {
+        gradient = g;
+    }
 
 
     
@@ -3,13 +3,22 @@
 #define _svg_SVGElements_hpp_
 
 #include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <iosfwd>
+#include <string>
 using namespace std;
 #include "Color.hpp"
 #include "Point.hpp"
 #include "PNGImage.hpp"
+#include "Stroke.hpp"
 
 namespace svg
 {
+    class SceneWriter;
+    class Profiler;
+
     /**
      * @class SVGElement
      * @brief The base class for all SVG elements.
@@ -29,11 +38,25 @@ namespace svg
         virtual void rotate(int degrees,Point &t) = 0;
         virtual void scale(int v, Point &t) = 0;
         virtual SVGElement* clone() const = 0;
-        string get_id();
+        virtual BoundingBox bounding_box() const = 0;   // canvas area the element may draw to
+        virtual void serialize(SceneWriter &out) const = 0;   // append to a compiled (.svgb) scene
+        string get_id() const;
+        void set_id(const string &id_);
+        //! Record where the element was read from, for diagnostics.
+        //! @param line Source line.
+        //! @param index Position in document order, counting from 1.
+        void set_source(int line, int index);
+        int source_line() const;    // 0 if not read from a document
+        int source_index() const;   // 0 if not read from a document
     private:
         string id;
+        int line = 0;
+        int index = 0;
     };
 
+    //! Draw an element, through the image's profiler if it has one.
+    void draw_element(const SVGElement &e, PNGImage &img);
+
     // Declaration of namespace functions
     // readSVG -> implement it in readSVG.cpp
     // convert -> already given (DO NOT CHANGE) in convert.cpp
@@ -43,18 +66,312 @@ namespace svg
      * @param svg_file The path to the SVG file.
      * @param dimensions The dimensions of the SVG canvas.
      * @param svg_elements A vector to store the SVG elements.
+     * @param profiler Receives the parse and transform cost of each element, if not null.
      */
     void readSVG(const std::string &svg_file,
                  Point &dimensions,
-                 std::vector<SVGElement *> &svg_elements);
+                 std::vector<SVGElement *> &svg_elements,
+                 Profiler *profiler = nullptr);
+
+    /**
+     * @brief Reads an SVG document held in memory (gzip-compressed or not).
+     * @param data The document text (it need not be null-terminated).
+     * @param size The size of the text in bytes.
+     * @param dimensions The dimensions of the SVG canvas.
+     * @param svg_elements A vector to store the SVG elements.
+     * @param profiler Receives the parse and transform cost of each element, if not null.
+     */
+    void readSVG(const char *data, size_t size,
+                 Point &dimensions,
+                 std::vector<SVGElement *> &svg_elements,
+                 Profiler *profiler = nullptr);
     
+    /**
+     * @brief Rendering options shared by the conversion functions.
+     */
+    struct RenderOptions
+    {
+        RenderOptions() : front_to_back(false), lod_tolerance(0), profiler(nullptr) {}
+        //! Draw topmost elements first and never overwrite a pixel (see
+        //! PNGImage::set_front_to_back), skipping elements that are
+        //! already hidden. The output is the same as in painter's order.
+        bool front_to_back;
+        //! Level-of-detail tolerance in output pixels, 0 for exact output
+        //! (see PNGImage::set_lod_tolerance): shapes at most a pixel across
+        //! become single pixels and outlines are simplified within it.
+        double lod_tolerance;
+        //! If not null, receives the parse, transform and draw cost of
+        //! each element (see Profiler). Compiled (.svgb) scenes are drawn
+        //! as a whole and not profiled; the pipelined conversions
+        //! (convert_stream, convert_batch) ignore it.
+        Profiler *profiler;
+    };
+
     /**
      * @brief Converts an SVG file to a PNG file.
      * @param svg_file The path to the SVG file.
      * @param png_file The path to the output PNG file.
+     * @param options Rendering options.
      */
     void convert(const std::string &svg_file,
-                 const std::string &png_file);
+                 const std::string &png_file,
+                 const RenderOptions &options = RenderOptions());
+
+    /**
+     * @brief A window of the (scaled) canvas, see convert_viewport.
+     */
+    struct Viewport
+    {
+        int x;          //!< Left edge of the window on the scaled canvas.
+        int y;          //!< Top edge of the window on the scaled canvas.
+        int width;      //!< Window width, in pixels.
+        int height;     //!< Window height, in pixels.
+        double scale;   //!< Scale applied to the canvas.
+    };
+
+    /**
+     * @brief Converts a window of an SVG file to a PNG file.
+     *
+     * Only the window is allocated; elements whose bounding box falls
+     * outside it are skipped and the others are clipped to it.
+     * @param svg_file The path to the SVG file.
+     * @param png_file The path to the output PNG file.
+     * @param viewport The window to render.
+     * @param options Rendering options.
+     */
+    void convert_viewport(const std::string &svg_file,
+                          const std::string &png_file,
+                          const Viewport &viewport,
+                          const RenderOptions &options = RenderOptions());
+
+    /**
+     * @brief One output of convert_sizes.
+     */
+    struct SizedOutput
+    {
+        int size;               //!< Longest side of the output, in pixels.
+        std::string png_file;   //!< The path to the output PNG file.
+    };
+
+    /**
+     * @brief Converts an SVG file to several PNG files of different sizes.
+     *
+     * The SVG is parsed once. Each output is rendered at its own resolution
+     * by scaling the geometry, except that outputs no larger than
+     * box_filter_max are box-filtered down from the smallest rendered
+     * output above them. The PNG files are encoded in parallel; if any
+     * fails, the first failure is rethrown once all have finished.
+     * Throws std::runtime_error if the SVG has no width or height.
+     * @param svg_file The path to the SVG file.
+     * @param outputs Sizes and paths of the PNG files.
+     * @param box_filter_max Largest size produced by downscaling (0 for none).
+     * @param options Rendering options.
+     */
+    void convert_sizes(const std::string &svg_file,
+                       const std::vector<SizedOutput> &outputs,
+                       int box_filter_max = 0,
+                       const RenderOptions &options = RenderOptions());
+
+    /**
+     * @brief Compiles an SVG file to the binary scene format (.svgb).
+     *
+     * The scene is stored after transformations and <use> resolution, and
+     * convert / convert_banded accept the compiled file in place of the SVG.
+     * @param svg_file The path to the SVG file.
+     * @param svgb_file The path to the output scene file.
+     */
+    void compile_svgb(const std::string &svg_file,
+                      const std::string &svgb_file);
+
+    /**
+     * @brief Converts an SVG file to a PNG file, one band of rows at a time.
+     *
+     * Only a band_height x width buffer is kept in memory: each band is drawn
+     * with the elements whose bounding box crosses it and then streamed to the
+     * PNG file, so very large canvases can be rendered in bounded memory.
+     * @param svg_file The path to the SVG file.
+     * @param png_file The path to the output PNG file.
+     * @param band_height Number of rows rendered at a time.
+     * @param options Rendering options.
+     */
+    void convert_banded(const std::string &svg_file,
+                        const std::string &png_file,
+                        int band_height,
+                        const RenderOptions &options = RenderOptions());
+
+    /**
+     * @brief A caller-owned buffer of RGB pixels (3 bytes per pixel, red first).
+     */
+    struct PixelBuffer
+    {
+        unsigned char *pixels;  //!< First pixel of the top row.
+        int width;              //!< Width, in pixels.
+        int height;             //!< Height, in pixels.
+        size_t stride;          //!< Distance between the starts of two rows, in bytes (at least 3 * width).
+    };
+
+    /**
+     * @brief Receives the bytes of an encoded PNG, in order, one piece at a
+     * time as the encoder produces them; the compressed data is passed
+     * straight from the encoder's buffer.
+     */
+    typedef std::function<void(const void *data, size_t size)> WriteCallback;
+
+    /**
+     * @brief An SVG document parsed from memory, rendered without files.
+     *
+     * The document is parsed once and may then be rendered any number of
+     * times, at any scale, e.g. by a service holding SVG bytes in memory.
+     */
+    class SVGDocument
+    {
+    public:
+        /**
+         * @brief Parses a document (gzip-compressed or not).
+         * Throws std::runtime_error if it is not valid SVG.
+         * @param data The document text (it need not be null-terminated).
+         * @param size The size of the text in bytes.
+         */
+        SVGDocument(const char *data, size_t size);
+        ~SVGDocument();
+        /**
+         * @brief Gets the canvas size.
+         * @return Width and height, from the root element.
+         */
+        Point dimensions() const;
+        /**
+         * @brief Renders a window of the (scaled) canvas into a caller buffer.
+         *
+         * The buffer is cleared to white first and then drawn in place; no
+         * other image is allocated.
+         * Throws std::invalid_argument if the buffer is null, empty, or has
+         * rows shorter than its width.
+         * @param target The buffer; its size is the size of the window.
+         * @param origin Top-left corner of the window on the scaled canvas.
+         * @param scale Scale applied to the canvas.
+         * @param options Rendering options.
+         */
+        void render(const PixelBuffer &target, const Point &origin = {0, 0}, double scale = 1.0,
+                    const RenderOptions &options = RenderOptions()) const;
+        /**
+         * @brief Renders the whole canvas and encodes it as PNG.
+         * @param write Receives the PNG bytes.
+         * @param options Rendering options.
+         */
+        void encode_png(const WriteCallback &write, const RenderOptions &options = RenderOptions()) const;
+
+    private:
+        SVGDocument(const SVGDocument &) = delete;
+        SVGDocument &operator=(const SVGDocument &) = delete;
+
+        class Scene;
+        std::unique_ptr<Scene> scene;
+    };
+
+    /**
+     * @brief Encodes a caller buffer as PNG.
+     * Throws std::invalid_argument for a buffer that render would reject,
+     * and std::runtime_error if encoding fails.
+     * @param pixels The pixels.
+     * @param write Receives the PNG bytes.
+     */
+    void encode_png(const PixelBuffer &pixels, const WriteCallback &write);
+
+    /**
+     * @brief Settings of convert_stream.
+     */
+    struct PipelineOptions
+    {
+        PipelineOptions()
+            : parse_threads(1), raster_threads(1), encode_threads(1), queue_capacity(4),
+              io_depth(64), io_uring(true) {}
+        int parse_threads;      //!< Threads parsing documents (readSVG).
+        int raster_threads;     //!< Threads drawing parsed documents.
+        int encode_threads;     //!< Threads encoding and saving images.
+        //! Documents held between two stages. A stage whose output queue
+        //! is full waits, which caps the documents in flight (and memory).
+        size_t queue_capacity;
+        //! convert_batch: largest number of file reads and writes in flight.
+        size_t io_depth;
+        //! convert_batch: do the I/O through io_uring when the kernel
+        //! allows it (else, or when false, through a thread pool).
+        bool io_uring;
+        RenderOptions render;   //!< Rendering options.
+    };
+
+    /**
+     * @brief Activity of one convert_stream stage.
+     */
+    struct StageReport
+    {
+        std::string name;       //!< Stage name.
+        int threads;            //!< Number of threads.
+        size_t documents;       //!< Documents processed.
+        double busy_seconds;    //!< Time spent working, summed over threads.
+        double starved_seconds; //!< Time spent waiting for input.
+        double blocked_seconds; //!< Time spent waiting for room downstream.
+    };
+
+    /**
+     * @brief Outcome of convert_stream.
+     */
+    struct PipelineReport
+    {
+        double wall_seconds;                //!< Elapsed time.
+        size_t documents;                   //!< Documents read from the stream.
+        std::vector<StageReport> stages;    //!< Read, parse, raster, encode (and write).
+        std::string io_backend;             //!< convert_batch: I/O engine used.
+        std::vector<std::string> errors;    //!< One message per failed document.
+        //! Print the per-stage utilisation (busy time over threads x
+        //! elapsed time), for tuning the thread counts.
+        void print(std::ostream &out) const;
+    };
+
+    /**
+     * @brief Converts a stream of SVG documents to PNG files, pipelined.
+     *
+     * Documents are separated by null bytes or simply concatenated (a
+     * document ends with the </svg> closing its root element). Reading,
+     * parsing, drawing and encoding run as separate stages, connected by
+     * bounded queues, each with its own threads, so that documents are
+     * parsed and encoded while others are drawn. A document that fails is
+     * reported and skipped.
+     * @param in The stream of documents (e.g. std::cin).
+     * @param png_pattern Output path, where "%d" is replaced by the
+     * document number, from 1 (without "%d", "_<number>" is inserted
+     * before the extension).
+     * @param options Thread counts, queue capacity and rendering options.
+     * @return Number of documents, errors and per-stage activity.
+     */
+    PipelineReport convert_stream(std::istream &in,
+                                  const std::string &png_pattern,
+                                  const PipelineOptions &options = PipelineOptions());
+
+    /**
+     * @brief One conversion of convert_batch.
+     */
+    struct BatchJob
+    {
+        std::string svg_file;   //!< The path to the SVG (or .svgz) file.
+        std::string png_file;   //!< The path to the output PNG file.
+    };
+
+    /**
+     * @brief Converts many SVG files to PNG files, pipelined, with
+     * asynchronous file I/O.
+     *
+     * As convert_stream, but the files are read and the encoded PNGs
+     * written through AsyncIO (io_uring, or a thread pool doing
+     * pread / pwrite), with up to options.io_depth requests in flight, so
+     * that no parse, raster or encode thread waits for the disk. A
+     * conversion that fails is reported and skipped.
+     * @param jobs Input and output files.
+     * @param options Thread counts, queue capacity, I/O and rendering options.
+     * @return Errors and per-stage activity; the read and write stages
+     * count their time as request latency, with io_depth as threads.
+     */
+    PipelineReport convert_batch(const std::vector<BatchJob> &jobs,
+                                 const PipelineOptions &options = PipelineOptions());
 
 
 
@@ -68,16 +385,18 @@ namespace svg
     class Group : public SVGElement {
     public:
 
-        Group(vector<SVGElement*> elements); //constructor
+        Group(vector<SVGElement*> elements); //constructor, takes the vector (move it in)
         ~Group();                            //destructor
         void addElement(SVGElement* e);     //function to add element to the vector elements
-        vector<SVGElement*> getElements();          //getter
+        const vector<SVGElement*> &getElements() const;  //getter
         void draw(PNGImage &img) const override;
         void translate(const Point &t) override;
 
         void rotate(int degrees,Point &t) override;
         void scale(int v,Point &t) override;
         Group* clone() const override;          //function that creates a copy of the group
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
 
     private:
         vector<SVGElement*> elements;
@@ -85,6 +404,87 @@ namespace svg
 
 
 
+    /**
+     * @class Use
+     * @brief A class representing a <use> instance of another element.
+     *
+     * Instances of the same element share one immutable copy of it. While
+     * an instance is only translated, drawing blits a sprite of that copy,
+     * rendered once; rotating or scaling an instance turns it into an
+     * ordinary transformed copy.
+     */
+    class Use : public SVGElement {
+    public:
+        /**
+         * @brief Shared copy of a referenced element, with its sprite.
+         */
+        struct Source {
+            Source(SVGElement* element);    //constructor, takes ownership
+            ~Source();                      //destructor
+            const Sprite* get_sprite();     //sprite of the element (rendered on first call), or nullptr
+            SVGElement* element;
+            BoundingBox box;
+        private:
+            mutex lock;
+            bool sprite_done;
+            bool sprite_usable;
+            Sprite sprite;
+        };
+
+        Use(shared_ptr<Source> source);     //constructor
+        Use(const Use &other);              //copy constructor
+        ~Use();                             //destructor
+        void draw(PNGImage &img) const override;
+        void translate(const Point &t) override;
+        void rotate(int degrees,Point &t) override;
+        void scale(int v,Point &t) override;
+        Use* clone() const override;        //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
+
+    private:
+        Use &operator=(const Use &) = delete;
+        SVGElement* translated_copy() const;    //copy of the source, moved by offset
+
+        shared_ptr<Source> source;
+        Point offset;           //translation applied to the source
+        SVGElement* copy;       //transformed copy, once rotated or scaled
+    };
+
+
+
+    /**
+     * @class Clip
+     * @brief An element drawn through a clip path (clip-path attribute).
+     *
+     * Only the pixels inside the clip region, the union of the fills of
+     * the region's shapes, are drawn. Each draw rasterizes the region once
+     * into spans per row and intersects the element's fills with them
+     * (see PNGImage::begin_clip); nested clips intersect their regions.
+     */
+    class Clip : public SVGElement {
+    public:
+        Clip(SVGElement* element, Group* region);   //constructor, takes ownership of both
+        Clip(const Clip &other);                    //copy constructor
+        ~Clip();                                    //destructor
+        SVGElement* getElement() const;             //getter of the clipped element
+        void draw(PNGImage &img) const override;
+        void translate(const Point &t) override;
+        void rotate(int degrees,Point &t) override;
+        void scale(int v,Point &t) override;
+        Clip* clone() const override;       //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
+
+    private:
+        Clip &operator=(const Clip &) = delete;
+
+        SVGElement* element;
+        Group* region;          //shapes whose fills make the clip region
+    };
+
+
+
     /**
      * @class Ellipse
      * @brief A class representing an ellipse element.
@@ -99,9 +499,13 @@ namespace svg
         void rotate(int degrees,Point &t) override;
         void scale(int v,Point &t) override;
         Ellipse* clone() const override;    //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
+        void set_gradient(const Gradient &g);   //fill with a gradient instead of the fill color
 
     private:
         Color fill;
+        Gradient gradient;  //empty for a plain fill
         Point center;
         Point radius;
     };
@@ -128,17 +532,21 @@ namespace svg
     class Polyline : public SVGElement 
     {
     public:
-        Polyline(const std::vector<Point>& _points, Color _stroke);
+        Polyline(std::vector<Point> _points, Color _stroke,
+                 const StrokeStyle &_style = StrokeStyle());   //constructor, takes the points (move them in)
         ~Polyline() {}
         void draw(PNGImage& img) const override;
         void translate(const Point &t) override;
         void rotate(int degrees, Point &t) override;
         void scale(int v,Point &t) override;
         Polyline* clone() const override;     //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
 
     private:
         std::vector<Point> points; 
         Color stroke;                             
+        StrokeStyle style;
     };
 
 
@@ -151,7 +559,8 @@ namespace svg
     class Line : public Polyline 
     {
     public:
-        Line(int _x1, int _y1, int _x2, int _y2, Color _stroke);
+        Line(int _x1, int _y1, int _x2, int _y2, Color _stroke,
+             const StrokeStyle &_style = StrokeStyle());
         ~Line() {}
         Line* clone() const override;
     };
@@ -165,18 +574,22 @@ namespace svg
     {
 
     public:
-        Polygon(const std::vector<Point>& _points, Color _fill);  //constructor
+        Polygon(std::vector<Point> _points, Color _fill);  //constructor, takes the points (move them in)
         ~Polygon() {}                               //destructor
         void draw(PNGImage& img) const override;
         void translate(const Point &t) override;
         void rotate(int degrees,Point &t) override;
         void scale(int v,Point &t) override;
         Polygon* clone() const override;      //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
+        void set_gradient(const Gradient &g);   //fill with a gradient instead of the fill color
 
 
     private:
         std::vector<Point> points;
         Color fill; 
+        Gradient gradient;  //empty for a plain fill
     };
 
 
@@ -193,6 +606,77 @@ namespace svg
         ~Rect() {}
         Rect* clone() const override;       //function that creates a copy of the element
     };
+
+
+    /**
+     * @class Path
+     * @brief A class representing a path element.
+     *
+     * The path data ('d' attribute) is kept as absolute moves, lines and
+     * cubic curves (quadratic curves and arcs are converted on parsing).
+     * Curves are flattened when drawn, with as many segments as needed to
+     * stay within a quarter of a pixel at the output resolution.
+     */
+    class Path : public SVGElement
+    {
+    public:
+        /**
+         * @brief A point of the path data, in canvas coordinates.
+         */
+        struct Vertex {
+            double x, y;
+        };
+        /**
+         * @brief A normalized path command.
+         */
+        struct Segment {
+            enum Kind { MOVE, LINE, CUBIC, CLOSE } kind;
+            Vertex p[3];    //end point, or two control points and the end point
+        };
+
+        Path(const string &d, const Color &fill, bool filled,
+             const Color &stroke, bool stroked, bool even_odd,
+             const StrokeStyle &style = StrokeStyle());  //constructor
+        ~Path() {}                                  //destructor
+        void draw(PNGImage &img) const override;
+        void translate(const Point &t) override;
+        void rotate(int degrees,Point &t) override;
+        void scale(int v,Point &t) override;
+        Path* clone() const override;       //function that creates a copy of the element
+        BoundingBox bounding_box() const override;
+        void serialize(SceneWriter &out) const override;
+        void set_gradient(const Gradient &g);   //fill with a gradient instead of the fill color
+
+    private:
+        /**
+         * @brief Flattens the path at a given scale, one ring per subpath.
+         * @param scale Scale applied to canvas coordinates.
+         * @param tolerance Largest distance from a curve, in device pixels.
+         * @param points Receives the rounded device coordinates.
+         * @param ring_ends Receives the index one past each subpath.
+         * @param closed Receives whether each subpath was closed.
+         */
+        void flatten(double scale, double tolerance, vector<Point> &points,
+                     vector<size_t> &ring_ends, vector<bool> &closed) const;
+        /**
+         * @brief Builds the outline of a wide stroke around flattened subpaths.
+         * @param scale Scale the subpaths were flattened at.
+         * @param outline Receives the outline rings (see stroke_outline).
+         * @param outline_ends Receives the index one past each outline ring.
+         */
+        void outline_stroke(const vector<Point> &points, const vector<size_t> &ring_ends,
+                            const vector<bool> &closed, double scale,
+                            vector<Point> &outline, vector<size_t> &outline_ends) const;
+
+        vector<Segment> segments;
+        Color fill;
+        Gradient gradient;  //empty for a plain fill
+        Color stroke;
+        bool filled;
+        bool stroked;
+        bool even_odd;      //fill-rule="evenodd", instead of nonzero
+        StrokeStyle style;
+    };
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,856 @@
+//! @file SceneStats.cpp
+#include "SceneStats.hpp"
+#include "Color.hpp"
+#include "Gzip.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace svg
+{
+    namespace
+    {
+        //! Tags the analyzer tells apart.
+        enum Tag
+        {
+            G, RECT, CIRCLE, ELLIPSE, LINE, POLYLINE, POLYGON, PATH, USE, OTHER
+        };
+        const char *const TAG_NAMES[] = {"g", "rect", "circle", "ellipse", "line",
+                                         "polyline", "polygon", "path", "use"};
+
+        //! A piece of the document text.
+        struct Text
+        {
+            const char *begin, *end;
+
+            bool empty() const
+            {
+                return begin == end;
+            }
+            bool operator==(const char *s) const
+            {
+                size_t n = strlen(s);
+                return (size_t)(end - begin) == n && memcmp(begin, s, n) == 0;
+            }
+            std::string str() const
+            {
+                return std::string(begin, end);
+            }
+        };
+
+        Tag classify(const Text &name)
+        {
+            for (int t = G; t < OTHER; t++)
+            {
+                if (name == TAG_NAMES[t])
+                {
+                    return (Tag)t;
+                }
+            }
+            return OTHER;
+        }
+
+        bool is_space(char c)
+        {
+            return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+        }
+
+        bool is_digit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        //! Read the next number of a list, skipping separators.
+        //! @return False, with p unchanged past the separators, if no
+        //! number follows.
+        bool read_number(const char *&p, const char *end, double &v)
+        {
+            while (p < end && (is_space(*p) || *p == ','))
+            {
+                p++;
+            }
+            const char *start = p;
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                p++;
+            }
+            double r = 0;
+            bool digits = false;
+            for (; p < end && is_digit(*p); p++, digits = true)
+            {
+                r = r * 10 + (*p - '0');
+            }
+            if (p < end && *p == '.')
+            {
+                double f = 0.1;
+                for (p++; p < end && is_digit(*p); p++, f *= 0.1, digits = true)
+                {
+                    r += (*p - '0') * f;
+                }
+            }
+            if (!digits)
+            {
+                p = start;
+                return false;
+            }
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                const char *e = p + 1;
+                bool negative_exponent = e < end && *e == '-';
+                if (e < end && (*e == '-' || *e == '+'))
+                {
+                    e++;
+                }
+                int exponent = 0;
+                if (e < end && is_digit(*e))
+                {
+                    for (; e < end && is_digit(*e); e++)
+                    {
+                        exponent = std::min(exponent * 10 + (*e - '0'), 1000);
+                    }
+                    r *= std::pow(10.0, negative_exponent ? -exponent : exponent);
+                    p = e;
+                }
+            }
+            v = negative ? -r : r;
+            return true;
+        }
+
+        double number(const Text &t, double missing = 0)
+        {
+            const char *p = t.begin;
+            double v;
+            return read_number(p, t.end, v) ? v : missing;
+        }
+
+        //! Pixels drawn by a stroked segment of the given width.
+        double stroke_pixels(double dx, double dy, double width)
+        {
+            return (std::max(std::fabs(dx), std::fabs(dy)) + 1) * width;
+        }
+
+        //! Bounding box of a shape's vertices, in doubles.
+        struct Extent
+        {
+            double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+
+            void extend(double x, double y)
+            {
+                x0 = std::min(x0, x);
+                y0 = std::min(y0, y);
+                x1 = std::max(x1, x);
+                y1 = std::max(y1, y);
+            }
+            double area() const
+            {
+                return x0 > x1 ? 0 : (x1 - x0 + 1) * (y1 - y0 + 1);
+            }
+            double perimeter() const
+            {
+                return x0 > x1 ? 0 : 2 * (x1 - x0 + y1 - y0);
+            }
+        };
+
+        //! Walk path data, extending an extent with its end and control points.
+        //! @return Number of points.
+        uint64_t path_points(const Text &d, Extent &extent)
+        {
+            uint64_t points = 0;
+            char command = 0;
+            double x = 0, y = 0, start_x = 0, start_y = 0;
+            const char *p = d.begin;
+            while (p < d.end)
+            {
+                if (is_space(*p) || *p == ',')
+                {
+                    p++;
+                    continue;
+                }
+                char c = *p;
+                if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+                {
+                    command = c;
+                    p++;
+                    if (c == 'Z' || c == 'z')
+                    {
+                        x = start_x;
+                        y = start_y;
+                    }
+                    continue;
+                }
+                char upper = command & ~0x20;
+                int count = upper == 'H' || upper == 'V' ? 1
+                            : upper == 'C'               ? 6
+                            : upper == 'S' || upper == 'Q' ? 4
+                            : upper == 'A'               ? 7
+                            : upper == 'M' || upper == 'L' || upper == 'T' ? 2
+                                                         : 0;
+                double v[7];
+                int read = 0;
+                while (read < count && read_number(p, d.end, v[read]))
+                {
+                    read++;
+                }
+                if (count == 0 || read < count)
+                {
+                    // Stray character or truncated command.
+                    p++;
+                    continue;
+                }
+                bool relative = command != upper;
+                double ox = relative ? x : 0, oy = relative ? y : 0;
+                if (upper == 'H')
+                {
+                    x = ox + v[0];
+                }
+                else if (upper == 'V')
+                {
+                    y = oy + v[0];
+                }
+                else if (upper == 'A')
+                {
+                    x = ox + v[5];
+                    y = oy + v[6];
+                }
+                else
+                {
+                    // Control points, then the end point.
+                    for (int i = 0; i + 2 < count; i += 2)
+                    {
+                        extent.extend(ox + v[i], oy + v[i + 1]);
+                        points++;
+                    }
+                    x = ox + v[count - 2];
+                    y = oy + v[count - 1];
+                }
+                extent.extend(x, y);
+                points++;
+                if (upper == 'M')
+                {
+                    start_x = x;
+                    start_y = y;
+                    // Further pairs are line segments.
+                    command = relative ? 'l' : 'L';
+                }
+            }
+            return points;
+        }
+
+        //! An open element, accumulating what its subtree draws.
+        struct Frame
+        {
+            Frame(double scale_, int groups_) : elements(0), area(0), scale(scale_), groups(groups_), container(true) {}
+
+            //! Id attribute, if any.
+            std::string id;
+            //! Elements in the subtree, not counting <use> targets.
+            uint64_t elements;
+            //! Fill estimate of the same elements.
+            double area;
+            //! Product of the scale transforms down to the element.
+            double scale;
+            //! Number of <g> elements from the root down to the element.
+            int groups;
+            //! Whether its children are drawn (only <g> and the root draw
+            //! theirs: the contents of <defs> and the like are only drawn
+            //! through <use>).
+            bool container;
+            //! Targets of the <use> elements in the subtree, with their counts.
+            std::unique_ptr<std::unordered_map<std::string, uint64_t>> uses;
+        };
+
+        //! An element with an id, as a <use> target.
+        struct Definition
+        {
+            uint64_t elements;
+            double area;
+            std::unordered_map<std::string, uint64_t> uses;
+            //! Expansion state: 0 to do, 1 in progress, 2 done.
+            int state;
+            double expanded_elements, expanded_area;
+            //! On a reference cycle: its references expand to nothing.
+            bool cyclic;
+        };
+
+        //! Attributes of an element that the analyzer reads.
+        struct Attributes
+        {
+            Text id, href, fill, stroke, stroke_width, transform, points, d;
+            Text x, y, width, height, cx, cy, r, rx, ry, x1, y1, x2, y2;
+
+            void set(const Text &name, const Text &value)
+            {
+                struct Field
+                {
+                    const char *name;
+                    size_t length;
+                    Text Attributes::*text;
+                };
+                static const Field fields[] = {
+                    {"id", 2, &Attributes::id}, {"href", 4, &Attributes::href},
+                    {"xlink:href", 10, &Attributes::href}, {"fill", 4, &Attributes::fill},
+                    {"stroke", 6, &Attributes::stroke}, {"stroke-width", 12, &Attributes::stroke_width},
+                    {"transform", 9, &Attributes::transform}, {"points", 6, &Attributes::points},
+                    {"d", 1, &Attributes::d}, {"x", 1, &Attributes::x}, {"y", 1, &Attributes::y},
+                    {"width", 5, &Attributes::width}, {"height", 6, &Attributes::height},
+                    {"cx", 2, &Attributes::cx}, {"cy", 2, &Attributes::cy}, {"r", 1, &Attributes::r},
+                    {"rx", 2, &Attributes::rx}, {"ry", 2, &Attributes::ry}, {"x1", 2, &Attributes::x1},
+                    {"y1", 2, &Attributes::y1}, {"x2", 2, &Attributes::x2}, {"y2", 2, &Attributes::y2}};
+                size_t length = name.end - name.begin;
+                for (const Field &f : fields)
+                {
+                    if (f.length == length && memcmp(f.name, name.begin, length) == 0)
+                    {
+                        this->*f.text = value;
+                        return;
+                    }
+                }
+            }
+        };
+
+        //! Gathers the statistics from a stream of tags.
+        class Analyzer
+        {
+        public:
+            Analyzer(SceneStats &stats)
+                : stats_(stats), tag_counts_(), root_seen_(false), rgb_seen_((1 << 24) / 64), rgb_count_(0)
+            {
+                // The document itself: holds the root element's totals.
+                stack_.emplace_back(1.0, 0);
+            }
+
+            void start(const Text &name, const Attributes &a, bool closed, int line)
+            {
+                Frame &parent = stack_.back();
+                if (!root_seen_)
+                {
+                    root_seen_ = true;
+                    stats_.dimensions = {(int)number(a.width), (int)number(a.height)};
+                    stats_.canvas_area = (double)stats_.dimensions.x * stats_.dimensions.y;
+                    double scale = parent.scale;
+                    stack_.emplace_back(scale, 0);
+                    if (closed)
+                    {
+                        end();
+                    }
+                    return;
+                }
+
+                Tag tag = classify(name);
+                if (tag == OTHER)
+                {
+                    other_tags_[name.str()]++;
+                }
+                else
+                {
+                    tag_counts_[tag]++;
+                }
+                stats_.elements++;
+                double scale = parent.scale;
+                if (!a.transform.empty())
+                {
+                    const char *s = std::search(a.transform.begin, a.transform.end, "scale(", "scale(" + 6);
+                    if (s != a.transform.end)
+                    {
+                        scale *= number({s + 6, a.transform.end}, 1);
+                    }
+                }
+                int groups = parent.groups + (tag == G ? 1 : 0);
+                stats_.max_group_depth = std::max(stats_.max_group_depth, groups);
+                add_color(a.fill);
+                add_color(a.stroke);
+
+                // Vertices and fill estimate of the element itself.
+                uint64_t vertices = 0;
+                double area = 0;
+                double stroke_width = number(a.stroke_width, 1);
+                switch (tag)
+                {
+                case RECT:
+                    vertices = 4;
+                    area = number(a.width) * number(a.height);
+                    break;
+                case CIRCLE:
+                    area = 4 * number(a.r) * number(a.r);
+                    break;
+                case ELLIPSE:
+                    area = 4 * number(a.rx) * number(a.ry);
+                    break;
+                case LINE:
+                    vertices = 2;
+                    area = stroke_pixels(number(a.x2) - number(a.x1), number(a.y2) - number(a.y1), stroke_width);
+                    break;
+                case POLYLINE:
+                case POLYGON:
+                {
+                    Extent extent;
+                    double px = 0, py = 0, x, y;
+                    for (const char *p = a.points.begin; p < a.points.end;)
+                    {
+                        if (!read_number(p, a.points.end, x) || !read_number(p, a.points.end, y))
+                        {
+                            p++;
+                            continue;
+                        }
+                        if (tag == POLYLINE && vertices > 0)
+                        {
+                            area += stroke_pixels(x - px, y - py, stroke_width);
+                        }
+                        extent.extend(x, y);
+                        px = x;
+                        py = y;
+                        vertices++;
+                    }
+                    if (tag == POLYGON)
+                    {
+                        area = extent.area();
+                    }
+                    break;
+                }
+                case PATH:
+                {
+                    Extent extent;
+                    vertices = path_points(a.d, extent);
+                    bool filled = !(a.fill == "none");
+                    bool stroked = !a.stroke.empty() && !(a.stroke == "none");
+                    area = (filled ? extent.area() : 0) + (stroked ? extent.perimeter() * stroke_width : 0);
+                    break;
+                }
+                default:
+                    break;
+                }
+                stats_.vertices += vertices;
+                if (vertices > stats_.max_vertices)
+                {
+                    stats_.max_vertices = vertices;
+                    stats_.max_vertices_line = line;
+                }
+
+                stack_.emplace_back(scale, groups);
+                Frame &frame = stack_.back();
+                frame.id = a.id.str();
+                frame.area = area * scale * scale;
+                frame.container = tag == G;
+                if (tag == USE)
+                {
+                    stats_.uses++;
+                    if (!a.href.empty() && *a.href.begin == '#')
+                    {
+                        std::string target(a.href.begin + 1, a.href.end);
+                        fan_out_[target]++;
+                        frame.uses.reset(new std::unordered_map<std::string, uint64_t>());
+                        (*frame.uses)[target]++;
+                    }
+                }
+                else if (tag != OTHER)
+                {
+                    frame.elements = 1;
+                }
+                if (closed)
+                {
+                    end();
+                }
+            }
+
+            void end()
+            {
+                if (stack_.size() <= 1)
+                {
+                    return;
+                }
+                Frame frame = std::move(stack_.back());
+                stack_.pop_back();
+                if (!frame.id.empty())
+                {
+                    Definition &def = definitions_[frame.id];
+                    def = {frame.elements, frame.area, {}, 0, 0, 0, false};
+                    if (frame.uses)
+                    {
+                        def.uses = *frame.uses;
+                    }
+                }
+                Frame &parent = stack_.back();
+                if (!parent.container)
+                {
+                    return;
+                }
+                parent.elements += frame.elements;
+                parent.area += frame.area;
+                if (!frame.uses)
+                {
+                    return;
+                }
+                if (!parent.uses)
+                {
+                    parent.uses = std::move(frame.uses);
+                    return;
+                }
+                for (const auto &use : *frame.uses)
+                {
+                    (*parent.uses)[use.first] += use.second;
+                }
+            }
+
+            void finish()
+            {
+                while (stack_.size() > 1)
+                {
+                    end();
+                }
+                for (int t = G; t < OTHER; t++)
+                {
+                    if (tag_counts_[t] > 0)
+                    {
+                        stats_.tags[TAG_NAMES[t]] = tag_counts_[t];
+                    }
+                }
+                stats_.tags.insert(other_tags_.begin(), other_tags_.end());
+                for (const auto &f : fan_out_)
+                {
+                    if (definitions_.find(f.first) == definitions_.end())
+                    {
+                        stats_.unresolved_uses += f.second;
+                    }
+                    if (f.second > stats_.max_fan_out)
+                    {
+                        stats_.max_fan_out = f.second;
+                        stats_.max_fan_out_id = f.first;
+                    }
+                }
+                stats_.colors = rgb_count_ + other_colors_.size();
+
+                const Frame &document = stack_[0];
+                stats_.drawn_elements = document.elements;
+                stats_.expanded_elements = (double)document.elements;
+                stats_.fill_pixels = document.area;
+                if (document.uses)
+                {
+                    for (const auto &use : *document.uses)
+                    {
+                        const Definition *target = expand(use.first);
+                        if (target != nullptr)
+                        {
+                            stats_.expanded_elements += use.second * target->expanded_elements;
+                            stats_.fill_pixels += use.second * target->expanded_area;
+                        }
+                    }
+                }
+            }
+
+        private:
+            //! Compute the expanded totals of a <use> target.
+            //! @param id Target id.
+            //! @return The target, or nullptr if missing or part of a cycle.
+            const Definition *expand(const std::string &id)
+            {
+                auto it = definitions_.find(id);
+                if (it == definitions_.end())
+                {
+                    return nullptr;
+                }
+                Definition &def = it->second;
+                if (def.state == 1)
+                {
+                    // Every definition from this one to the innermost one
+                    // being expanded is on the cycle.
+                    stats_.cyclic = true;
+                    auto cycle = std::find(expanding_.begin(), expanding_.end(), &def);
+                    for (; cycle != expanding_.end(); ++cycle)
+                    {
+                        (*cycle)->cyclic = true;
+                    }
+                    return nullptr;
+                }
+                if (def.state == 0)
+                {
+                    def.state = 1;
+                    expanding_.push_back(&def);
+                    def.expanded_elements = (double)def.elements;
+                    def.expanded_area = def.area;
+                    for (const auto &use : def.uses)
+                    {
+                        const Definition *target = expand(use.first);
+                        if (target != nullptr)
+                        {
+                            def.expanded_elements += use.second * target->expanded_elements;
+                            def.expanded_area += use.second * target->expanded_area;
+                        }
+                    }
+                    def.state = 2;
+                    expanding_.pop_back();
+                }
+                return def.cyclic ? nullptr : &def;
+            }
+
+            void add_rgb(uint32_t rgb)
+            {
+                uint64_t &word = rgb_seen_[rgb / 64];
+                uint64_t bit = 1ULL << (rgb % 64);
+                rgb_count_ += (word & bit) == 0;
+                word |= bit;
+            }
+
+            void add_color(const Text &t)
+            {
+                if (t.empty() || t == "none")
+                {
+                    return;
+                }
+                if (*t.begin == '#' && (t.end - t.begin == 7 || t.end - t.begin == 4))
+                {
+                    uint32_t rgb = 0;
+                    bool valid = true;
+                    for (const char *p = t.begin + 1; p < t.end; p++)
+                    {
+                        char c = *p | 0x20;
+                        int digit = is_digit(*p) ? *p - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+                        valid = valid && digit >= 0;
+                        // #rgb stands for #rrggbb.
+                        rgb = t.end - t.begin == 4 ? rgb << 8 | digit * 17 : rgb << 4 | digit;
+                    }
+                    if (valid)
+                    {
+                        add_rgb(rgb);
+                        return;
+                    }
+                }
+                std::string name = t.str();
+                auto known = named_.find(name);
+                if (known == named_.end())
+                {
+                    try
+                    {
+                        Color c = parse_color(name);
+                        known = named_.insert({name, (long)c.red << 16 | c.green << 8 | c.blue}).first;
+                    }
+                    catch (const std::exception &)
+                    {
+                        known = named_.insert({name, -1}).first;
+                    }
+                }
+                if (known->second >= 0)
+                {
+                    add_rgb((uint32_t)known->second);
+                }
+                else
+                {
+                    other_colors_.insert(name);
+                }
+            }
+
+            SceneStats &stats_;
+            std::vector<Frame> stack_;
+            uint64_t tag_counts_[OTHER];
+            std::map<std::string, uint64_t> other_tags_;
+            bool root_seen_;
+            std::unordered_map<std::string, Definition> definitions_;
+            //! Definitions being expanded, outermost first.
+            std::vector<Definition *> expanding_;
+            std::unordered_map<std::string, uint64_t> fan_out_;
+            //! One bit per RGB color seen (2 MiB), and their number.
+            std::vector<uint64_t> rgb_seen_;
+            size_t rgb_count_;
+            //! Colors given by name: RGB, or -1 if unknown.
+            std::unordered_map<std::string, long> named_;
+            std::unordered_set<std::string> other_colors_;
+        };
+
+        //! Position just past the next occurrence of a delimiter, or end.
+        const char *skip_past(const char *p, const char *end, const char *delimiter)
+        {
+            size_t n = strlen(delimiter);
+            const char *found = std::search(p, end, delimiter, delimiter + n);
+            return found == end ? end : found + n;
+        }
+    }
+
+    SceneStats::SceneStats()
+        : dimensions{0, 0}, elements(0), vertices(0), max_vertices(0), max_vertices_line(0),
+          max_group_depth(0), uses(0), max_fan_out(0), unresolved_uses(0), cyclic(false),
+          drawn_elements(0), expanded_elements(0), canvas_area(0), fill_pixels(0), colors(0)
+    {
+    }
+
+    SceneStats analyze_svg(const char *data, size_t size)
+    {
+        SceneStats stats;
+        Analyzer analyzer(stats);
+        const char *p = data, *end = data + size;
+        const char *counted = data;
+        int line = 1;
+        const Attributes none = Attributes();
+        while (p < end)
+        {
+            const char *lt = (const char *)memchr(p, '<', end - p);
+            if (lt == nullptr || lt + 1 >= end)
+            {
+                break;
+            }
+            p = lt + 1;
+            if (*p == '!')
+            {
+                if (end - p >= 3 && memcmp(p, "!--", 3) == 0)
+                {
+                    p = skip_past(p + 3, end, "-->");
+                }
+                else if (end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0)
+                {
+                    p = skip_past(p + 8, end, "]]>");
+                }
+                else
+                {
+                    // Declaration, e.g. <!DOCTYPE ... [ ... ]>.
+                    for (int brackets = 0; p < end && (*p != '>' || brackets > 0); p++)
+                    {
+                        brackets += *p == '[' ? 1 : *p == ']' ? -1 : 0;
+                    }
+                    p = std::min(end, p + 1);
+                }
+                continue;
+            }
+            if (*p == '?')
+            {
+                p = skip_past(p, end, "?>");
+                continue;
+            }
+            if (*p == '/')
+            {
+                p = skip_past(p, end, ">");
+                analyzer.end();
+                continue;
+            }
+
+            // Start tag: name, attributes, then > or />.
+            Text name = {p, p};
+            while (p < end && !is_space(*p) && *p != '/' && *p != '>')
+            {
+                p++;
+            }
+            name.end = p;
+            Attributes attributes = none;
+            bool closed = false, complete = false;
+            while (p < end)
+            {
+                if (is_space(*p))
+                {
+                    p++;
+                    continue;
+                }
+                if (*p == '>')
+                {
+                    p++;
+                    complete = true;
+                    break;
+                }
+                if (*p == '/')
+                {
+                    p++;
+                    closed = complete = p < end && *p == '>';
+                    p += complete ? 1 : 0;
+                    break;
+                }
+                Text attribute = {p, p};
+                while (p < end && *p != '=' && !is_space(*p) && *p != '>' && *p != '/')
+                {
+                    p++;
+                }
+                attribute.end = p;
+                while (p < end && is_space(*p))
+                {
+                    p++;
+                }
+                if (p >= end || *p != '=')
+                {
+                    continue;
+                }
+                for (p++; p < end && is_space(*p); p++)
+                {
+                }
+                if (p >= end || (*p != '"' && *p != '\''))
+                {
+                    continue;
+                }
+                const char *close = (const char *)memchr(p + 1, *p, end - p - 1);
+                if (close == nullptr)
+                {
+                    p = end;
+                    break;
+                }
+                attributes.set(attribute, {p + 1, close});
+                p = close + 1;
+            }
+            if (!complete)
+            {
+                break;
+            }
+            line += (int)std::count(counted, lt, '\n');
+            counted = lt;
+            analyzer.start(name, attributes, closed, line);
+        }
+        analyzer.finish();
+        return stats;
+    }
+
+    SceneStats analyze_svg(const std::string &svg_file)
+    {
+        std::shared_ptr<const MappedFile> file = MappedFile::open(svg_file);
+        if (is_gzip(file->data(), file->size()))
+        {
+            std::vector<char> text = gunzip(file->data(), file->size());
+            return analyze_svg(text.data(), text.size());
+        }
+        return analyze_svg(file->data(), file->size());
+    }
+
+    void SceneStats::print(std::ostream &out) const
+    {
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(0);
+        out << "canvas          " << dimensions.x << " x " << dimensions.y << " (" << canvas_area << " pixels)\n";
+        out << "elements        " << elements;
+        const char *separator = ": ";
+        for (const auto &tag : tags)
+        {
+            out << separator << tag.first << ' ' << tag.second;
+            separator = ", ";
+        }
+        out << "\nvertices        " << vertices << " total, at most " << max_vertices;
+        if (max_vertices > 0)
+        {
+            out << " (line " << max_vertices_line << ')';
+        }
+        out << "\ngroup depth     " << max_group_depth << '\n';
+        out << "<use>           " << uses;
+        if (max_fan_out > 0)
+        {
+            out << ", at most " << max_fan_out << " referring to #" << max_fan_out_id;
+        }
+        if (unresolved_uses > 0)
+        {
+            out << ", " << unresolved_uses << " unresolved";
+        }
+        if (cyclic)
+        {
+            out << ", cyclic references";
+        }
+        out << "\ndrawn           " << drawn_elements << " elements, " << expanded_elements
+            << " once <use> is expanded\n";
+        out << "fill estimate   " << fill_pixels << " pixels";
+        if (canvas_area > 0)
+        {
+            out << std::setprecision(1) << " (" << fill_pixels / canvas_area << "x the canvas)";
+        }
+        out << "\ncolors          " << colors << '\n';
+        out.flags(flags);
+    }
+}
@@ -0,0 +1,81 @@
+//! @file SceneStats.hpp
+#ifndef __svg_SceneStats_hpp__
+#define __svg_SceneStats_hpp__
+
+#include "Point.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+namespace svg
+{
+    //! Cost estimate of an SVG document, gathered without building or
+    //! drawing its elements (see analyze_svg).
+    struct SceneStats
+    {
+        SceneStats();
+        //! Canvas size, from the root element.
+        Point dimensions;
+        //! Number of elements by tag, the root <svg> excluded.
+        std::map<std::string, uint64_t> tags;
+        //! Number of elements, as written.
+        uint64_t elements;
+        //! Vertices of polygons, polylines, lines, rectangles and paths
+        //! (a path counts one per end and control point).
+        uint64_t vertices;
+        //! Most vertices in one element, and its source line.
+        uint64_t max_vertices;
+        int max_vertices_line;
+        //! Deepest nesting of <g> elements.
+        int max_group_depth;
+        //! Number of <use> elements.
+        uint64_t uses;
+        //! Most <use> elements referring to one id, and that id.
+        uint64_t max_fan_out;
+        std::string max_fan_out_id;
+        //! <use> elements whose target does not exist.
+        uint64_t unresolved_uses;
+        //! True if some element refers to itself through <use> elements
+        //! (such references expand to nothing).
+        bool cyclic;
+        //! Number of elements drawn where they are written: <use> elements,
+        //! unknown elements, and the contents of elements other than <g>
+        //! (e.g. <defs>) excluded.
+        uint64_t drawn_elements;
+        //! Number of elements once every <use> is replaced by a copy of
+        //! its target, recursively: the elements a renderer draws.
+        double expanded_elements;
+        //! Canvas area, in pixels.
+        double canvas_area;
+        //! Estimated pixels filled when drawing, <use> expanded: the sum
+        //! of the bounding box areas of filled shapes and of the lengths
+        //! of stroked lines, times their scale transforms. Overlaps and
+        //! parts off the canvas count too, so this is an upper bound.
+        double fill_pixels;
+        //! Number of distinct fill and stroke colors.
+        size_t colors;
+
+        //! Print a report.
+        //! @param out Output stream.
+        void print(std::ostream &out) const;
+    };
+
+    //! Analyze an SVG document in one pass over its text, without building
+    //! a tree: memory use depends on the number of ids, <use> targets and
+    //! colors, not on the document size.
+    //! @param data Document text (it need not be null-terminated).
+    //! @param size Size in bytes.
+    //! @return Statistics.
+    SceneStats analyze_svg(const char *data, size_t size);
+
+    //! Analyze an SVG file, memory-mapped (gzip-compressed files are
+    //! inflated into memory first).
+    //! Throws std::runtime_error if the file can not be read.
+    //! @param svg_file File name.
+    //! @return Statistics.
+    SceneStats analyze_svg(const std::string &svg_file);
+}
+#endif
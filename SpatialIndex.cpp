@@ -0,0 +1,302 @@
+//! @file SpatialIndex.cpp
+#include "SpatialIndex.hpp"
+#include "SVGElements.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace svg
+{
+    namespace
+    {
+        //! Items per hierarchy leaf.
+        const uint32_t LEAF_SIZE = 4;
+        //! Largest number of grid cells an item may span, per axis.
+        const long MAX_SPAN = 4;
+
+        bool contains(const BoundingBox &box, int x, int y)
+        {
+            return box.min.x <= x && x <= box.max.x && box.min.y <= y && y <= box.max.y;
+        }
+    }
+
+    SpatialIndex::SpatialIndex(const std::vector<SVGElement *> &elements)
+        : origin_{0, 0}, cell_size_(1), columns_(0), rows_(0)
+    {
+        std::vector<Item> items;
+        for (SVGElement *e : elements)
+        {
+            collect(e, items);
+        }
+        build_grid(items);
+        if (!large_.empty())
+        {
+            nodes_.reserve(2 * large_.size() / LEAF_SIZE + 1);
+            build(0, (uint32_t)large_.size());
+        }
+    }
+
+    void SpatialIndex::collect(SVGElement *e, std::vector<Item> &items)
+    {
+        Group *g = dynamic_cast<Group *>(e);
+        if (g != nullptr)
+        {
+            for (SVGElement *member : g->getElements())
+            {
+                collect(member, items);
+            }
+            return;
+        }
+        BoundingBox box = e->bounding_box();
+        if (!box.empty())
+        {
+            items.push_back({box, (uint32_t)elements_.size()});
+            elements_.push_back(e);
+        }
+    }
+
+    void SpatialIndex::build_grid(const std::vector<Item> &items)
+    {
+        if (items.empty())
+        {
+            return;
+        }
+        BoundingBox bounds = BoundingBox::none();
+        for (const Item &item : items)
+        {
+            bounds.extend(item.box);
+        }
+        // About one cell per item.
+        double width = (double)bounds.max.x - bounds.min.x + 1;
+        double height = (double)bounds.max.y - bounds.min.y + 1;
+        cell_size_ = std::max(1, (int)std::ceil(std::sqrt(width * height / items.size())));
+        origin_ = bounds.min;
+        columns_ = (int)std::ceil(width / cell_size_);
+        rows_ = (int)std::ceil(height / cell_size_);
+
+        // Count, then place the items (counting sort by cell).
+        std::vector<uint32_t> count((size_t)columns_ * rows_ + 1, 0);
+        std::vector<bool> small(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const BoundingBox &b = items[i].box;
+            long x0 = ((long)b.min.x - origin_.x) / cell_size_, x1 = ((long)b.max.x - origin_.x) / cell_size_;
+            long y0 = ((long)b.min.y - origin_.y) / cell_size_, y1 = ((long)b.max.y - origin_.y) / cell_size_;
+            small[i] = x1 - x0 < MAX_SPAN && y1 - y0 < MAX_SPAN;
+            if (!small[i])
+            {
+                large_.push_back(items[i]);
+                continue;
+            }
+            for (long y = y0; y <= y1; y++)
+            {
+                for (long x = x0; x <= x1; x++)
+                {
+                    count[y * columns_ + x]++;
+                }
+            }
+        }
+        cell_start_.assign(count.size(), 0);
+        for (size_t c = 1; c < count.size(); c++)
+        {
+            cell_start_[c] = cell_start_[c - 1] + count[c - 1];
+        }
+        cell_items_.resize(cell_start_.back());
+        // Walking the items backwards leaves each cell topmost first.
+        std::vector<uint32_t> fill(cell_start_.begin(), cell_start_.end());
+        for (size_t i = items.size(); i-- > 0;)
+        {
+            if (!small[i])
+            {
+                continue;
+            }
+            const BoundingBox &b = items[i].box;
+            long x0 = ((long)b.min.x - origin_.x) / cell_size_, x1 = ((long)b.max.x - origin_.x) / cell_size_;
+            long y0 = ((long)b.min.y - origin_.y) / cell_size_, y1 = ((long)b.max.y - origin_.y) / cell_size_;
+            for (long y = y0; y <= y1; y++)
+            {
+                for (long x = x0; x <= x1; x++)
+                {
+                    cell_items_[fill[y * columns_ + x]++] = items[i];
+                }
+            }
+        }
+    }
+
+    uint32_t SpatialIndex::build(uint32_t begin, uint32_t end)
+    {
+        uint32_t index = (uint32_t)nodes_.size();
+        nodes_.push_back(Node());
+        BoundingBox box = BoundingBox::none();
+        uint32_t top = 0;
+        for (uint32_t i = begin; i < end; i++)
+        {
+            box.extend(large_[i].box);
+            top = std::max(top, large_[i].order);
+        }
+        nodes_[index].box = box;
+        nodes_[index].top = top;
+        if (end - begin <= LEAF_SIZE)
+        {
+            nodes_[index].first = begin;
+            nodes_[index].count = end - begin;
+            return index;
+        }
+
+        // Split at the median center along the longer axis.
+        bool split_x = (long)box.max.x - box.min.x >= (long)box.max.y - box.min.y;
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(large_.begin() + begin, large_.begin() + middle, large_.begin() + end,
+                         [split_x](const Item &a, const Item &b) {
+                             return split_x ? (long)a.box.min.x + a.box.max.x < (long)b.box.min.x + b.box.max.x
+                                            : (long)a.box.min.y + a.box.max.y < (long)b.box.min.y + b.box.max.y;
+                         });
+        build(begin, middle);
+        uint32_t right = build(middle, end);
+        nodes_[index].first = right;
+        nodes_[index].count = 0;
+        return index;
+    }
+
+    long SpatialIndex::cell(int x, int y) const
+    {
+        long cx = (long)x - origin_.x, cy = (long)y - origin_.y;
+        if (cx < 0 || cy < 0 || cx >= (long)columns_ * cell_size_ || cy >= (long)rows_ * cell_size_)
+        {
+            return -1;
+        }
+        return cy / cell_size_ * columns_ + cx / cell_size_;
+    }
+
+    SVGElement *SpatialIndex::query_point(int x, int y) const
+    {
+        bool found = false;
+        uint32_t best = 0;
+        long c = cell(x, y);
+        if (c >= 0)
+        {
+            for (uint32_t i = cell_start_[c]; i < cell_start_[c + 1]; i++)
+            {
+                if (contains(cell_items_[i].box, x, y))
+                {
+                    best = cell_items_[i].order;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!nodes_.empty())
+        {
+            // Depth-first, towards the most recently drawn subtree first;
+            // subtrees drawn entirely below the best hit so far are skipped.
+            uint32_t stack[64];
+            size_t depth = 0;
+            stack[depth++] = 0;
+            while (depth > 0)
+            {
+                uint32_t index = stack[--depth];
+                const Node &n = nodes_[index];
+                if ((found && n.top <= best) || !contains(n.box, x, y))
+                {
+                    continue;
+                }
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.first; i < n.first + n.count; i++)
+                    {
+                        const Item &item = large_[i];
+                        if ((!found || item.order > best) && contains(item.box, x, y))
+                        {
+                            best = item.order;
+                            found = true;
+                        }
+                    }
+                    continue;
+                }
+                uint32_t left = index + 1;
+                uint32_t right = n.first;
+                if (nodes_[left].top > nodes_[right].top)
+                {
+                    std::swap(left, right);
+                }
+                stack[depth++] = left;
+                stack[depth++] = right;
+            }
+        }
+        return found ? elements_[best] : nullptr;
+    }
+
+    std::vector<SVGElement *> SpatialIndex::query_rect(const BoundingBox &box) const
+    {
+        std::vector<uint32_t> hits;
+        if (columns_ > 0 && !box.empty())
+        {
+            long x0 = std::max(0L, ((long)box.min.x - origin_.x) / cell_size_);
+            long y0 = std::max(0L, ((long)box.min.y - origin_.y) / cell_size_);
+            long x1 = std::min((long)columns_ - 1, ((long)box.max.x - origin_.x) / cell_size_);
+            long y1 = std::min((long)rows_ - 1, ((long)box.max.y - origin_.y) / cell_size_);
+            if ((long)box.max.x >= origin_.x && (long)box.max.y >= origin_.y)
+            {
+                for (long y = y0; y <= y1; y++)
+                {
+                    for (long x = x0; x <= x1; x++)
+                    {
+                        long c = y * columns_ + x;
+                        for (uint32_t i = cell_start_[c]; i < cell_start_[c + 1]; i++)
+                        {
+                            const BoundingBox &b = cell_items_[i].box;
+                            // Items spanning several cells are reported by
+                            // the cell holding the overlap's top-left corner.
+                            if (b.intersects(box) &&
+                                cell(std::max(b.min.x, box.min.x), std::max(b.min.y, box.min.y)) == c)
+                            {
+                                hits.push_back(cell_items_[i].order);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (!nodes_.empty())
+        {
+            uint32_t stack[64];
+            size_t depth = 0;
+            stack[depth++] = 0;
+            while (depth > 0)
+            {
+                uint32_t index = stack[--depth];
+                const Node &n = nodes_[index];
+                if (!n.box.intersects(box))
+                {
+                    continue;
+                }
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.first; i < n.first + n.count; i++)
+                    {
+                        if (large_[i].box.intersects(box))
+                        {
+                            hits.push_back(large_[i].order);
+                        }
+                    }
+                    continue;
+                }
+                stack[depth++] = n.first;
+                stack[depth++] = index + 1;
+            }
+        }
+        std::sort(hits.begin(), hits.end());
+        std::vector<SVGElement *> result;
+        result.reserve(hits.size());
+        for (uint32_t order : hits)
+        {
+            result.push_back(elements_[order]);
+        }
+        return result;
+    }
+
+    size_t SpatialIndex::size() const
+    {
+        return elements_.size();
+    }
+}
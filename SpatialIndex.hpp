@@ -0,0 +1,91 @@
+//! @file SpatialIndex.hpp
+#ifndef __svg_SpatialIndex_hpp__
+#define __svg_SpatialIndex_hpp__
+
+#include "Point.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    class SVGElement;
+
+    //! Index over the elements of a scene, for hit testing and region
+    //! queries: a uniform grid, sized for the elements, holding those that
+    //! span a few cells, and a bounding volume hierarchy holding the others.
+    //! Groups are indexed through their members, so queries return the
+    //! innermost elements. Hits are decided on bounding boxes. The index
+    //! refers to the elements and must not outlive them.
+    class SpatialIndex
+    {
+    public:
+        //! Build the index, in O(n log n).
+        //! @param elements Top-level elements, in painter's order (as
+        //! produced by readSVG).
+        SpatialIndex(const std::vector<SVGElement *> &elements);
+        //! Find the topmost element at a point.
+        //! @param x X position, in canvas coordinates.
+        //! @param y Y position, in canvas coordinates.
+        //! @return The element drawn last among those whose bounding box
+        //! contains the point, or nullptr.
+        SVGElement *query_point(int x, int y) const;
+        //! Find the elements that may draw to a region.
+        //! @param box Region, in canvas coordinates.
+        //! @return Elements whose bounding box intersects the region, in
+        //! painter's order.
+        std::vector<SVGElement *> query_rect(const BoundingBox &box) const;
+        //! Get the number of indexed elements.
+        //! @return Number of elements.
+        size_t size() const;
+
+    private:
+        //! An indexed element.
+        struct Item
+        {
+            BoundingBox box;
+            //! Position in painter's order.
+            uint32_t order;
+        };
+        //! A tree node. The left child of an inner node follows it.
+        struct Node
+        {
+            BoundingBox box;
+            //! Highest painter's order in the subtree.
+            uint32_t top;
+            //! Leaf: first item; inner node: right child.
+            uint32_t first;
+            //! Leaf: number of items; inner node: 0.
+            uint32_t count;
+        };
+
+        //! Add the leaves of an element, in painter's order.
+        void collect(SVGElement *e, std::vector<Item> &items);
+        //! Build the grid, moving items too large for it to large_.
+        void build_grid(const std::vector<Item> &items);
+        //! Build the subtree over large_[begin, end).
+        //! @return Index of the subtree's root.
+        uint32_t build(uint32_t begin, uint32_t end);
+        //! Get the grid cell holding a point.
+        //! @return Cell index, or -1 outside the grid.
+        long cell(int x, int y) const;
+
+        std::vector<SVGElement *> elements_;
+        //! Grid origin (top-left corner of cell 0).
+        Point origin_;
+        //! Cell width and height.
+        int cell_size_;
+        //! Grid size, in cells.
+        int columns_, rows_;
+        //! Start of each cell's items in cell_items_, plus the end.
+        std::vector<uint32_t> cell_start_;
+        //! Items of each cell, topmost first.
+        std::vector<Item> cell_items_;
+        //! Items in the hierarchy.
+        std::vector<Item> large_;
+        //! Hierarchy nodes (empty without large items).
+        std::vector<Node> nodes_;
+    };
+}
+#endif
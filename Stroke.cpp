@@ -0,0 +1,207 @@
+//! @file Stroke.cpp
+#include "Stroke.hpp"
+
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+
+namespace svg
+{
+    namespace
+    {
+        //! Largest distance, in device pixels, between a round join or
+        //! cap and its polygon.
+        const double TOLERANCE = 0.25;
+
+        struct Vec
+        {
+            double x, y;
+        };
+
+        Vec operator+(Vec a, Vec b) { return {a.x + b.x, a.y + b.y}; }
+        Vec operator-(Vec a, Vec b) { return {a.x - b.x, a.y - b.y}; }
+        Vec operator*(Vec a, double k) { return {a.x * k, a.y * k}; }
+        double dot(Vec a, Vec b) { return a.x * b.x + a.y * b.y; }
+        double cross(Vec a, Vec b) { return a.x * b.y - a.y * b.x; }
+
+        //! Collects rings, all wound the same way.
+        class RingBuilder
+        {
+        public:
+            RingBuilder(std::vector<Point> &rings, std::vector<size_t> &ring_ends)
+                : rings_(rings), ring_ends_(ring_ends) {}
+
+            void add(const Vec *v, size_t count)
+            {
+                double area = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    area += cross(v[i], v[(i + 1) % count]);
+                }
+                if (area == 0)
+                {
+                    return;
+                }
+                size_t start = rings_.size();
+                for (size_t i = 0; i < count; i++)
+                {
+                    const Vec &p = v[area > 0 ? i : count - 1 - i];
+                    // Halves round up, as path vertices do.
+                    rings_.push_back({(int)std::floor(p.x + 0.5), (int)std::floor(p.y + 0.5)});
+                }
+                if (rings_.size() - start < 3)
+                {
+                    rings_.resize(start);
+                    return;
+                }
+                ring_ends_.push_back(rings_.size());
+            }
+
+            void circle(Vec center, double radius)
+            {
+                // Enough sides for the chords to stay within the tolerance.
+                double step = 2 * std::acos(std::max(-1.0, 1 - TOLERANCE / radius));
+                int sides = std::max(8, std::min(1024, (int)std::ceil(2 * M_PI / step)));
+                circle_.resize(sides);
+                for (int i = 0; i < sides; i++)
+                {
+                    double a = 2 * M_PI * i / sides;
+                    circle_[i] = {center.x + radius * std::cos(a), center.y + radius * std::sin(a)};
+                }
+                add(circle_.data(), circle_.size());
+            }
+
+        private:
+            std::vector<Point> &rings_;
+            std::vector<size_t> &ring_ends_;
+            std::vector<Vec> circle_;
+        };
+    }
+
+    bool StrokeStyle::thin(double scale) const
+    {
+        return width <= 1 || width * scale <= 1;
+    }
+
+    void StrokeStyle::scale(int v)
+    {
+        if (width > 1)
+        {
+            width *= std::abs(v);
+        }
+    }
+
+    int StrokeStyle::extent() const
+    {
+        double reach = width / 2 * std::max(join == MITER_JOIN ? miter_limit : 1.0, M_SQRT2);
+        return (int)std::ceil(reach) + 1;
+    }
+
+    void stroke_outline(const Point *points, size_t count, bool closed,
+                        const StrokeStyle &style, double scale,
+                        std::vector<Point> &rings, std::vector<size_t> &ring_ends)
+    {
+        std::vector<Vec> v;
+        for (size_t i = 0; i < count; i++)
+        {
+            Vec p = {points[i].x * scale, points[i].y * scale};
+            if (v.empty() || p.x != v.back().x || p.y != v.back().y)
+            {
+                v.push_back(p);
+            }
+        }
+        if (closed && v.size() > 1 && v.front().x == v.back().x && v.front().y == v.back().y)
+        {
+            v.pop_back();
+        }
+        if (v.empty())
+        {
+            return;
+        }
+        RingBuilder out(rings, ring_ends);
+        double hw = style.width * scale / 2;
+
+        if (v.size() == 1)
+        {
+            // A zero-length line only shows its caps.
+            if (style.cap == StrokeStyle::ROUND_CAP)
+            {
+                out.circle(v[0], hw);
+            }
+            else if (style.cap == StrokeStyle::SQUARE_CAP)
+            {
+                Vec square[4] = {{v[0].x - hw, v[0].y - hw}, {v[0].x + hw, v[0].y - hw},
+                                 {v[0].x + hw, v[0].y + hw}, {v[0].x - hw, v[0].y + hw}};
+                out.add(square, 4);
+            }
+            return;
+        }
+
+        size_t segments = closed ? v.size() : v.size() - 1;
+        for (size_t i = 0; i < segments; i++)
+        {
+            Vec a = v[i], b = v[(i + 1) % v.size()];
+            Vec d = b - a;
+            d = d * (1 / std::sqrt(dot(d, d)));
+            Vec n = {-d.y * hw, d.x * hw};
+            if (!closed && style.cap == StrokeStyle::SQUARE_CAP)
+            {
+                if (i == 0)
+                {
+                    a = a - d * hw;
+                }
+                if (i + 1 == segments)
+                {
+                    b = b + d * hw;
+                }
+            }
+            Vec quad[4] = {a + n, b + n, b - n, a - n};
+            out.add(quad, 4);
+        }
+
+        if (!closed && style.cap == StrokeStyle::ROUND_CAP)
+        {
+            out.circle(v.front(), hw);
+            out.circle(v.back(), hw);
+        }
+
+        size_t first = closed ? 0 : 1;
+        size_t last = closed ? v.size() : v.size() - 1;
+        for (size_t i = first; i < last; i++)
+        {
+            Vec p = v[i];
+            Vec d0 = p - v[(i + v.size() - 1) % v.size()];
+            Vec d1 = v[(i + 1) % v.size()] - p;
+            d0 = d0 * (1 / std::sqrt(dot(d0, d0)));
+            d1 = d1 * (1 / std::sqrt(dot(d1, d1)));
+            double turn = cross(d0, d1);
+            if (std::fabs(turn) < 1e-12 && dot(d0, d1) > 0)
+            {
+                continue;   // straight through, the quads already meet
+            }
+            if (style.join == StrokeStyle::ROUND_JOIN)
+            {
+                out.circle(p, hw);
+                continue;
+            }
+            // The join fills the gap on the outer side of the turn.
+            double side = turn > 0 ? -1 : 1;
+            Vec n0 = Vec{-d0.y, d0.x} * (hw * side);
+            Vec n1 = Vec{-d1.y, d1.x} * (hw * side);
+            Vec sum = n0 + n1;
+            double len2 = dot(sum, sum);
+            if (style.join == StrokeStyle::MITER_JOIN && len2 > 0 &&
+                2 * hw * hw / std::sqrt(len2) <= style.miter_limit * hw)
+            {
+                Vec miter = sum * (2 * hw * hw / len2);
+                Vec quad[4] = {p, p + n0, p + miter, p + n1};
+                out.add(quad, 4);
+            }
+            else
+            {
+                Vec triangle[3] = {p, p + n0, p + n1};
+                out.add(triangle, 3);
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+//! @file Stroke.hpp
+#ifndef __svg_Stroke_hpp__
+#define __svg_Stroke_hpp__
+
+#include "Point.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace svg
+{
+    //! How lines are stroked (stroke-width, stroke-linejoin,
+    //! stroke-linecap and stroke-miterlimit).
+    struct StrokeStyle
+    {
+        //! Shape drawn where two segments meet.
+        enum Join { MITER_JOIN, ROUND_JOIN, BEVEL_JOIN };
+        //! Shape drawn at the ends of an open line.
+        enum Cap { BUTT_CAP, ROUND_CAP, SQUARE_CAP };
+
+        //! Constructor, with the SVG defaults.
+        StrokeStyle() : width(1), join(MITER_JOIN), cap(BUTT_CAP), miter_limit(4) {}
+        //! Check if lines are drawn one pixel wide at a scale, as thin
+        //! (Bresenham) lines instead of outlines.
+        //! @param scale Scale applied to canvas coordinates.
+        //! @return True for hairlines.
+        bool thin(double scale) const;
+        //! Scale the width with the geometry. Hairlines (width up to 1)
+        //! stay one pixel wide, as transformed lines always were.
+        //! @param v Scale amount.
+        void scale(int v);
+        //! Get how far the stroke may reach beyond the line's vertices.
+        //! @return Distance, in canvas units.
+        int extent() const;
+
+        //! Line width, in canvas units.
+        double width;
+        //! Join style.
+        Join join;
+        //! Cap style.
+        Cap cap;
+        //! Largest ratio of miter length to width before a miter join
+        //! falls back to a bevel.
+        double miter_limit;
+    };
+
+    //! Build the outline of a wide line as polygon rings, to be filled
+    //! with the nonzero rule (see PNGImage::draw_device_rings).
+    //! There is one ring per segment, join and cap, all wound the same
+    //! way, so their union is filled in a single pass and pixels where
+    //! they overlap are written once.
+    //! @param points Line vertices.
+    //! @param count Number of vertices.
+    //! @param closed Join the last vertex back to the first (no caps).
+    //! @param style Stroke style.
+    //! @param scale Scale from the vertices' units to device pixels.
+    //! @param rings Receives the ring vertices, in device coordinates.
+    //! @param ring_ends Receives the index one past the last vertex of each ring.
+    void stroke_outline(const Point *points, size_t count, bool closed,
+                        const StrokeStyle &style, double scale,
+                        std::vector<Point> &rings, std::vector<size_t> &ring_ends);
+}
+#endif
@@ -0,0 +1,739 @@
+// Project file headers
+#include "SVGElements.hpp"
+#include "MappedFile.hpp"
+#include "Gzip.hpp"
+#include "BinaryScene.hpp"
+#include "SpatialIndex.hpp"
+#include "SceneStats.hpp"
+#include "Profiler.hpp"
+#include "external/tinyxml2/tinyxml2.h"
+
+// C++ library headers
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// POSIX headers
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+namespace svg
+{
+    //! Benchmark scenes and measurements, run by name prefix.
+    class BenchDriver
+    {
+    private:
+        string root_path;
+
+        static double now_ms()
+        {
+            return chrono::duration<double, milli>(
+                       chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        //! Peak resident set size of this process, in KiB.
+        static long peak_rss_kb()
+        {
+            ifstream status("/proc/self/status");
+            string line;
+            while (getline(status, line))
+            {
+                if (line.compare(0, 6, "VmHWM:") == 0)
+                {
+                    return atol(line.c_str() + 6);
+                }
+            }
+            return 0;
+        }
+
+        //! Write a scene with n elements of each basic kind.
+        string write_scene(const string &name, int n)
+        {
+            string file = root_path + "/output/" + name + ".svg";
+            ofstream out(file);
+            int size = 2000;
+            out << "<svg width=\"" << size << "\" height=\"" << size
+                << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+            srand(42);
+            for (int i = 0; i < n; i++)
+            {
+                int x = rand() % size, y = rand() % size;
+                out << "<rect x=\"" << x << "\" y=\"" << y << "\" width=\"" << 1 + rand() % 50
+                    << "\" height=\"" << 1 + rand() % 50 << "\" fill=\"#" << hex << setw(6)
+                    << setfill('0') << (rand() & 0xFFFFFF) << dec << "\"/>\n";
+                out << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << 1 + rand() % 20
+                    << "\" fill=\"red\"/>\n";
+                out << "<polyline points=\"";
+                for (int k = 0; k < 8; k++)
+                {
+                    out << (x + rand() % 40) % size << ',' << (y + rand() % 40) % size << ' ';
+                }
+                out << "\" stroke=\"blue\"/>\n";
+                out << "<polygon points=\"" << x << ',' << y << ' ' << (x + 30) % size << ','
+                    << y << ' ' << x << ',' << (y + 30) % size << "\" fill=\"green\"/>\n";
+            }
+            out << "</svg>\n";
+            return file;
+        }
+
+        //! Write a grid of n x n copies of an icon, as <use> instances or
+        //! as repeated inline groups.
+        string write_icon_grid(const string &name, int n, bool use)
+        {
+            string file = root_path + "/output/" + name + ".svg";
+            ofstream out(file);
+            out << "<svg width=\"" << n * 20 << "\" height=\"" << n * 20
+                << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+            string icon = "<circle cx=\"8\" cy=\"8\" r=\"7\" fill=\"blue\"/>"
+                          "<polygon points=\"3,3 13,5 8,14\" fill=\"yellow\"/>"
+                          "<rect x=\"6\" y=\"6\" width=\"4\" height=\"4\" fill=\"red\"/>";
+            out << "<g id=\"icon\">" << icon << "</g>\n";
+            for (int i = 0; i < n * n; i++)
+            {
+                int x = (i % n) * 20, y = (i / n) * 20;
+                if (use)
+                {
+                    out << "<use href=\"#icon\" transform=\"translate(" << x << "," << y << ")\"/>\n";
+                }
+                else
+                {
+                    out << "<g transform=\"translate(" << x << "," << y << ")\">" << icon << "</g>\n";
+                }
+            }
+            out << "</svg>\n";
+            return file;
+        }
+
+        //! Write a scene with n curved paths (cubic and quadratic
+        //! curves and arcs).
+        string write_paths(const string &name, int n)
+        {
+            string file = root_path + "/output/" + name + ".svg";
+            ofstream out(file);
+            int size = 2000;
+            out << "<svg width=\"" << size << "\" height=\"" << size
+                << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+            srand(42);
+            for (int i = 0; i < n; i++)
+            {
+                int x = rand() % size, y = rand() % size, r = 5 + rand() % 60;
+                out << "<path d=\"M" << x << ',' << y << " c" << r << ',' << -r << ' ' << 2 * r
+                    << ',' << r << ' ' << 3 * r << ",0 s" << r << ',' << 2 * r << ' ' << -r << ','
+                    << 2 * r << " q" << -r << ',' << r << ' ' << -2 * r << ",0 a" << r << ',' << r / 2
+                    << " 30 1 1 " << -r << ',' << -r << "z\" fill=\"#" << hex << setw(6)
+                    << setfill('0') << (rand() & 0xFFFFFF) << dec << "\" stroke=\"black\"/>\n";
+            }
+            out << "</svg>\n";
+            return file;
+        }
+
+        //! Write a scene with n small polygons of many vertices (circles
+        //! of 64 vertices, 4 to 24 units across).
+        string write_detail(const string &name, int n)
+        {
+            string file = root_path + "/output/" + name + ".svg";
+            ofstream out(file);
+            int size = 2000;
+            out << "<svg width=\"" << size << "\" height=\"" << size
+                << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+            srand(42);
+            for (int i = 0; i < n; i++)
+            {
+                int x = rand() % size, y = rand() % size, r = 2 + rand() % 11;
+                out << "<polygon points=\"";
+                for (int k = 0; k < 64; k++)
+                {
+                    out << x + (int)lround(r * cos(k * M_PI / 32)) << ','
+                        << y + (int)lround(r * sin(k * M_PI / 32)) << ' ';
+                }
+                out << "\" fill=\"blue\"/>\n";
+            }
+            out << "</svg>\n";
+            return file;
+        }
+
+        //! Run a measurement in a child process, so that its peak RSS
+        //! is not affected by other measurements.
+        template <typename F>
+        void measure(const string &label, int iterations, F f)
+        {
+            cout.flush();
+            ::pid_t pid = ::fork();
+            if (pid == 0)
+            {
+                long rss_before = peak_rss_kb();
+                double start = now_ms();
+                for (int i = 0; i < iterations; i++)
+                {
+                    f();
+                }
+                double elapsed = (now_ms() - start) / iterations;
+                cout << "  " << left << setw(28) << label << right
+                     << fixed << setprecision(3) << setw(10) << elapsed << " ms"
+                     << setw(10) << peak_rss_kb() - rss_before << " KiB peak RSS growth" << endl;
+                // exit rather than _exit, so that instrumented builds
+                // write their profile (see make pgo).
+                exit(0);
+            }
+            int child_status;
+            ::waitpid(pid, &child_status, 0);
+        }
+
+        void bench_load()
+        {
+            string file = write_scene("bench_load", 50000);
+            cout << "load: " << file << endl;
+            measure("tinyxml2 LoadFile", 5, [&]() {
+                tinyxml2::XMLDocument doc;
+                doc.LoadFile(file.c_str());
+            });
+            measure("mmap + Parse (cold map)", 5, [&]() {
+                MappedFile::clear_cache();
+                shared_ptr<const MappedFile> m = MappedFile::open(file);
+                tinyxml2::XMLDocument doc;
+                doc.Parse(m->data(), m->size());
+            });
+            measure("mmap + Parse (cached map)", 5, [&]() {
+                shared_ptr<const MappedFile> m = MappedFile::open(file);
+                tinyxml2::XMLDocument doc;
+                doc.Parse(m->data(), m->size());
+            });
+            measure("readSVG", 5, [&]() {
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(file, dimensions, elements);
+                for (SVGElement *e : elements)
+                {
+                    delete e;
+                }
+            });
+            measure("analyze_svg", 5, [&]() {
+                analyze_svg(file);
+            });
+        }
+
+        void bench_svgz()
+        {
+            string file = write_scene("bench_svgz", 50000);
+            string svgz_file = file + "z";
+            if (system(("gzip -6c " + file + " > " + svgz_file).c_str()) != 0)
+            {
+                cout << "svgz: gzip not available" << endl;
+                return;
+            }
+            cout << "svgz: " << file << endl;
+            measure("readSVG .svg", 5, [&]() {
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(file, dimensions, elements);
+                for (SVGElement *e : elements)
+                {
+                    delete e;
+                }
+            });
+            measure("gunzip only", 5, [&]() {
+                shared_ptr<const MappedFile> m = MappedFile::open(svgz_file);
+                gunzip(m->data(), m->size());
+            });
+            measure("readSVG .svgz", 5, [&]() {
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(svgz_file, dimensions, elements);
+                for (SVGElement *e : elements)
+                {
+                    delete e;
+                }
+            });
+        }
+
+        void bench_svgb()
+        {
+            string file = write_scene("bench_svgb", 50000);
+            string svgb_file = root_path + "/output/bench_svgb.svgb";
+            compile_svgb(file, svgb_file);
+            cout << "svgb: " << file << endl;
+            measure("readSVG", 5, [&]() {
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(file, dimensions, elements);
+                for (SVGElement *e : elements)
+                {
+                    delete e;
+                }
+            });
+            measure("BinaryScene", 5, [&]() {
+                BinaryScene scene(svgb_file);
+            });
+            measure("convert .svg", 1, [&]() {
+                convert(file, root_path + "/output/bench_svgb.png");
+            });
+            measure("convert .svgb", 1, [&]() {
+                convert(svgb_file, root_path + "/output/bench_svgb.png");
+            });
+        }
+
+        void bench_stream()
+        {
+            const int documents = 24;
+            string file = write_scene("bench_stream", 5000);
+            ifstream in(file);
+            string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            string stream_text;
+            for (int i = 0; i < documents; i++)
+            {
+                stream_text += text;
+            }
+            string pattern = root_path + "/output/bench_stream_%d.png";
+            cout << "stream: " << documents << " x " << file << endl;
+            measure("convert, one by one", 1, [&]() {
+                for (int i = 1; i <= documents; i++)
+                {
+                    convert(file, root_path + "/output/bench_stream_" + to_string(i) + ".png");
+                }
+            });
+            const int threads[][3] = {{1, 1, 1}, {1, 2, 4}, {2, 4, 8}};
+            for (const int *t : threads)
+            {
+                PipelineOptions options;
+                options.parse_threads = t[0];
+                options.raster_threads = t[1];
+                options.encode_threads = t[2];
+                string label = "convert_stream " + to_string(t[0]) + "," + to_string(t[1]) + "," + to_string(t[2]);
+                measure(label, 1, [&]() {
+                    istringstream stream(stream_text);
+                    PipelineReport report = convert_stream(stream, pattern, options);
+                    report.print(cout);
+                });
+            }
+        }
+
+        void bench_batch()
+        {
+            // Many small files.
+            const int files = 500;
+            vector<BatchJob> jobs;
+            srand(42);
+            for (int i = 0; i < files; i++)
+            {
+                string name = root_path + "/output/bench_batch_" + to_string(i);
+                ofstream out(name + ".svg");
+                out << "<svg width=\"64\" height=\"64\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+                for (int k = 0; k < 20; k++)
+                {
+                    out << "<rect x=\"" << rand() % 60 << "\" y=\"" << rand() % 60
+                        << "\" width=\"8\" height=\"8\" fill=\"blue\"/>\n";
+                }
+                out << "</svg>\n";
+                jobs.push_back({name + ".svg", name + ".png"});
+            }
+            cout << "batch: " << files << " files of 64 x 64 pixels" << endl;
+            measure("convert, one by one", 1, [&]() {
+                for (const BatchJob &job : jobs)
+                {
+                    convert(job.svg_file, job.png_file);
+                }
+            });
+            for (bool io_uring : {false, true})
+            {
+                PipelineOptions options;
+                options.io_uring = io_uring;
+                measure(io_uring ? "convert_batch (io_uring)" : "convert_batch (thread pool)", 1, [&]() {
+                    convert_batch(jobs, options).print(cout);
+                });
+            }
+        }
+
+        void bench_sprites()
+        {
+            string use_file = write_icon_grid("bench_sprites_use", 150, true);
+            string inline_file = write_icon_grid("bench_sprites_inline", 150, false);
+            cout << "sprites: 150 x 150 icon grid" << endl;
+            measure("convert, inline icons", 1, [&]() {
+                convert(inline_file, root_path + "/output/bench_sprites.png");
+            });
+            measure("convert, <use> sprites", 1, [&]() {
+                convert(use_file, root_path + "/output/bench_sprites.png");
+            });
+        }
+
+        void bench_paths()
+        {
+            string file = write_paths("bench_paths", 20000);
+            cout << "paths: " << file << endl;
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(file, dimensions, elements);
+            // Drawing to a pixel far off the canvas flattens every path
+            // but rasterizes nothing.
+            measure("flatten only", 5, [&]() {
+                PNGImage img(1, 1, {-100000, -100000});
+                for (SVGElement *e : elements)
+                {
+                    e->draw(img);
+                }
+            });
+            measure("draw", 5, [&]() {
+                PNGImage img(dimensions.x, dimensions.y);
+                for (SVGElement *e : elements)
+                {
+                    e->draw(img);
+                }
+            });
+            measure("draw at 4x scale", 1, [&]() {
+                PNGImage img(dimensions.x * 4, dimensions.y * 4, {0, 0}, 4.0);
+                for (SVGElement *e : elements)
+                {
+                    e->draw(img);
+                }
+            });
+            for (SVGElement *e : elements)
+            {
+                delete e;
+            }
+        }
+
+        void bench_strokes()
+        {
+            // Random walks of many short segments.
+            vector<vector<Point>> walks;
+            srand(42);
+            for (int i = 0; i < 200; i++)
+            {
+                vector<Point> points;
+                Point p = {rand() % 2000, rand() % 2000};
+                for (int k = 0; k < 2000; k++)
+                {
+                    p = {max(0, min(1999, p.x + rand() % 21 - 10)), max(0, min(1999, p.y + rand() % 21 - 10))};
+                    points.push_back(p);
+                }
+                walks.push_back(points);
+            }
+            cout << "strokes: 200 polylines x 2000 vertices" << endl;
+            struct Style
+            {
+                const char *label;
+                double width;
+                StrokeStyle::Join join;
+                StrokeStyle::Cap cap;
+            };
+            const Style styles[] = {
+                {"width 1", 1, StrokeStyle::MITER_JOIN, StrokeStyle::BUTT_CAP},
+                {"width 8, miter joins", 8, StrokeStyle::MITER_JOIN, StrokeStyle::BUTT_CAP},
+                {"width 8, bevel joins", 8, StrokeStyle::BEVEL_JOIN, StrokeStyle::SQUARE_CAP},
+                {"width 8, round joins", 8, StrokeStyle::ROUND_JOIN, StrokeStyle::ROUND_CAP},
+                {"width 32, round joins", 32, StrokeStyle::ROUND_JOIN, StrokeStyle::ROUND_CAP},
+            };
+            for (const Style &st : styles)
+            {
+                StrokeStyle style;
+                style.width = st.width;
+                style.join = st.join;
+                style.cap = st.cap;
+                vector<Polyline> lines;
+                for (const vector<Point> &points : walks)
+                {
+                    lines.push_back(Polyline(points, {0, 0, 255}, style));
+                }
+                measure(st.label, 1, [&]() {
+                    PNGImage img(2000, 2000);
+                    for (const Polyline &line : lines)
+                    {
+                        line.draw(img);
+                    }
+                });
+            }
+        }
+
+        void bench_lines()
+        {
+            // Contour-like lines: long, mostly horizontal or vertical
+            // segments, some of them leaving the image.
+            vector<pair<Point, Point>> lines;
+            srand(42);
+            for (int i = 0; i < 200000; i++)
+            {
+                Point a = {rand() % 2400 - 200, rand() % 2400 - 200};
+                int length = 50 + rand() % 400, drift = rand() % 41 - 20;
+                lines.push_back(i % 2 == 0 ? make_pair(a, Point{a.x + length, a.y + drift})
+                                           : make_pair(a, Point{a.x + drift, a.y + length}));
+            }
+            cout << "lines: 200000 lines, 50 to 450 pixels long" << endl;
+            measure("draw_line", 1, [&]() {
+                PNGImage img(2000, 2000);
+                for (const pair<Point, Point> &line : lines)
+                {
+                    img.draw_line(line.first, line.second, {0, 0, 255});
+                }
+            });
+        }
+
+        void bench_index()
+        {
+            const int n = 1000000;
+            vector<SVGElement *> elements;
+            srand(42);
+            for (int i = 0; i < n; i++)
+            {
+                elements.push_back(new Rect(rand() % 20000, rand() % 20000, {0, 0, 0},
+                                            1 + rand() % 40, 1 + rand() % 40));
+            }
+            vector<Point> queries;
+            for (int i = 0; i < n; i++)
+            {
+                queries.push_back({rand() % 20000, rand() % 20000});
+            }
+            cout << "index: " << n << " rects on a 20000 x 20000 canvas" << endl;
+            measure("build", 1, [&]() {
+                SpatialIndex index(elements);
+            });
+            SpatialIndex index(elements);
+            measure("1M x query_point", 1, [&]() {
+                size_t hits = 0;
+                for (const Point &q : queries)
+                {
+                    hits += index.query_point(q.x, q.y) != nullptr;
+                }
+                cout << "  (" << hits << " hits)" << endl;
+            });
+            measure("1M x query_rect 50 x 50", 1, [&]() {
+                size_t hits = 0;
+                for (const Point &q : queries)
+                {
+                    hits += index.query_rect({q, q.translate({49, 49})}).size();
+                }
+                cout << "  (" << hits << " hits)" << endl;
+            });
+            for (SVGElement *e : elements)
+            {
+                delete e;
+            }
+        }
+
+        void bench_lod()
+        {
+            string files[] = {write_scene("bench_lod", 50000), write_paths("bench_lod_paths", 20000),
+                              write_detail("bench_lod_detail", 100000)};
+            for (const string &file : files)
+            {
+                cout << "lod: 200 pixel thumbnail of " << file << endl;
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(file, dimensions, elements);
+                double scale = 200.0 / max(dimensions.x, dimensions.y);
+                auto render = [&](PNGImage &img) {
+                    for (SVGElement *e : elements)
+                    {
+                        e->draw(img);
+                    }
+                };
+                measure("exact", 5, [&]() {
+                    PNGImage img(200, 200, {0, 0}, scale);
+                    render(img);
+                });
+                measure("lod tolerance 0.5", 5, [&]() {
+                    PNGImage img(200, 200, {0, 0}, scale);
+                    img.set_lod_tolerance(0.5);
+                    render(img);
+                });
+                PNGImage exact(200, 200, {0, 0}, scale), simplified(200, 200, {0, 0}, scale);
+                simplified.set_lod_tolerance(0.5);
+                render(exact);
+                render(simplified);
+                int differ = 0;
+                for (int y = 0; y < exact.height(); y++)
+                {
+                    for (int x = 0; x < exact.width(); x++)
+                    {
+                        Color a = exact.at(x, y), b = simplified.at(x, y);
+                        differ += a.red != b.red || a.green != b.green || a.blue != b.blue;
+                    }
+                }
+                cout << "  pixels differing: " << differ << " of " << exact.width() * exact.height() << endl;
+                for (SVGElement *e : elements)
+                {
+                    delete e;
+                }
+            }
+        }
+
+        void bench_encode()
+        {
+            // A sparse diagram: a few shapes on a large white canvas.
+            PNGImage sparse(4000, 3000);
+            srand(42);
+            for (int i = 0; i < 40; i++)
+            {
+                int x = rand() % 3800, y = 1000 + rand() % 400;
+                Rect(x, y, {(rgb_value)(rand() % 256), 0, 255}, 150, 80).draw(sparse);
+                Circle({255, (rgb_value)(rand() % 256), 0}, {x + 75, y + 40}, 30).draw(sparse);
+            }
+            // A dense one: shapes everywhere.
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(write_scene("bench_encode", 20000), dimensions, elements);
+            PNGImage dense(dimensions.x, dimensions.y);
+            for (SVGElement *e : elements)
+            {
+                e->draw(dense);
+                delete e;
+            }
+            vector<char> png;
+            cout << "encode: 4000 x 3000 sparse diagram, 2000 x 2000 dense scene" << endl;
+            measure("sparse", 3, [&]() { sparse.encode(png); });
+            measure("dense", 3, [&]() { dense.encode(png); });
+        }
+
+        void bench_gradients()
+        {
+            // Large shapes, filled with a color, then with gradients fitted
+            // to each shape's box.
+            vector<Gradient::Stop> stops = {{0, {255, 0, 0}}, {0.5, {255, 255, 0}}, {1, {0, 0, 255}}};
+            const pair<const char *, Gradient> fills[] = {
+                {"solid", Gradient()},
+                {"linear gradient", Gradient::linear(0, 0, 1, 1, stops)},
+                {"radial gradient", Gradient::radial(0.5, 0.5, 0.5, stops)},
+            };
+            vector<Rect> rects;
+            vector<Ellipse> ellipses;
+            srand(42);
+            for (int i = 0; i < 100; i++)
+            {
+                int x = rand() % 1600, y = rand() % 1700;
+                rects.push_back(Rect(x, y, {0, 128, 255}, 400, 300));
+                ellipses.push_back(Ellipse({255, 128, 0}, {x + 200, y + 150}, {200, 150}));
+            }
+            PNGImage img(2000, 2000);
+            Profiler profiler;      // only to count the pixels
+            img.set_profiler(&profiler);
+            for (const Rect &r : rects)
+            {
+                r.draw(img);
+            }
+            for (const Ellipse &e : ellipses)
+            {
+                e.draw(img);
+            }
+            img.set_profiler(nullptr);
+            cout << "gradients: 100 rectangles and 100 ellipses, " << img.pixels_written() / 1000000.0
+                 << " Mpixels per draw" << endl;
+            for (const pair<const char *, Gradient> &fill : fills)
+            {
+                for (Rect &r : rects)
+                {
+                    Gradient g = fill.second;
+                    g.fit(r.bounding_box());
+                    r.set_gradient(g);
+                }
+                for (Ellipse &e : ellipses)
+                {
+                    Gradient g = fill.second;
+                    g.fit(e.bounding_box());
+                    e.set_gradient(g);
+                }
+                measure(fill.first, 5, [&]() {
+                    for (const Rect &r : rects)
+                    {
+                        r.draw(img);
+                    }
+                    for (const Ellipse &e : ellipses)
+                    {
+                        e.draw(img);
+                    }
+                });
+            }
+        }
+
+        void bench_clips()
+        {
+            // A layer of large shapes, drawn as is and through clip paths
+            // of one shape and of many small ones.
+            auto layer = []() {
+                vector<SVGElement *> shapes;
+                srand(42);
+                for (int i = 0; i < 100; i++)
+                {
+                    int x = rand() % 1600, y = rand() % 1700;
+                    shapes.push_back(new Rect(x, y, {0, 128, 255}, 400, 300));
+                    shapes.push_back(new Ellipse({255, 128, 0}, {x + 200, y + 150}, {200, 150}));
+                }
+                return new Group(shapes);
+            };
+            vector<SVGElement *> dots;
+            for (int y = 0; y < 10; y++)
+            {
+                for (int x = 0; x < 10; x++)
+                {
+                    dots.push_back(new Circle({0, 0, 0}, {100 + 200 * x, 100 + 200 * y}, 90));
+                }
+            }
+            const pair<const char *, SVGElement *> layers[] = {
+                {"unclipped", layer()},
+                {"clipped to a circle", new Clip(layer(), new Group({new Circle({0, 0, 0}, {1000, 1000}, 900)}))},
+                {"clipped to 100 circles", new Clip(layer(), new Group(dots))},
+            };
+            PNGImage img(2000, 2000);
+            for (const pair<const char *, SVGElement *> &l : layers)
+            {
+                measure(l.first, 5, [&]() { l.second->draw(img); });
+                delete l.second;
+            }
+        }
+
+    public:
+        BenchDriver(const string &root_path) : root_path(root_path) {}
+
+        void run_benchmarks(const string &spec)
+        {
+            struct Entry
+            {
+                const char *name;
+                void (BenchDriver::*run)();
+            };
+            const Entry entries[] = {
+                {"load", &BenchDriver::bench_load},
+                {"svgb", &BenchDriver::bench_svgb},
+                {"svgz", &BenchDriver::bench_svgz},
+                {"stream", &BenchDriver::bench_stream},
+                {"batch", &BenchDriver::bench_batch},
+                {"sprites", &BenchDriver::bench_sprites},
+                {"paths", &BenchDriver::bench_paths},
+                {"strokes", &BenchDriver::bench_strokes},
+                {"lines", &BenchDriver::bench_lines},
+                {"index", &BenchDriver::bench_index},
+                {"lod", &BenchDriver::bench_lod},
+                {"encode", &BenchDriver::bench_encode},
+                {"gradients", &BenchDriver::bench_gradients},
+                {"clips", &BenchDriver::bench_clips},
+            };
+            for (const Entry &e : entries)
+            {
+                if (string(e.name).find(spec) == 0)
+                {
+                    (this->*e.run)();
+                }
+            }
+        }
+    };
+}
+
+int main(int argc, char **argv)
+{
+    --argc;
+    ++argv;
+    svg::BenchDriver driver(argc == 2 ? argv[1] : ".");
+    string spec = argc >= 1 ? argv[0] : "";
+    driver.run_benchmarks(spec);
+    return 0;
+}
@@ -1,23 +1,806 @@
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <exception>
+#include <stdexcept>
+#include <cstring>
 #include "SVGElements.hpp"
+#include "BinaryScene.hpp"
+#include "BoundedQueue.hpp"
+#include "AsyncIO.hpp"
 
 namespace svg
 {
-    void convert(const std::string &svg_file, const std::string &png_file)
+    namespace
+    {
+        //! A scene ready to be drawn: either parsed SVG elements or a
+        //! compiled (.svgb) scene, detected from the file contents.
+        class LoadedScene
+        {
+        public:
+            LoadedScene(const std::string &file, Profiler *profiler = nullptr)
+            {
+                if (BinaryScene::is_binary(*MappedFile::open(file)))
+                {
+                    binary.reset(new BinaryScene(file));
+                    dimensions = binary->dimensions();
+                    return;
+                }
+                readSVG(file, dimensions, svg_elements, profiler);
+                compute_boxes();
+            }
+            //! Parse an SVG document held in memory.
+            LoadedScene(const char *data, size_t size)
+            {
+                readSVG(data, size, dimensions, svg_elements);
+                compute_boxes();
+            }
+            ~LoadedScene()
+            {
+                for (SVGElement* e : svg_elements)
+                {
+                    delete e;
+                }
+            }
+            //! Draw the elements whose bounding box crosses the image.
+            void draw(PNGImage &img) const
+            {
+                if (binary)
+                {
+                    binary->draw(img);
+                    return;
+                }
+                if (img.front_to_back())
+                {
+                    for (size_t i = svg_elements.size(); i-- > 0;)
+                    {
+                        if (!img.covered(boxes[i]))
+                        {
+                            draw_element(*svg_elements[i], img);
+                        }
+                    }
+                    return;
+                }
+                for (size_t i = 0; i < svg_elements.size(); i++)
+                {
+                    if (boxes[i].intersects(img.bounds()))
+                    {
+                        draw_element(*svg_elements[i], img);
+                    }
+                }
+            }
+
+            Point dimensions;
+
+        private:
+            void compute_boxes()
+            {
+                for (SVGElement* e : svg_elements)
+                {
+                    boxes.push_back(e->bounding_box());
+                }
+            }
+
+            LoadedScene(const LoadedScene &) = delete;
+            LoadedScene &operator=(const LoadedScene &) = delete;
+
+            std::vector<SVGElement *> svg_elements;
+            std::vector<BoundingBox> boxes;
+            std::unique_ptr<BinaryScene> binary;
+        };
+
+        //! Set up an image for the rendering options.
+        void apply_options(PNGImage &img, const RenderOptions &options)
+        {
+            img.set_front_to_back(options.front_to_back);
+            img.set_lod_tolerance(options.lod_tolerance);
+            img.set_profiler(options.profiler);
+        }
+
+        //! Splits a stream into SVG documents, at null bytes or right after
+        //! the end tag of each root <svg> element. Comments, CDATA sections,
+        //! processing instructions and quoted attribute values are skipped
+        //! when looking for tags.
+        class DocumentSplitter
+        {
+        public:
+            DocumentSplitter(std::istream &in) : in_(in), scan_(0), next_(0), depth_(0), eof_(false) {}
+
+            //! Get the next non-blank document.
+            //! @param document Receives the document text.
+            //! @return False at the end of the stream.
+            bool next(std::vector<char> &document)
+            {
+                for (;;)
+                {
+                    size_t end = find_end();
+                    if (end == std::string::npos && !eof_)
+                    {
+                        char chunk[65536];
+                        in_.read(chunk, sizeof(chunk));
+                        buffer_.append(chunk, (size_t)in_.gcount());
+                        eof_ = in_.gcount() == 0;
+                        continue;
+                    }
+                    if (end == std::string::npos)
+                    {
+                        // Unterminated last document.
+                        end = next_ = buffer_.size();
+                    }
+                    document.assign(buffer_.begin(), buffer_.begin() + end);
+                    bool blank = buffer_.find_first_not_of(" \t\r\n") >= end;
+                    buffer_.erase(0, next_);
+                    scan_ = 0;
+                    depth_ = 0;
+                    if (!blank)
+                    {
+                        return true;
+                    }
+                    if (buffer_.empty() && eof_)
+                    {
+                        return false;
+                    }
+                }
+            }
+
+        private:
+            //! Scan buffer_ for the end of its first document, resuming
+            //! where the last scan stopped.
+            //! @return End of the document, with next_ set to the start of
+            //! the following one, or npos if more data is needed.
+            size_t find_end()
+            {
+                const size_t npos = std::string::npos;
+                while (scan_ < buffer_.size())
+                {
+                    char c = buffer_[scan_];
+                    if (c == '\0')
+                    {
+                        next_ = scan_ + 1;
+                        return scan_;
+                    }
+                    if (c != '<')
+                    {
+                        scan_++;
+                        continue;
+                    }
+                    // Markup: wait until it is complete.
+                    if (buffer_.size() - scan_ < 9 && !eof_)
+                    {
+                        return npos;
+                    }
+                    size_t end;
+                    if (buffer_.compare(scan_, 4, "<!--") == 0)
+                    {
+                        end = skip_to("-->");
+                    }
+                    else if (buffer_.compare(scan_, 9, "<![CDATA[") == 0)
+                    {
+                        end = skip_to("]]>");
+                    }
+                    else if (buffer_.compare(scan_, 2, "<?") == 0)
+                    {
+                        end = skip_to("?>");
+                    }
+                    else
+                    {
+                        end = tag_end();
+                    }
+                    if (end == npos)
+                    {
+                        return npos;
+                    }
+                    bool self_closing = buffer_[end - 2] == '/';
+                    bool done = false;
+                    if (is_tag("</svg"))
+                    {
+                        done = --depth_ <= 0;
+                    }
+                    else if (is_tag("<svg"))
+                    {
+                        done = self_closing && depth_ == 0;
+                        depth_ += self_closing ? 0 : 1;
+                    }
+                    scan_ = end;
+                    if (done)
+                    {
+                        next_ = end;
+                        return end;
+                    }
+                }
+                return npos;
+            }
+
+            //! Check the name of the tag at scan_.
+            bool is_tag(const char *name) const
+            {
+                size_t n = std::char_traits<char>::length(name);
+                if (buffer_.compare(scan_, n, name) != 0 || scan_ + n >= buffer_.size())
+                {
+                    return false;
+                }
+                char after = buffer_[scan_ + n];
+                return after == '>' || after == '/' || after == ' ' || after == '\t' ||
+                       after == '\r' || after == '\n';
+            }
+
+            size_t skip_to(const char *terminator) const
+            {
+                size_t end = buffer_.find(terminator, scan_ + 2);
+                return end == std::string::npos ? end : end + std::char_traits<char>::length(terminator);
+            }
+
+            //! Find the end of the tag at scan_, skipping quoted values.
+            size_t tag_end() const
+            {
+                char quote = 0;
+                for (size_t i = scan_ + 1; i < buffer_.size(); i++)
+                {
+                    char c = buffer_[i];
+                    if (quote != 0)
+                    {
+                        quote = c == quote ? 0 : quote;
+                    }
+                    else if (c == '"' || c == '\'')
+                    {
+                        quote = c;
+                    }
+                    else if (c == '>')
+                    {
+                        return i + 1;
+                    }
+                }
+                return std::string::npos;
+            }
+
+            std::istream &in_;
+            //! Text read and not returned yet.
+            std::string buffer_;
+            //! Scan position, end of the next document and element depth.
+            size_t scan_, next_;
+            int depth_;
+            bool eof_;
+        };
+
+        //! Documents passed between the stages of convert_stream and
+        //! convert_batch.
+        struct SourceDocument
+        {
+            size_t index;
+            std::vector<char> text;
+        };
+        struct ParsedDocument
+        {
+            size_t index;
+            std::unique_ptr<LoadedScene> scene;
+        };
+        struct RenderedDocument
+        {
+            size_t index;
+            std::unique_ptr<PNGImage> image;
+        };
+
+        //! Output of the last stage.
+        struct NoOutput
+        {
+            size_t index;
+        };
+
+        typedef std::chrono::steady_clock Clock;
+
+        double seconds_since(Clock::time_point start)
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        //! Names a document in error messages, from its index.
+        typedef std::function<std::string(size_t)> Label;
+
+        //! The threads of one pipeline stage. Each thread takes documents
+        //! from the input queue, processes them and passes them on; the
+        //! output queue is closed once the last thread is done.
+        template <typename In, typename Out>
+        class Stage
+        {
+        public:
+            typedef std::function<void(In &, Out &)> Work;
+
+            Stage(StageReport &report, BoundedQueue<In> &input, BoundedQueue<Out> *output,
+                  Work work, PipelineReport &pipeline, std::mutex &lock, Label label)
+                : report_(report), input_(input), output_(output), work_(work),
+                  errors_(pipeline.errors), lock_(lock), label_(label), running_(report.threads)
+            {
+                for (int i = 0; i < report.threads; i++)
+                {
+                    threads_.emplace_back(&Stage::run, this);
+                }
+            }
+            void join()
+            {
+                for (std::thread &t : threads_)
+                {
+                    t.join();
+                }
+            }
+
+        private:
+            void run()
+            {
+                StageReport mine = {std::string(), 0, 0, 0, 0, 0};
+                In item;
+                double waited;
+                while (input_.pop(item, waited))
+                {
+                    mine.starved_seconds += waited;
+                    Clock::time_point start = Clock::now();
+                    Out result;
+                    result.index = item.index;
+                    bool ok = true;
+                    try
+                    {
+                        work_(item, result);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::lock_guard<std::mutex> guard(lock_);
+                        errors_.push_back(label_(item.index) + ": " + e.what());
+                        ok = false;
+                    }
+                    item = In();
+                    mine.busy_seconds += seconds_since(start);
+                    mine.documents++;
+                    if (ok && output_ != nullptr)
+                    {
+                        mine.blocked_seconds += output_->push(std::move(result));
+                    }
+                }
+                mine.starved_seconds += waited;
+                std::lock_guard<std::mutex> guard(lock_);
+                report_.documents += mine.documents;
+                report_.busy_seconds += mine.busy_seconds;
+                report_.starved_seconds += mine.starved_seconds;
+                report_.blocked_seconds += mine.blocked_seconds;
+                if (--running_ == 0 && output_ != nullptr)
+                {
+                    output_->close();
+                }
+            }
+
+            StageReport &report_;
+            BoundedQueue<In> &input_;
+            BoundedQueue<Out> *output_;
+            Work work_;
+            std::vector<std::string> &errors_;
+            std::mutex &lock_;
+            Label label_;
+            int running_;
+            std::vector<std::thread> threads_;
+        };
+
+        //! The parse and raster stages shared by convert_stream and
+        //! convert_batch, taking documents from texts and leaving images.
+        class RenderStages
+        {
+        public:
+            //! Start the stages.
+            //! @param taken Called as each document is taken from texts.
+            RenderStages(PipelineReport &report, const PipelineOptions &options, std::mutex &lock,
+                         Label label, std::function<void()> taken)
+                : texts(options.queue_capacity), scenes(options.queue_capacity), images(options.queue_capacity),
+                  parse_(report.stages[1], texts, &scenes,
+                         [taken](SourceDocument &doc, ParsedDocument &parsed) {
+                             if (taken)
+                             {
+                                 taken();
+                             }
+                             parsed.scene.reset(new LoadedScene(doc.text.data(), doc.text.size()));
+                         },
+                         report, lock, label),
+                  raster_(report.stages[2], scenes, &images,
+                          [&options](ParsedDocument &parsed, RenderedDocument &rendered) {
+                              const LoadedScene &scene = *parsed.scene;
+                              rendered.image.reset(new PNGImage(scene.dimensions.x, scene.dimensions.y));
+                              apply_options(*rendered.image, options.render);
+                              // Profilers take one thread at a time.
+                              rendered.image->set_profiler(nullptr);
+                              scene.draw(*rendered.image);
+                          },
+                          report, lock, label)
+            {
+            }
+            //! Wait for the stages, once texts is closed.
+            void join()
+            {
+                parse_.join();
+                raster_.join();
+            }
+
+            BoundedQueue<SourceDocument> texts;
+            BoundedQueue<ParsedDocument> scenes;
+            BoundedQueue<RenderedDocument> images;
+
+        private:
+            Stage<SourceDocument, ParsedDocument> parse_;
+            Stage<ParsedDocument, RenderedDocument> raster_;
+        };
+
+        StageReport stage_report(const char *name, int threads)
+        {
+            return {name, std::max(1, threads), 0, 0, 0, 0};
+        }
+
+        //! Name the output of a stream document.
+        std::string stream_output_name(const std::string &pattern, size_t index)
+        {
+            std::string number = std::to_string(index);
+            size_t at = pattern.find("%d");
+            if (at != std::string::npos)
+            {
+                return pattern.substr(0, at) + number + pattern.substr(at + 2);
+            }
+            size_t dot = pattern.find_last_of('.');
+            size_t slash = pattern.find_last_of('/');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            {
+                return pattern + "_" + number;
+            }
+            return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+        }
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file,
+                 const RenderOptions &options)
+    {
+        LoadedScene scene(svg_file, options.profiler);
+        PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        apply_options(img, options);
+        scene.draw(img);
+        img.save(png_file);
+    }
+
+    void convert_viewport(const std::string &svg_file,
+                          const std::string &png_file,
+                          const Viewport &viewport,
+                          const RenderOptions &options)
+    {
+        LoadedScene scene(svg_file, options.profiler);
+        PNGImage img(viewport.width, viewport.height,
+                     {viewport.x, viewport.y}, viewport.scale);
+        apply_options(img, options);
+        scene.draw(img);
+        img.save(png_file);
+    }
+
+    void convert_sizes(const std::string &svg_file,
+                       const std::vector<SizedOutput> &outputs,
+                       int box_filter_max,
+                       const RenderOptions &options)
+    {
+        LoadedScene scene(svg_file, options.profiler);
+        int long_side = std::max(scene.dimensions.x, scene.dimensions.y);
+        if (long_side <= 0)
+        {
+            throw std::runtime_error(svg_file + ": cannot scale an image with no size!");
+        }
+
+        // Largest first, so that box-filtered outputs can reuse a render.
+        std::vector<size_t> order(outputs.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return outputs[a].size > outputs[b].size;
+        });
+
+        std::vector<std::unique_ptr<PNGImage>> images(outputs.size());
+        const PNGImage *rendered = nullptr;
+        for (size_t i : order)
+        {
+            double scale = (double)outputs[i].size / long_side;
+            int w = std::max(1, (int)std::lround(scene.dimensions.x * scale));
+            int h = std::max(1, (int)std::lround(scene.dimensions.y * scale));
+            if (outputs[i].size <= box_filter_max && rendered != nullptr &&
+                rendered->width() >= w && rendered->height() >= h)
+            {
+                images[i].reset(new PNGImage(rendered->downscale(w, h)));
+                continue;
+            }
+            images[i].reset(new PNGImage(w, h, {0, 0}, scale));
+            apply_options(*images[i], options);
+            scene.draw(*images[i]);
+            rendered = images[i].get();
+        }
+
+        // An exception must not escape an encoder thread: each is kept and
+        // the first one rethrown once every thread has finished.
+        std::vector<std::exception_ptr> errors(outputs.size());
+        std::vector<std::thread> encoders;
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            encoders.emplace_back([&images, &outputs, &errors, i]() {
+                try
+                {
+                    images[i]->save(outputs[i].png_file);
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread &t : encoders)
+        {
+            t.join();
+        }
+        for (const std::exception_ptr &error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    void compile_svgb(const std::string &svg_file, const std::string &svgb_file)
     {
         Point dimensions;
         std::vector<SVGElement *> svg_elements;
         readSVG(svg_file, dimensions, svg_elements);
-        PNGImage img(dimensions.x, dimensions.y);
+        SceneWriter writer;
         for (SVGElement* e : svg_elements)
         {
-            e->draw(img);
+            e->serialize(writer);
+            delete e;
         }
-        img.save(png_file);
-        for (SVGElement* e  : svg_elements)
+        writer.save(svgb_file, dimensions);
+    }
+
+    void convert_banded(const std::string &svg_file,
+                        const std::string &png_file,
+                        int band_height,
+                        const RenderOptions &options)
+    {
+        LoadedScene scene(svg_file, options.profiler);
+        Point dimensions = scene.dimensions;
+        band_height = std::max(1, std::min(band_height, dimensions.y));
+        int full_bands = dimensions.y / band_height;
+        int last_band = dimensions.y % band_height;
+
+        PNGStreamWriter writer(png_file, dimensions.x, dimensions.y);
+        PNGImage band(dimensions.x, band_height);
+        apply_options(band, options);
+        for (int b = 0; b < full_bands; b++)
         {
-            delete e;
+            band.reset({0, b * band_height});
+            scene.draw(band);
+            writer.write(band);
+        }
+        if (last_band > 0)
+        {
+            PNGImage last(dimensions.x, last_band, {0, full_bands * band_height});
+            apply_options(last, options);
+            scene.draw(last);
+            writer.write(last);
+        }
+        writer.finish();
+    }
+
+    namespace
+    {
+        //! PNGImage::encode write function forwarding each piece of the
+        //! PNG to a WriteCallback.
+        void write_to_callback(void *context, const void *data, size_t size)
+        {
+            (*(const WriteCallback *)context)(data, size);
+        }
+    }
+
+    class SVGDocument::Scene : public LoadedScene
+    {
+    public:
+        Scene(const char *data, size_t size) : LoadedScene(data, size) {}
+    };
+
+    SVGDocument::SVGDocument(const char *data, size_t size) : scene(new Scene(data, size))
+    {
+    }
+
+    SVGDocument::~SVGDocument()
+    {
+    }
+
+    Point SVGDocument::dimensions() const
+    {
+        return scene->dimensions;
+    }
+
+    void SVGDocument::render(const PixelBuffer &target, const Point &origin, double scale,
+                             const RenderOptions &options) const
+    {
+        PNGImage img((Color *)target.pixels, target.width, target.height, target.stride, origin, scale);
+        img.reset(origin);
+        apply_options(img, options);
+        scene->draw(img);
+    }
+
+    void SVGDocument::encode_png(const WriteCallback &write, const RenderOptions &options) const
+    {
+        PNGImage img(scene->dimensions.x, scene->dimensions.y);
+        apply_options(img, options);
+        scene->draw(img);
+        img.encode(write_to_callback, (void *)&write);
+    }
+
+    void encode_png(const PixelBuffer &pixels, const WriteCallback &write)
+    {
+        PNGImage img((Color *)pixels.pixels, pixels.width, pixels.height, pixels.stride);
+        img.encode(write_to_callback, (void *)&write);
+    }
+
+    PipelineReport convert_stream(std::istream &in,
+                                  const std::string &png_pattern,
+                                  const PipelineOptions &options)
+    {
+        Clock::time_point start = Clock::now();
+        PipelineReport report;
+        report.documents = 0;
+        report.stages = {stage_report("read", 1),
+                         stage_report("parse", options.parse_threads),
+                         stage_report("raster", options.raster_threads),
+                         stage_report("encode", options.encode_threads)};
+        std::mutex lock;
+        Label label = [](size_t index) { return "document " + std::to_string(index); };
+        RenderStages render(report, options, lock, label, nullptr);
+        Stage<RenderedDocument, NoOutput> encode(
+            report.stages[3], render.images, nullptr,
+            [&png_pattern](RenderedDocument &rendered, NoOutput &) {
+                rendered.image->save(stream_output_name(png_pattern, rendered.index));
+            },
+            report, lock, label);
+
+        // Read on this thread.
+        StageReport &read = report.stages[0];
+        DocumentSplitter splitter(in);
+        for (;;)
+        {
+            Clock::time_point read_start = Clock::now();
+            SourceDocument doc;
+            bool more = splitter.next(doc.text);
+            read.busy_seconds += seconds_since(read_start);
+            if (!more)
+            {
+                break;
+            }
+            doc.index = ++report.documents;
+            read.documents++;
+            read.blocked_seconds += render.texts.push(std::move(doc));
+        }
+        render.texts.close();
+        render.join();
+        encode.join();
+        report.wall_seconds = seconds_since(start);
+        return report;
+    }
+
+    PipelineReport convert_batch(const std::vector<BatchJob> &jobs, const PipelineOptions &options)
+    {
+        Clock::time_point start = Clock::now();
+        std::unique_ptr<AsyncIO> io =
+            AsyncIO::create(options.io_depth, options.io_uring ? AsyncIO::AUTO : AsyncIO::THREAD_POOL);
+        PipelineReport report;
+        report.io_backend = io->name();
+        report.documents = jobs.size();
+        // The I/O stages count their requests in flight as threads.
+        report.stages = {stage_report("read", (int)io->depth()),
+                         stage_report("parse", options.parse_threads),
+                         stage_report("raster", options.raster_threads),
+                         stage_report("encode", options.encode_threads),
+                         stage_report("write", (int)io->depth())};
+        std::mutex lock;
+        Label label = [&jobs](size_t index) { return jobs[index].svg_file; };
+        // Documents read and not parsed yet, so that texts never fills up
+        // and read completions never wait.
+        BoundedQueue<char> slots(options.queue_capacity);
+        RenderStages render(report, options, lock, label, [&slots]() {
+            char slot;
+            double waited;
+            slots.pop(slot, waited);
+        });
+        auto io_error = [&](const std::string &what, int error) {
+            std::lock_guard<std::mutex> guard(lock);
+            report.errors.push_back(what + ": " + std::strerror(error));
+        };
+        AsyncIO &io_ref = *io;
+        StageReport &write = report.stages[4];
+        Stage<RenderedDocument, NoOutput> encode(
+            report.stages[3], render.images, nullptr,
+            [&](RenderedDocument &rendered, NoOutput &) {
+                std::vector<char> png;
+                rendered.image->encode(png);
+                rendered.image.reset();
+                size_t index = rendered.index;
+                Clock::time_point submitted = Clock::now();
+                io_ref.write_file(jobs[index].png_file, std::move(png), [&, index, submitted](int error) {
+                    if (error != 0)
+                    {
+                        io_error(jobs[index].svg_file + ": writing " + jobs[index].png_file, error);
+                    }
+                    std::lock_guard<std::mutex> guard(lock);
+                    write.documents++;
+                    write.busy_seconds += seconds_since(submitted);
+                });
+            },
+            report, lock, label);
+
+        // Submit the reads from this thread.
+        StageReport &read = report.stages[0];
+        for (size_t index = 0; index < jobs.size(); index++)
+        {
+            double blocked = slots.push(0);
+            Clock::time_point submitted = Clock::now();
+            io->read_file(jobs[index].svg_file, [&, index, submitted](std::vector<char> &data, int error) {
+                double latency = seconds_since(submitted);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    read.documents++;
+                    read.busy_seconds += latency;
+                }
+                if (error != 0)
+                {
+                    io_error(jobs[index].svg_file, error);
+                    char slot;
+                    double waited;
+                    slots.pop(slot, waited);
+                    return;
+                }
+                SourceDocument doc;
+                doc.index = index;
+                doc.text = std::move(data);
+                render.texts.push(std::move(doc));
+            });
+            read.blocked_seconds += blocked + seconds_since(submitted);
+        }
+        // All reads have completed once nothing is pending.
+        io->drain();
+        render.texts.close();
+        render.join();
+        encode.join();
+        io->drain();
+        report.wall_seconds = seconds_since(start);
+        return report;
+    }
+
+    void PipelineReport::print(std::ostream &out) const
+    {
+        out << documents << " documents in " << std::fixed << std::setprecision(3) << wall_seconds
+            << " s" << std::endl
+            << std::left << std::setw(8) << "stage" << std::right << std::setw(8) << "threads"
+            << std::setw(10) << "busy s" << std::setw(8) << "util %" << std::setw(10) << "starved s"
+            << std::setw(10) << "blocked s" << std::endl;
+        for (const StageReport &stage : stages)
+        {
+            double utilisation = wall_seconds > 0 ? stage.busy_seconds / (stage.threads * wall_seconds) : 0;
+            out << std::left << std::setw(8) << stage.name << std::right << std::setw(8) << stage.threads
+                << std::setw(10) << stage.busy_seconds << std::setw(8) << std::setprecision(1)
+                << 100 * utilisation << std::setprecision(3) << std::setw(10) << stage.starved_seconds
+                << std::setw(10) << stage.blocked_seconds << std::endl;
+        }
+        if (!io_backend.empty())
+        {
+            out << "I/O: " << io_backend << std::endl;
+        }
+        for (const std::string &error : errors)
+        {
+            out << error << std::endl;
         }
     }
-}
\ No newline at end of file
+}
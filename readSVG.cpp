@@ -1,7 +1,11 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 #include "SVGElements.hpp"
+#include "MappedFile.hpp"
+#include "Gzip.hpp"
+#include "Profiler.hpp"
 #include <unordered_map>
 #include "external/tinyxml2/tinyxml2.h"
 
@@ -76,274 +80,827 @@ void applyTransformation(SVGElement* element, const string& transform_attr, Poin
 }
 
 /**
- * @brief Reads an SVG group element and processes its child elements, applying transformations if necessary.
+ * @brief Reads the stroke-width, stroke-linejoin, stroke-linecap and stroke-miterlimit attributes.
  *
- * @param child Pointer to the XML element representing the group.
- * @param shapes Vector of pointers to SVGElement objects where the parsed elements will be stored.
- * @param id_map Unordered map of string to SVGElement pointers, used for resolving references.
+ * @param child Pointer to the XML element.
+ * @return The stroke style, with the SVG defaults for missing attributes.
  */
-void readGroup(XMLElement *child, vector<SVGElement*> &shapes, unordered_map<string, SVGElement*> &id_map) {
-    const char* element_name = child->Name(); // Get the name of the current XML element
+StrokeStyle readStrokeStyle(XMLElement *child)
+{
+    StrokeStyle style;
+    style.width = child->DoubleAttribute("stroke-width", style.width);
+    style.miter_limit = child->DoubleAttribute("stroke-miterlimit", style.miter_limit);
+
+    const char* join = child->Attribute("stroke-linejoin");
+    if (join && strcmp(join, "round") == 0) {
+        style.join = StrokeStyle::ROUND_JOIN;
+    } else if (join && strcmp(join, "bevel") == 0) {
+        style.join = StrokeStyle::BEVEL_JOIN;
+    }
 
-    string transform_attr; // To store the transformation attribute value
-    string transform_origin_attr; // To store the transform-origin attribute value
-    Point transform_origin{0, 0}; // Initialize the transformation origin to (0, 0)
-    bool istransform = false; // Flag to indicate if a transformation attribute is present
+    const char* cap = child->Attribute("stroke-linecap");
+    if (cap && strcmp(cap, "round") == 0) {
+        style.cap = StrokeStyle::ROUND_CAP;
+    } else if (cap && strcmp(cap, "square") == 0) {
+        style.cap = StrokeStyle::SQUARE_CAP;
+    }
+    return style;
+}
 
-    // Read attributes of the current element
-    for (const XMLAttribute* attr = child->FirstAttribute(); attr != nullptr; attr = attr->Next())
+/**
+ * @brief An id, pointing into the parsed document (which outlives it).
+ */
+struct IdKey
+{
+    const char* data;
+    size_t size;
+
+    IdKey(const char* id) : data(id), size(strlen(id)) {}
+    bool operator==(const IdKey &other) const
+    {
+        return size == other.size && memcmp(data, other.data, size) == 0;
+    }
+};
+
+/**
+ * @brief FNV-1a hash of an id.
+ */
+struct IdKeyHash
+{
+    size_t operator()(const IdKey &key) const
     {
-        if (strcmp(attr->Name(), "transform") == 0) {
-            // If a transform attribute is found, store its value and set the flag
-            transform_attr = attr->Value();
-            istransform = true;
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < key.size; i++) {
+            h = (h ^ (unsigned char)key.data[i]) * 16777619u;
         }
-        if (strcmp(attr->Name(), "transform-origin") == 0)
-        {
-            // If a transform-origin attribute is found, parse its value
-            transform_origin_attr = attr->Value();
-            size_t pos = transform_origin_attr.find_first_of(" ");
+        return h;
+    }
+};
+
+/**
+ * @brief An element with an id, and the copy shared by its <use> instances.
+ *
+ * The copy is built when first needed: from the element as read (with its own
+ * transform, not its ancestors'), or straight from the document for references
+ * to elements that come later or are never drawn (e.g. inside <defs>).
+ */
+struct IdEntry
+{
+    IdEntry(XMLElement* node, int index) : node(node), index(index) {}
+
+    XMLElement* node;                   // The element with the id (the first, if several)
+    int index;                          // Its position in document order
+    bool referenced = false;            // Some <use> refers to it
+    bool open = false;                  // Being read: a reference to it now is a cycle
+    bool cyclic = false;                // On a reference cycle: its references make nothing
+    bool resolved = false;              // Whether source is final
+    shared_ptr<Use::Source> source;     // The shared copy, or nullptr if it makes no element
+};
 
-            if (pos != string::npos)
-            {
-                int x = stoi(transform_origin_attr.substr(0, pos)); // Extract x-coordinate
-                int y = stoi(transform_origin_attr.substr(pos + 1)); // Extract y-coordinate
+/**
+ * @brief State shared by the elements of a document while it is read.
+ */
+struct ReadContext
+{
+    unordered_map<IdKey, IdEntry, IdKeyHash> ids;  // Elements by id, for resolving references
+    vector<IdEntry*> open;                  // Referenced elements being read, outermost first
+    int elements = 0;                       // Number of XML elements read so far
+    Profiler* profiler = nullptr;           // Receives the parse and transform costs, if not null
+    Point dimensions{0, 0};                 // Canvas size, for lengths in percent
+    unordered_map<XMLElement*, Gradient> gradients; // Gradients read so far, in their own units
+    unordered_map<XMLElement*, unique_ptr<Group>> clips; // Clip regions read so far, untransformed
+    bool in_clip = false;                   // Reading the shapes of a clip region
+};
+
+/**
+ * @brief Gets the id a <use> element refers to.
+ *
+ * @return The id, or nullptr if the element has no local reference.
+ */
+const char* useTarget(XMLElement *use)
+{
+    const char* href = use->Attribute("href");
+    if (!href) {
+        href = use->Attribute("xlink:href");
+    }
+    return href && href[0] == '#' ? href + 1 : nullptr;
+}
 
-                transform_origin.x = x; // Set the x-coordinate of the transform origin
-                transform_origin.y = y; // Set the y-coordinate of the transform origin
+/**
+ * @brief Indexes the ids of a document, wherever the elements are.
+ *
+ * Elements are numbered in document order, as readGroup numbers them.
+ *
+ * @param root The root element.
+ * @param context Receives the ids.
+ */
+void indexIds(XMLElement *root, ReadContext &context)
+{
+    vector<const char*> targets; // Ids referred to by <use> elements
+    int index = 0;
+    XMLElement* node = root->FirstChildElement();
+    while (node) {
+        index++;
+        const char* id = node->Attribute("id");
+        if (id) {
+            context.ids.insert({IdKey(id), IdEntry(node, index)});
+        }
+        if (strcmp(node->Name(), "use") == 0) {
+            const char* target = useTarget(node);
+            if (target) {
+                targets.push_back(target);
             }
         }
+
+        // Next element, in document order
+        if (node->FirstChildElement()) {
+            node = node->FirstChildElement();
+            continue;
+        }
+        while (node != root && !node->NextSiblingElement()) {
+            node = node->Parent()->ToElement();
+        }
+        node = node != root ? node->NextSiblingElement() : nullptr;
+    }
+    for (const char* target : targets) {
+        auto entry = context.ids.find(IdKey(target));
+        if (entry != context.ids.end()) {
+            entry->second.referenced = true;
+        }
     }
+}
 
-    if (strcmp(element_name, "use") == 0) {
-        // Handle <use> elements (which reference other elements by ID)
-        const char* href_attr = child->Attribute("href");
-        if (href_attr && href_attr[0] == '#') {
-            string element_id = href_attr + 1; // Extract the referenced element's ID
-            if (id_map.find(element_id) != id_map.end()) {
-                // If the referenced element is found in the id_map, clone it
-                SVGElement* referenced_element = id_map[element_id];
-                SVGElement* cloned_element = referenced_element->clone();
+/**
+ * @brief Counts the elements inside an element.
+ */
+int countDescendants(XMLElement *node)
+{
+    int count = 0;
+    for (XMLElement* child = node->FirstChildElement(); child != nullptr; child = child->NextSiblingElement()) {
+        count += 1 + countDescendants(child);
+    }
+    return count;
+}
 
-                // Apply transformation if the attribute is present
-                if (istransform) {
-                    applyTransformation(cloned_element, transform_attr, transform_origin);
-                }
+/**
+ * @brief The attributes shared by all element types, decoded in one pass.
+ */
+struct CommonAttributes
+{
+    const char* id = nullptr;           // id attribute, or nullptr
+    const char* fill = nullptr;         // fill attribute, or nullptr
+    const char* stroke = nullptr;       // stroke attribute, or nullptr
+    const char* transform = nullptr;    // transform attribute, or nullptr
+    const char* clip_path = nullptr;    // clip-path attribute, or nullptr
+    Point transform_origin{0, 0};       // transform-origin attribute, (0, 0) if missing
+};
 
-                shapes.push_back(cloned_element); // Add the cloned element to the shapes vector
+/**
+ * @brief Decodes the common attributes of an element.
+ *
+ * @param child Pointer to the XML element.
+ * @return The attributes found.
+ */
+CommonAttributes readCommonAttributes(XMLElement *child)
+{
+    CommonAttributes attrs;
+    for (const XMLAttribute* attr = child->FirstAttribute(); attr != nullptr; attr = attr->Next())
+    {
+        const char* name = attr->Name();
+        if (strcmp(name, "id") == 0) {
+            attrs.id = attr->Value();
+        } else if (strcmp(name, "fill") == 0) {
+            attrs.fill = attr->Value();
+        } else if (strcmp(name, "stroke") == 0) {
+            attrs.stroke = attr->Value();
+        } else if (strcmp(name, "transform") == 0) {
+            attrs.transform = attr->Value();
+        } else if (strcmp(name, "clip-path") == 0) {
+            attrs.clip_path = attr->Value();
+        } else if (strcmp(name, "transform-origin") == 0) {
+            // Parse "x y"
+            string origin = attr->Value();
+            size_t pos = origin.find_first_of(" ");
+            if (pos != string::npos) {
+                attrs.transform_origin.x = stoi(origin.substr(0, pos));
+                attrs.transform_origin.y = stoi(origin.substr(pos + 1));
             }
         }
     }
+    return attrs;
+}
 
-    cout << "SHAPES SIZE --->" << shapes.size() << '\n'; 
+/**
+ * @brief Parses a color attribute.
+ *
+ * A paint server reference ("url(#id)") gives its fallback color, black if it
+ * has none (see readGradient for the reference itself).
+ *
+ * @param value The attribute value; a missing value is an error.
+ * @return The color.
+ */
+Color readColor(const char* value)
+{
+    if (value && strncmp(value, "url(", 4) == 0) {
+        const char* fallback = strchr(value, ')');
+        fallback = fallback ? fallback + 1 : "";
+        while (*fallback == ' ') {
+            fallback++;
+        }
+        return *fallback && strcmp(fallback, "none") != 0 ? parse_color(fallback) : Color{0, 0, 0};
+    }
+    return parse_color(value ? value : "");
+}
 
-    if (strcmp(element_name, "g") == 0) {
-        // Handle <g> elements (groups of SVG elements)
-        vector<SVGElement*> group_e; // Vector to store the group's child elements
+/**
+ * @brief Parses a length attribute, a number or a percentage.
+ *
+ * @param node Pointer to the XML element.
+ * @param name The attribute name.
+ * @param fallback The value if the attribute is missing.
+ * @param whole The length 100% stands for.
+ * @return The length.
+ */
+double readLength(XMLElement *node, const char* name, double fallback, double whole)
+{
+    const char* value = node->Attribute(name);
+    if (!value) {
+        return fallback;
+    }
+    char* end;
+    double length = strtod(value, &end);
+    return *end == '%' ? length * whole / 100 : length;
+}
 
-        // Recursively read the group's child elements
-        for (XMLElement *group_child = child->FirstChildElement(); group_child != nullptr; group_child = group_child->NextSiblingElement()) {
-            readGroup(group_child, group_e, id_map);
-        }
+/**
+ * @brief Reads a <linearGradient> or <radialGradient> definition and its stops.
+ *
+ * Coordinates are in the units of gradientUnits: fractions of the filled
+ * element's box by default, canvas units for "userSpaceOnUse".
+ *
+ * @param node Pointer to the XML element.
+ * @param context The document state (for the canvas size).
+ * @return The gradient, or an empty one if the node is no gradient or has no stops.
+ */
+Gradient readGradientDefinition(XMLElement *node, const ReadContext &context)
+{
+    bool linear = strcmp(node->Name(), "linearGradient") == 0;
+    if (!linear && strcmp(node->Name(), "radialGradient") != 0) {
+        return Gradient();
+    }
+    vector<Gradient::Stop> stops;
+    for (XMLElement* stop = node->FirstChildElement("stop"); stop != nullptr; stop = stop->NextSiblingElement("stop")) {
+        const char* color = stop->Attribute("stop-color");
+        stops.push_back({readLength(stop, "offset", 0, 1), color ? parse_color(color) : Color{0, 0, 0}});
+    }
+    if (stops.empty()) {
+        return Gradient();
+    }
 
-        Group* g = new Group(group_e); // Create a new Group from the child elements
+    const char* units = node->Attribute("gradientUnits");
+    bool user_space = units && strcmp(units, "userSpaceOnUse") == 0;
+    double w = user_space ? context.dimensions.x : 1;
+    double h = user_space ? context.dimensions.y : 1;
+    if (linear) {
+        return Gradient::linear(readLength(node, "x1", 0, w), readLength(node, "y1", 0, h),
+                                readLength(node, "x2", w, w), readLength(node, "y2", 0, h), stops);
+    }
+    // A radius in percent is relative to the diagonal, over sqrt(2).
+    double diagonal = sqrt((w * w + h * h) / 2);
+    return Gradient::radial(readLength(node, "cx", w / 2, w), readLength(node, "cy", h / 2, h),
+                            readLength(node, "r", diagonal / 2, diagonal), stops);
+}
 
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(g, transform_attr, transform_origin);
-        }
+/**
+ * @brief Gets the gradient a fill attribute refers to ("url(#id)"), fitted to an element.
+ *
+ * @param fill The fill attribute, or nullptr.
+ * @param box The pixels the element covers, before its transform.
+ * @param context The document state, holding the gradient definitions.
+ * @return The gradient, or an empty one if the fill is no reference to a gradient.
+ */
+Gradient readGradient(const char* fill, const BoundingBox &box, ReadContext &context)
+{
+    if (!fill || strncmp(fill, "url(#", 5) != 0) {
+        return Gradient();
+    }
+    const char* end = strchr(fill, ')');
+    string id(fill + 5, end ? end : fill + strlen(fill));
+    auto entry = context.ids.find(IdKey(id.c_str()));
+    if (entry == context.ids.end()) {
+        return Gradient();
+    }
+    XMLElement* node = entry->second.node;
+    auto it = context.gradients.find(node);
+    if (it == context.gradients.end()) {
+        it = context.gradients.insert({node, readGradientDefinition(node, context)}).first;
+    }
+    Gradient gradient = it->second;
+    const char* units = node->Attribute("gradientUnits");
+    if (!units || strcmp(units, "userSpaceOnUse") != 0) {
+        gradient.fit(box);
+    }
+    return gradient;
+}
 
-        shapes.push_back(g); // Add the group to the shapes vector
-    } 
+/**
+ * @brief Parses a points attribute ("x,y x,y ...").
+ *
+ * @param child Pointer to the XML element.
+ * @return The points, in order.
+ */
+vector<Point> readPoints(XMLElement *child)
+{
+    const char* points = child->Attribute("points");
+    vector<Point> points_vec; // Vector to store the points
+    stringstream ss(points ? points : ""); // Create a stringstream from the points string
+    string point;
 
-    else if (strcmp(element_name, "ellipse") == 0)
+    // Parse the points attribute into individual points
+    while (getline(ss, point, ' '))
     {
-        // Handle <ellipse> elements
-        int cx = child->IntAttribute("cx"); // Get the x-coordinate of the center
-        int cy = child->IntAttribute("cy"); // Get the y-coordinate of the center
-        int rx = child->IntAttribute("rx"); // Get the x-radius
-        int ry = child->IntAttribute("ry"); // Get the y-radius
-        string fill_color = child->Attribute("fill"); // Get the fill color
-
-        Ellipse* e = new Ellipse(parse_color(fill_color), {cx, cy}, {rx, ry}); // Create a new Ellipse
-
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
+        size_t pos = point.find(',');
+        if (pos != string::npos)
+        {
+            int x = stoi(point.substr(0, pos)); // Extract x-coordinate
+            int y = stoi(point.substr(pos + 1)); // Extract y-coordinate
+            points_vec.push_back({x, y}); // Add the point to the vector
         }
-
-        shapes.push_back(e); // Add the ellipse to the shapes vector
     }
+    return points_vec;
+}
 
-    else if (strcmp(element_name, "circle") == 0)
-    {
-        // Handle <circle> elements
-        int cx = child->IntAttribute("cx"); // Get the x-coordinate of the center
-        int cy = child->IntAttribute("cy"); // Get the y-coordinate of the center
-        int r = child->IntAttribute("r"); // Get the radius
-        string fill_color = child->Attribute("fill"); // Get the fill color
+void readGroup(XMLElement *child, vector<SVGElement*> &shapes, ReadContext &context);
+SVGElement* readElement(XMLElement *child, ReadContext &context, bool in_place);
+shared_ptr<Use::Source> resolveReference(IdEntry &entry, ReadContext &context);
 
-        Circle* e = new Circle(parse_color(fill_color), {cx, cy}, r); // Create a new Circle
+/**
+ * @brief Builds an element from its XML node.
+ *
+ * Factories read the attributes specific to their element type; the common ones
+ * (transform, id) are applied by the caller.
+ *
+ * @return The new element, or nullptr if the node makes none.
+ */
+typedef SVGElement* (*ElementFactory)(XMLElement *child, const CommonAttributes &attrs, ReadContext &context);
 
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
-        }
+SVGElement* readG(XMLElement *child, const CommonAttributes &, ReadContext &context)
+{
+    vector<SVGElement*> group_e; // Vector to store the group's child elements
 
-        shapes.push_back(e); // Add the circle to the shapes vector
+    // Recursively read the group's child elements
+    for (XMLElement *group_child = child->FirstChildElement(); group_child != nullptr; group_child = group_child->NextSiblingElement()) {
+        readGroup(group_child, group_e, context);
     }
+    return new Group(std::move(group_e));
+}
 
-    else if (strcmp(element_name, "polyline") == 0)
-    {
-        // Handle <polyline> elements
-        string points = child->Attribute("points"); // Get the points attribute
-        string stroke_color = child->Attribute("stroke"); // Get the stroke color
+SVGElement* readUse(XMLElement *child, const CommonAttributes &, ReadContext &context)
+{
+    // <use> elements reference other elements by ID
+    const char* target = useTarget(child);
+    if (!target) {
+        return nullptr;
+    }
+    auto entry = context.ids.find(IdKey(target));
+    if (entry == context.ids.end()) {
+        return nullptr;
+    }
+    // All instances share one copy of the element (and its cached sprite).
+    shared_ptr<Use::Source> source = resolveReference(entry->second, context);
+    return source ? new Use(source) : nullptr;
+}
 
-        vector<Point> points_vec; // Vector to store the points
-        stringstream ss(points); // Create a stringstream from the points string
-        string point;
+SVGElement* readEllipse(XMLElement *child, const CommonAttributes &attrs, ReadContext &context)
+{
+    int cx = child->IntAttribute("cx"); // Get the x-coordinate of the center
+    int cy = child->IntAttribute("cy"); // Get the y-coordinate of the center
+    int rx = child->IntAttribute("rx"); // Get the x-radius
+    int ry = child->IntAttribute("ry"); // Get the y-radius
+    Ellipse* e = new Ellipse(readColor(attrs.fill), {cx, cy}, {rx, ry});
+    e->set_gradient(readGradient(attrs.fill, e->bounding_box(), context));
+    return e;
+}
 
-        // Parse the points attribute into individual points
-        while (getline(ss, point, ' '))
-        {
-            size_t pos = point.find(',');
-            if (pos != string::npos)
-            {
-                int x = stoi(point.substr(0, pos)); // Extract x-coordinate
-                int y = stoi(point.substr(pos + 1)); // Extract y-coordinate
-                points_vec.push_back({x, y}); // Add the point to the vector
-            }
-        }
+SVGElement* readCircle(XMLElement *child, const CommonAttributes &attrs, ReadContext &context)
+{
+    int cx = child->IntAttribute("cx"); // Get the x-coordinate of the center
+    int cy = child->IntAttribute("cy"); // Get the y-coordinate of the center
+    int r = child->IntAttribute("r"); // Get the radius
+    Circle* e = new Circle(readColor(attrs.fill), {cx, cy}, r);
+    e->set_gradient(readGradient(attrs.fill, e->bounding_box(), context));
+    return e;
+}
 
-        Polyline* e = new Polyline(points_vec, parse_color(stroke_color)); // Create a new Polyline
+SVGElement* readPolyline(XMLElement *child, const CommonAttributes &attrs, ReadContext &)
+{
+    return new Polyline(readPoints(child), readColor(attrs.stroke), readStrokeStyle(child));
+}
 
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
-        }
+SVGElement* readLine(XMLElement *child, const CommonAttributes &attrs, ReadContext &)
+{
+    int x1 = child->IntAttribute("x1"); // Get the x-coordinate of the start point
+    int y1 = child->IntAttribute("y1"); // Get the y-coordinate of the start point
+    int x2 = child->IntAttribute("x2"); // Get the x-coordinate of the end point
+    int y2 = child->IntAttribute("y2"); // Get the y-coordinate of the end point
+    return new Line(x1, y1, x2, y2, readColor(attrs.stroke), readStrokeStyle(child));
+}
+
+SVGElement* readPolygon(XMLElement *child, const CommonAttributes &attrs, ReadContext &context)
+{
+    Polygon* e = new Polygon(readPoints(child), readColor(attrs.fill));
+    e->set_gradient(readGradient(attrs.fill, e->bounding_box(), context));
+    return e;
+}
 
-        shapes.push_back(e); // Add the polyline to the shapes vector
+SVGElement* readPath(XMLElement *child, const CommonAttributes &attrs, ReadContext &context)
+{
+    const char* d = child->Attribute("d"); // Get the path data
+    // Get the fill rule (nonzero if missing); clip shapes have their own
+    const char* fill_rule = child->Attribute(context.in_clip ? "clip-rule" : "fill-rule");
+
+    // Fill is black if missing, stroke is none if missing
+    bool filled = !attrs.fill || strcmp(attrs.fill, "none") != 0;
+    bool stroked = attrs.stroke && strcmp(attrs.stroke, "none") != 0;
+    Color fill = attrs.fill && filled ? readColor(attrs.fill) : Color{0, 0, 0};
+    Color stroke = stroked ? readColor(attrs.stroke) : Color{0, 0, 0};
+    bool even_odd = fill_rule && strcmp(fill_rule, "evenodd") == 0;
+    Path* e = new Path(d ? d : "", fill, filled, stroke, stroked, even_odd, readStrokeStyle(child));
+    if (filled) {
+        e->set_gradient(readGradient(attrs.fill, e->bounding_box(), context));
     }
+    return e;
+}
+
+SVGElement* readRect(XMLElement *child, const CommonAttributes &attrs, ReadContext &context)
+{
+    int x = child->IntAttribute("x"); // Get the x-coordinate of the rectangle
+    int y = child->IntAttribute("y"); // Get the y-coordinate of the rectangle
+    int width = child->IntAttribute("width"); // Get the width of the rectangle
+    int height = child->IntAttribute("height"); // Get the height of the rectangle
+    Rect* e = new Rect(x, y, readColor(attrs.fill), width, height);
+    e->set_gradient(readGradient(attrs.fill, e->bounding_box(), context));
+    return e;
+}
+
+/**
+ * @brief An element type: its tag, and the factory building it.
+ */
+struct ElementType
+{
+    const char* tag;
+    ElementFactory factory;
+};
+
+/**
+ * @brief The element types readGroup knows. To support a new element, write its
+ * factory and add it here (the tag hash must stay collision-free, which is
+ * checked at compile time).
+ */
+constexpr ElementType ELEMENT_TYPES[] = {
+    {"g", readG},
+    {"use", readUse},
+    {"ellipse", readEllipse},
+    {"circle", readCircle},
+    {"polyline", readPolyline},
+    {"line", readLine},
+    {"polygon", readPolygon},
+    {"path", readPath},
+    {"rect", readRect},
+};
+constexpr size_t ELEMENT_TYPE_COUNT = sizeof(ELEMENT_TYPES) / sizeof(ELEMENT_TYPES[0]);
+
+/**
+ * @brief Tag hash, perfect over the registered tags: the first character and
+ * the length select one of TAG_SLOTS slots.
+ */
+constexpr size_t TAG_SLOTS = 32;
+constexpr size_t tagLength(const char* tag)
+{
+    return *tag ? 1 + tagLength(tag + 1) : 0;
+}
+constexpr size_t tagSlot(const char* tag, size_t length)
+{
+    return ((unsigned char)tag[0] + 14 * length) % TAG_SLOTS;
+}
+constexpr size_t typeSlot(size_t i)
+{
+    return tagSlot(ELEMENT_TYPES[i].tag, tagLength(ELEMENT_TYPES[i].tag));
+}
+constexpr bool slotsDistinct(size_t i, size_t j)
+{
+    return i >= ELEMENT_TYPE_COUNT ? true
+         : j >= ELEMENT_TYPE_COUNT ? slotsDistinct(i + 1, i + 2)
+         : typeSlot(i) != typeSlot(j) && slotsDistinct(i, j + 1);
+}
+static_assert(slotsDistinct(0, 1), "two element tags share a hash slot: change tagSlot");
 
-    else if (strcmp(element_name, "line") == 0)
+/**
+ * @brief Finds the factory of a tag, with one hash and one string comparison.
+ *
+ * @param tag The element tag.
+ * @return The factory, or nullptr for tags that make no element.
+ */
+ElementFactory findFactory(const char* tag)
+{
+    struct SlotTable
     {
-        // Handle <line> elements
-        int x1 = child->IntAttribute("x1"); // Get the x-coordinate of the start point
-        int y1 = child->IntAttribute("y1"); // Get the y-coordinate of the start point
-        int x2 = child->IntAttribute("x2"); // Get the x-coordinate of the end point
-        int y2 = child->IntAttribute("y2"); // Get the y-coordinate of the end point
-        string stroke_color = child->Attribute("stroke"); // Get the stroke color
-
-        Line* e = new Line(x1, y1, x2, y2, parse_color(stroke_color)); // Create a new Line
-
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
+        const ElementType* slots[TAG_SLOTS] = {};
+        SlotTable()
+        {
+            for (size_t i = 0; i < ELEMENT_TYPE_COUNT; i++) {
+                slots[typeSlot(i)] = &ELEMENT_TYPES[i];
+            }
         }
+    };
+    static const SlotTable table;
+    size_t length = strlen(tag);
+    if (length == 0) {
+        return nullptr;
+    }
+    const ElementType* type = table.slots[tagSlot(tag, length)];
+    return type && strcmp(type->tag, tag) == 0 ? type->factory : nullptr;
+}
 
-        shapes.push_back(e); // Add the line to the shapes vector
+/**
+ * @brief Clips an element to the <clipPath> a clip-path attribute refers to ("url(#id)").
+ *
+ * The clip region is read once per <clipPath>, in the coordinates of the clipped
+ * elements (clipPathUnits="objectBoundingBox" is not supported), and each clipped
+ * element gets its own copy, transformed with it. Only the fills of the <rect>,
+ * <circle>, <ellipse>, <polygon> and <path> children make the region.
+ *
+ * @param e The element, which the result takes ownership of.
+ * @param clip_path The clip-path attribute.
+ * @param context The document state, holding the clip regions read so far.
+ * @return The clipped element, or e itself if the attribute refers to no <clipPath>.
+ */
+SVGElement* readClip(SVGElement* e, const char* clip_path, ReadContext &context)
+{
+    if (strncmp(clip_path, "url(#", 5) != 0) {
+        return e;
+    }
+    const char* end = strchr(clip_path, ')');
+    string id(clip_path + 5, end ? end : clip_path + strlen(clip_path));
+    auto entry = context.ids.find(IdKey(id.c_str()));
+    if (entry == context.ids.end() || strcmp(entry->second.node->Name(), "clipPath") != 0) {
+        return e;
     }
+    XMLElement* node = entry->second.node;
+    auto it = context.clips.find(node);
+    if (it == context.clips.end()) {
+        // Read the shapes with the numbers they have in document order
+        vector<SVGElement*> shapes;
+        int elements = context.elements;
+        context.elements = entry->second.index;
+        context.in_clip = true;
+        for (XMLElement* child = node->FirstChildElement(); child != nullptr; child = child->NextSiblingElement()) {
+            const char* tag = child->Name();
+            if (strcmp(tag, "rect") == 0 || strcmp(tag, "circle") == 0 || strcmp(tag, "ellipse") == 0 ||
+                strcmp(tag, "polygon") == 0 || strcmp(tag, "path") == 0) {
+                // Not in place: the black copy must not become the shared copy of its id
+                SVGElement* shape = readElement(child, context, false);
+                if (shape) {
+                    shapes.push_back(shape);
+                }
+            } else {
+                context.elements += 1 + countDescendants(child);
+            }
+        }
+        context.in_clip = false;
+        context.elements = elements;
 
-    else if (strcmp(element_name, "polygon") == 0)
-    {
-        // Handle <polygon> elements
-        string points = child->Attribute("points"); // Get the points attribute
-        string fill_color = child->Attribute("fill"); // Get the fill color
+        Group* region = new Group(std::move(shapes));
+        CommonAttributes attrs = readCommonAttributes(node);
+        if (attrs.transform) {
+            applyTransformation(region, attrs.transform, attrs.transform_origin);
+        }
+        it = context.clips.insert({node, unique_ptr<Group>(region)}).first;
+    }
+    return new Clip(e, it->second->clone());
+}
 
-        vector<Point> points_vec; // Vector to store the points
-        stringstream ss(points); // Create a stringstream from the points string
-        string point;
+/**
+ * @brief Reads an SVG element, and the elements it contains, applying transformations if necessary.
+ *
+ * @param child Pointer to the XML element.
+ * @param context The document state, used for resolving references.
+ * @param in_place True if the element is read where it is in the document (and not to
+ *        resolve a reference): if it is referenced, its shared copy is made from it.
+ * @return The new element, or nullptr if the node makes none.
+ */
+SVGElement* readElement(XMLElement *child, ReadContext &context, bool in_place) {
+    const char* element_name = child->Name(); // Get the name of the current XML element
+    int line = child->GetLineNum(); // Source position of the element
+    int index = ++context.elements;
+    Profiler* profiler = context.profiler;
+    if (profiler) {
+        profiler->begin(Profiler::PARSE, line, index, element_name, child->Attribute("id"));
+    }
 
-        // Parse the points attribute into individual points
-        while (getline(ss, point, ' '))
-        {
-            size_t pos = point.find(',');
-            if (pos != string::npos)
-            {
-                int x = stoi(point.substr(0, pos)); // Extract x-coordinate
-                int y = stoi(point.substr(pos + 1)); // Extract y-coordinate
-                points_vec.push_back({x, y}); // Add the point to the vector
+    ElementFactory factory = findFactory(element_name);
+    if (factory != readG) {
+        // Keep the numbering in document order past the elements not read
+        context.elements += countDescendants(child);
+    }
+    SVGElement* e = nullptr;
+    if (factory) {
+        CommonAttributes attrs = readCommonAttributes(child);
+        if (context.in_clip) {
+            // Only the geometry of clip shapes counts
+            attrs.fill = "black";
+            attrs.stroke = attrs.clip_path = nullptr;
+        }
+
+        // A referenced element is open while it is read, to catch references to itself.
+        // Its shared copy is never made from a clip shape, which has lost its paint.
+        IdEntry* entry = nullptr;
+        if (attrs.id && !context.in_clip) {
+            auto it = context.ids.find(IdKey(attrs.id));
+            if (it != context.ids.end() && it->second.node == child && it->second.referenced &&
+                !it->second.resolved) {
+                entry = &it->second;
+                entry->open = true;
+                context.open.push_back(entry);
             }
         }
 
-        Polygon* e = new Polygon(points_vec, parse_color(fill_color)); // Create a new Polygon
+        e = factory(child, attrs, context);
+        if (e && attrs.clip_path) {
+            // Clip before the transform, which moves the region too
+            e = readClip(e, attrs.clip_path, context);
+        }
+        if (e) {
+            // Apply transformation if the attribute is present
+            if (attrs.transform) {
+                if (profiler) {
+                    profiler->begin(Profiler::TRANSFORM, line, index);
+                }
+                applyTransformation(e, attrs.transform, attrs.transform_origin);
+                if (profiler) {
+                    profiler->end();
+                }
+            }
 
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
+            // Give the new element its id, if it has one, and its source position
+            if (attrs.id) {
+                e->set_id(attrs.id);
+            }
+            e->set_source(line, index);
         }
 
-        shapes.push_back(e); // Add the polygon to the shapes vector
+        if (entry) {
+            entry->open = false;
+            context.open.pop_back();
+            if (in_place) {
+                // Copy it now, before the transforms of its ancestors apply
+                entry->source = e ? make_shared<Use::Source>(e->clone()) : nullptr;
+                entry->resolved = true;
+            }
+        }
+    }
+    if (profiler) {
+        profiler->end();
     }
+    return e;
+}
 
-    else if (strcmp(element_name, "rect") == 0)
-    {
-        // Handle <rect> elements
-        int x = child->IntAttribute("x"); // Get the x-coordinate of the rectangle
-        int y = child->IntAttribute("y"); // Get the y-coordinate of the rectangle
-        string fill_color = child->Attribute("fill"); // Get the fill color
-        int width = child->IntAttribute("width"); // Get the width of the rectangle
-        int height = child->IntAttribute("height"); // Get the height of the rectangle
-
-        Rect* e = new Rect(x, y, parse_color(fill_color), width, height); // Create a new Rect
-
-        // Apply transformation if the attribute is present
-        if (istransform) {
-            applyTransformation(e, transform_attr, transform_origin);
+/**
+ * @brief Gets the shared copy of a referenced element, reading it from the document
+ * if it has not been read yet.
+ *
+ * @param entry The referenced element.
+ * @param context The document state.
+ * @return The copy, or nullptr if the element makes none or is on a reference cycle.
+ */
+shared_ptr<Use::Source> resolveReference(IdEntry &entry, ReadContext &context)
+{
+    if (entry.open) {
+        // The element would contain itself: every element from it to the innermost
+        // one being read is on the cycle, and none of them can be referenced
+        auto it = find(context.open.begin(), context.open.end(), &entry);
+        for (; it != context.open.end(); ++it) {
+            (*it)->cyclic = true;
         }
+        return nullptr;
+    }
+    if (!entry.resolved) {
+        // Read it again, with the numbers it has in document order
+        int elements = context.elements;
+        context.elements = entry.index - 1;
+        SVGElement* e = readElement(entry.node, context, false);
+        context.elements = elements;
+        entry.source = e ? make_shared<Use::Source>(e) : nullptr;
+        entry.resolved = true;
+    }
+    return entry.cyclic ? nullptr : entry.source;
+}
 
-        shapes.push_back(e); // Add the rectangle to the shapes vector
+/**
+ * @brief Reads an SVG element, and the elements it contains, applying transformations if necessary.
+ *
+ * @param child Pointer to the XML element.
+ * @param shapes Vector of pointers to SVGElement objects where the parsed element will be stored.
+ * @param context The document state, used for resolving references.
+ */
+void readGroup(XMLElement *child, vector<SVGElement*> &shapes, ReadContext &context) {
+    SVGElement* e = readElement(child, context, true);
+    if (e) {
+        shapes.push_back(e);
     }
 }
 
+/**
+ * @brief Reads the elements of a parsed SVG document.
+ *
+ * @param doc The parsed document.
+ * @param dimensions A Point object to store the dimensions (width and height) of the SVG.
+ * @param svg_elements A vector to store pointers to the extracted SVGElement objects.
+ * @param profiler Receives the parse and transform cost of each element, if not null.
+ */
+void readDocument(XMLDocument& doc, Point& dimensions, vector<SVGElement *>& svg_elements, Profiler* profiler)
+{
+    XMLElement *xml_elem = doc.RootElement();
+
+    // Read the dimensions of the SVG from the "width" and "height" attributes of the root element
+    dimensions.x = xml_elem->IntAttribute("width");
+    dimensions.y = xml_elem->IntAttribute("height");
+
+    // Create the reading state, with the elements of the document by id
+    ReadContext context;
+    context.profiler = profiler;
+    context.dimensions = dimensions;
+    indexIds(xml_elem, context);
+
+    // Iterate over all child elements of the root element
+    for (XMLElement *child = xml_elem->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+    {
+        // Read the group of SVG elements
+        readGroup(child, svg_elements, context);
+    }
+}
 
 /**
  * @brief Reads an SVG file and extracts its dimensions and elements.
  *
  * This function loads an SVG file, reads its dimensions (width and height),
  * and extracts its elements into a vector. It also keeps track of elements by their IDs.
+ * The file is memory-mapped and parsed straight from the mapping (tinyxml2 makes its
+ * single working copy from there), and recently used mappings are shared between calls.
+ * Gzip-compressed files (.svgz) are inflated into memory first.
  *
  * @param svg_file The path to the SVG file to be read.
  * @param dimensions A Point object to store the dimensions (width and height) of the SVG.
  * @param svg_elements A vector to store pointers to the extracted SVGElement objects.
+ * @param profiler Receives the parse and transform cost of each element, if not null.
  *
  */
-void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements)
+void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements, Profiler* profiler)
 {
     XMLDocument doc;
-    XMLError r = doc.LoadFile(svg_file.c_str());
+    shared_ptr<const MappedFile> file = MappedFile::open(svg_file);
+    XMLError r;
+    if (is_gzip(file->data(), file->size()))
+    {
+        // .svgz: inflate into memory and parse from there
+        vector<char> text = gunzip(file->data(), file->size());
+        r = doc.Parse(text.empty() ? "" : text.data(), text.size());
+    }
+    else
+    {
+        r = doc.Parse(file->size() > 0 ? file->data() : "", file->size());
+    }
 
     if (r != XML_SUCCESS)
     {
         throw runtime_error("Unable to load " + svg_file);
     }
+    readDocument(doc, dimensions, svg_elements, profiler);
+}
 
-    XMLElement *xml_elem = doc.RootElement();
-
-    // Read the dimensions of the SVG from the "width" and "height" attributes of the root element
-    dimensions.x = xml_elem->IntAttribute("width");
-    dimensions.y = xml_elem->IntAttribute("height");
-
-    // Create a map to store SVG elements by their IDs
-    unordered_map<string, SVGElement*> id_map; 
-
-    // Iterate over all child elements of the root element
-    for (XMLElement *child = xml_elem->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+/**
+ * @brief Reads an SVG document held in memory (gzip-compressed or not).
+ *
+ * @param data The document text (it need not be null-terminated).
+ * @param size The size of the text in bytes.
+ * @param dimensions A Point object to store the dimensions (width and height) of the SVG.
+ * @param svg_elements A vector to store pointers to the extracted SVGElement objects.
+ * @param profiler Receives the parse and transform cost of each element, if not null.
+ */
+void readSVG(const char* data, size_t size, Point& dimensions, vector<SVGElement *>& svg_elements, Profiler* profiler)
+{
+    if (is_gzip(data, size))
     {
-        // Read the group of SVG elements
-        readGroup(child, svg_elements, id_map);
-        
-        // Get the "id" attribute of the child element
-        const char* element_id = child->Attribute("id");
-        
-        // If the "id" attribute is present
-        if (element_id) {
-            // Add the element to the ID map using the ID as the key and the last element added to the svg_elements list as the value
-            id_map[string(element_id)] = svg_elements.back();
-        }
+        vector<char> text = gunzip(data, size);
+        readSVG(text.data(), text.size(), dimensions, svg_elements, profiler);
+        return;
+    }
+    XMLDocument doc;
+    if (doc.Parse(size > 0 ? data : "", size) != XML_SUCCESS)
+    {
+        throw runtime_error("Unable to parse SVG document");
     }
+    readDocument(doc, dimensions, svg_elements, profiler);
 }
 
-
-
-}
\ No newline at end of file
+}
@@ -1,17 +1,220 @@
 #include "SVGElements.hpp"
+#include "Profiler.hpp"
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+namespace
+{
+    //! Insert a suffix before the file extension: out.png -> out_128.png.
+    std::string with_suffix(const std::string &file, const std::string &suffix)
+    {
+        size_t dot = file.find_last_of('.');
+        size_t slash = file.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        {
+            return file + suffix;
+        }
+        return file.substr(0, dot) + suffix + file.substr(dot);
+    }
+
+    bool ends_with(const std::string &s, const std::string &suffix)
+    {
+        return s.size() > suffix.size() &&
+               s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+}
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    int band_height = 0;
+    int box_filter_max = 0;
+    std::vector<int> sizes;
+    svg::Viewport viewport = {0, 0, 0, 0, 1.0};
+    svg::RenderOptions options;
+    svg::PipelineOptions pipeline;
+    std::string batch_dir;
+    svg::Profiler profiler;
+    int profile_rows = 0;
+    std::string trace_file;
+    bool valid = true;
+    int arg = 1;
+    for (; valid && arg < argc && std::string(argv[arg]).compare(0, 2, "--") == 0; arg++)
+    {
+        std::string option = argv[arg];
+        if (option == "--front-to-back")
+        {
+            options.front_to_back = true;
+            continue;
+        }
+        if (option == "--no-io-uring")
+        {
+            pipeline.io_uring = false;
+            continue;
+        }
+        // The other options take a value.
+        if (arg + 1 >= argc)
+        {
+            valid = false;
+            break;
+        }
+        std::string value = argv[++arg];
+        if (option == "--band")
+        {
+            band_height = std::atoi(value.c_str());
+            valid = band_height > 0;
+        }
+        else if (option == "--sizes")
+        {
+            std::istringstream list(value);
+            std::string size;
+            while (std::getline(list, size, ','))
+            {
+                sizes.push_back(std::atoi(size.c_str()));
+                valid = valid && sizes.back() > 0;
+            }
+        }
+        else if (option == "--viewport")
+        {
+            char sep;
+            std::istringstream spec(value);
+            spec >> viewport.x >> sep >> viewport.y >> sep >> viewport.width >> sep >> viewport.height;
+            if (spec >> sep)
+            {
+                spec >> viewport.scale;
+            }
+            valid = viewport.width > 0 && viewport.height > 0 && viewport.scale > 0;
+        }
+        else if (option == "--box-filter")
+        {
+            box_filter_max = std::atoi(value.c_str());
+        }
+        else if (option == "--threads")
+        {
+            char sep;
+            std::istringstream spec(value);
+            spec >> pipeline.parse_threads >> sep >> pipeline.raster_threads >> sep >> pipeline.encode_threads;
+            valid = !spec.fail() && pipeline.parse_threads > 0 && pipeline.raster_threads > 0 &&
+                    pipeline.encode_threads > 0;
+        }
+        else if (option == "--batch")
+        {
+            batch_dir = value;
+        }
+        else if (option == "--io-depth")
+        {
+            int depth = std::atoi(value.c_str());
+            pipeline.io_depth = depth;
+            valid = depth > 0;
+        }
+        else if (option == "--queue")
+        {
+            int capacity = std::atoi(value.c_str());
+            pipeline.queue_capacity = capacity;
+            valid = capacity > 0;
+        }
+        else if (option == "--profile")
+        {
+            profile_rows = std::atoi(value.c_str());
+            valid = profile_rows > 0;
+        }
+        else if (option == "--trace")
+        {
+            trace_file = value;
+        }
+        else if (option == "--lod")
+        {
+            options.lod_tolerance = std::atof(value.c_str());
+            valid = options.lod_tolerance > 0;
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (valid && !batch_dir.empty() && argc - arg >= 1)
+    {
+        // Batch: out_dir/<name>.png for each in_dir/<name>.svg[z].
+        std::vector<svg::BatchJob> jobs;
+        for (; arg < argc; arg++)
+        {
+            std::string in_file = argv[arg];
+            std::string name = in_file.substr(in_file.find_last_of('/') + 1);
+            name = name.substr(0, name.find_last_of('.'));
+            jobs.push_back({in_file, batch_dir + "/" + name + ".png"});
+        }
+        pipeline.render = options;
+        std::cout << "Performing conversion ... " << jobs.size() << " files --> " << batch_dir << std::endl;
+        svg::convert_batch(jobs, pipeline).print(std::cout);
+        std::cout << "Done!" << std::endl;
+    }
+    else if (!valid || !batch_dir.empty() || argc - arg != 2)
     {
-        std::cout << "Usage: svgtopng in_file.svg out_file.png" << std::endl;
+        std::cout << "Usage: svgtopng [--front-to-back] [--band rows] in_file.svg[z] out_file.png" << std::endl
+                  << "       svgtopng --sizes s1,s2,... [--box-filter max_size] in_file.svg[z] out_file.png" << std::endl
+                  << "         (writes out_file_<s>.png for each longest-side size s)" << std::endl
+                  << "       svgtopng --viewport x,y,w,h[,scale] in_file.svg[z] out_file.png" << std::endl
+                  << "         (renders the w x h window at x,y of the canvas scaled by scale)" << std::endl
+                  << "       svgtopng in_file.svg[z] out_file.svgb   (compile to a binary scene)" << std::endl
+                  << "       svgtopng [--threads parse,raster,encode] [--queue n] - out_%d.png" << std::endl
+                  << "         (converts the concatenated or null-separated SVG documents on stdin)" << std::endl
+                  << "       svgtopng [--threads parse,raster,encode] [--queue n] [--io-depth n] [--no-io-uring]" << std::endl
+                  << "                --batch out_dir in_file.svg[z]...   (writes out_dir/in_file.png for each)" << std::endl
+                  << "       --lod pixels simplifies shapes within that many pixels (e.g. for thumbnails)" << std::endl
+                  << "       --profile n prints the n costliest elements of a single-file conversion," << std::endl
+                  << "       --trace file.json writes its timeline (chrome://tracing format)" << std::endl;
     }
     else
     {
-        std::cout << "Performing conversion ... " << argv[1] << " --> " << argv[2] << std::endl;
-        svg::convert(argv[1], argv[2]);
+        std::string in_file = argv[arg], out_file = argv[arg + 1];
+        if (profile_rows > 0 || !trace_file.empty())
+        {
+            options.profiler = &profiler;
+        }
+        std::cout << "Performing conversion ... " << in_file << " --> " << out_file << std::endl;
+        if (in_file == "-")
+        {
+            pipeline.render = options;
+            svg::convert_stream(std::cin, out_file, pipeline).print(std::cout);
+        }
+        else if (ends_with(out_file, ".svgb"))
+        {
+            svg::compile_svgb(in_file, out_file);
+        }
+        else if (!sizes.empty())
+        {
+            std::vector<svg::SizedOutput> outputs;
+            for (int size : sizes)
+            {
+                outputs.push_back({size, with_suffix(out_file, "_" + std::to_string(size))});
+            }
+            svg::convert_sizes(in_file, outputs, box_filter_max, options);
+        }
+        else if (viewport.width > 0)
+        {
+            svg::convert_viewport(in_file, out_file, viewport, options);
+        }
+        else if (band_height > 0)
+        {
+            svg::convert_banded(in_file, out_file, band_height, options);
+        }
+        else
+        {
+            svg::convert(in_file, out_file, options);
+        }
+        if (profile_rows > 0)
+        {
+            profiler.print_top(std::cout, profile_rows);
+        }
+        if (!trace_file.empty())
+        {
+            std::ofstream trace(trace_file);
+            profiler.write_trace(trace);
+        }
         std::cout << "Done!" << std::endl;
     }
     return 0;
-}
\ No newline at end of file
+}
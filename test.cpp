@@ -1,9 +1,14 @@
 
 // Project file headers
 #include "SVGElements.hpp"
+#include "SpatialIndex.hpp"
+#include "Profiler.hpp"
+#include "SceneStats.hpp"
+#include "Gzip.hpp"
 
 // C++ library headers
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <cassert>
 #include <iostream>
@@ -12,6 +17,11 @@
 #include <vector>
 #include <iterator>
 #include <fstream>
+#include <sstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
 using namespace std;
 
 // POSIX headers
@@ -20,6 +30,35 @@ using namespace std;
 #include <sys/wait.h>
 #include <dirent.h>
 
+// Counting allocator, for the allocation budgets of element construction
+// (see check_allocations).
+namespace
+{
+    thread_local size_t allocations = 0;
+}
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocations++;
+    return malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
 namespace svg
 {
     const string LOG_FILE_NAME = "test_log.txt";
@@ -33,14 +72,44 @@ namespace svg
         int failed_tests = 0;
         FILE *log_stream;
 
-        bool run_conversion_test(const string &id)
+        bool compare_images(const string &exp_file, const string &out_file)
         {
-            string svg_file = root_path + "/input/" + id + ".svg";
-            string exp_file = root_path + "/expected/" + id + ".png";
-            string out_file = root_path + "/output/" + id + ".png";
-            convert(svg_file, out_file);
-            PNGImage img1(exp_file), img2(out_file);
-            int w1 = img1.width(), h1 = img1.height(),
+            return compare_window(exp_file, out_file, {0, 0}, {-1, -1});
+        }
+
+        // Expected image, loaded once per test with its dirty spans trimmed.
+        const PNGImage &expected_image(const string &exp_file)
+        {
+            static string cached_file;
+            static unique_ptr<PNGImage> cached;
+            if (cached == nullptr || cached_file != exp_file)
+            {
+                cached.reset(new PNGImage(exp_file));
+                cached->trim_dirty_spans();
+                cached_file = exp_file;
+            }
+            return *cached;
+        }
+
+        // Compare an output file against a window of the expected image
+        // (a negative size means the whole expected image). A loaded
+        // image starts with every pixel in its spans, so trimming them
+        // scans its rows once.
+        bool compare_window(const string &exp_file, const string &out_file,
+                            const Point &offset, const Point &size)
+        {
+            PNGImage img2(out_file);
+            img2.trim_dirty_spans();
+            return compare_window(expected_image(exp_file), img2, offset, size);
+        }
+
+        // Compare an image against a window of the expected image. Only
+        // the dirty spans of each row are compared: pixels outside both
+        // images' spans are white in both.
+        bool compare_window(const PNGImage &img1, const PNGImage &img2,
+                            const Point &offset, const Point &size)
+        {
+            int w1 = size.x < 0 ? img1.width() : size.x, h1 = size.y < 0 ? img1.height() : size.y,
                 w2 = img2.width(), h2 = img2.height();
             if (w1 != w2 || h1 != h2)
             {
@@ -49,11 +118,29 @@ namespace svg
                           << w2 << "x" << h2 << endl;
                 return false;
             }
-            for (int i = 0; i < w1; i++)
+            for (int j = 0; j < h1; j++)
             {
-                for (int j = 0; j < h1; j++)
+                int x0 = w1, x1 = -1, e0, e1;
+                if (img1.dirty_span(offset.y + j, e0, e1))
+                {
+                    x0 = max(0, e0 - offset.x);
+                    x1 = min(w1 - 1, e1 - offset.x);
+                }
+                if (img2.dirty_span(j, e0, e1))
+                {
+                    x0 = min(x0, e0);
+                    x1 = max(x1, e1);
+                }
+                if (x0 > x1 || equal(img2.row(j) + x0, img2.row(j) + x1 + 1, img1.row(offset.y + j) + offset.x + x0,
+                                     [](const Color &c1, const Color &c2) {
+                                         return c1.red == c2.red && c1.green == c2.green && c1.blue == c2.blue;
+                                     }))
                 {
-                    Color c1 = img1.at(i, j), c2 = img2.at(i, j);
+                    continue;
+                }
+                for (int i = x0; i <= x1; i++)
+                {
+                    Color c1 = img1.at(offset.x + i, offset.y + j), c2 = img2.at(i, j);
                     if (c1.red != c2.red || c1.green != c2.green || c1.blue != c2.blue)
                     {
                         cout << "pixel (" << i << ' ' << j << "): expected "
@@ -67,6 +154,631 @@ namespace svg
             return true;
         }
 
+        // A gzip length trailer is only a hint: a forged one must neither
+        // size the output nor pass the final length check.
+        bool check_forged_length(const string &svgz_file)
+        {
+            ifstream in(svgz_file, ios::binary);
+            string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            for (uint32_t forged : {0x7fffffffu, 0xffffffffu, 0u})
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    data[data.size() - 4 + i] = (char)(forged >> (8 * i));
+                }
+                try
+                {
+                    gunzip(data.data(), data.size());
+                    cout << "gzip length " << forged << " accepted" << endl;
+                    return false;
+                }
+                catch (const std::runtime_error &)
+                {
+                }
+            }
+            return true;
+        }
+
+        bool run_conversion_test(const string &id)
+        {
+            string svg_file = root_path + "/input/" + id + ".svg";
+            if (::access((svg_file + "z").c_str(), R_OK) == 0)
+            {
+                svg_file += "z";   // gzip-compressed input
+            }
+            string exp_file = root_path + "/expected/" + id + ".png";
+            string out_file = root_path + "/output/" + id + ".png";
+            if (svg_file.back() == 'z' && !check_forged_length(svg_file))
+            {
+                return false;
+            }
+            convert(svg_file, out_file);
+            if (!compare_images(exp_file, out_file))
+            {
+                return false;
+            }
+            // An image drawn in memory tracked its spans while drawing,
+            // so rows it never drew to are not scanned at all.
+            {
+                Point dimensions;
+                vector<SVGElement *> elements;
+                readSVG(svg_file, dimensions, elements);
+                PNGImage drawn(dimensions.x, dimensions.y);
+                for (SVGElement *e : elements)
+                {
+                    e->draw(drawn);
+                    delete e;
+                }
+                cout << "in memory: ";
+                if (!compare_window(expected_image(exp_file), drawn, {0, 0}, {-1, -1}))
+                {
+                    return false;
+                }
+            }
+            // Banded rendering must match, with bands that split shapes.
+            string banded_file = root_path + "/output/" + id + ".banded.png";
+            convert_banded(svg_file, banded_file, 7);
+            cout << "banded: ";
+            if (!compare_images(exp_file, banded_file))
+            {
+                return false;
+            }
+            // So must rendering from the compiled scene.
+            string svgb_file = root_path + "/output/" + id + ".svgb";
+            string svgb_png_file = root_path + "/output/" + id + ".svgb.png";
+            compile_svgb(svg_file, svgb_file);
+            convert(svgb_file, svgb_png_file);
+            cout << "svgb: ";
+            if (!compare_images(exp_file, svgb_png_file))
+            {
+                return false;
+            }
+            // A multi-size conversion must render its native size exactly.
+            const PNGImage &expected = expected_image(exp_file);
+            int native = max(expected.width(), expected.height());
+            string sized_file = root_path + "/output/" + id + ".sized.png";
+            convert_sizes(svg_file, {{native, sized_file},
+                                     {native / 2, root_path + "/output/" + id + ".half.png"},
+                                     {native / 8, root_path + "/output/" + id + ".eighth.png"}},
+                          native / 8);
+            cout << "sizes: ";
+            if (!compare_images(exp_file, sized_file))
+            {
+                return false;
+            }
+            // The half size is rendered at scale 0.5, as a viewport would
+            // be, and the eighth is box-filtered down from the half.
+            {
+                PNGImage half(root_path + "/output/" + id + ".half.png");
+                PNGImage eighth(root_path + "/output/" + id + ".eighth.png");
+                double scale = (double)(native / 2) / native;
+                Viewport window = {0, 0, max(1, (int)lround(expected.width() * scale)),
+                                   max(1, (int)lround(expected.height() * scale)), scale};
+                string half_file = root_path + "/output/" + id + ".half_viewport.png";
+                convert_viewport(svg_file, half_file, window);
+                PNGImage rendered(half_file);
+                half.trim_dirty_spans();
+                rendered.trim_dirty_spans();
+                cout << "half size: ";
+                if (!compare_window(rendered, half, {0, 0}, {-1, -1}))
+                {
+                    return false;
+                }
+                scale = (double)(native / 8) / native;
+                PNGImage filtered = half.downscale(max(1, (int)lround(expected.width() * scale)),
+                                                   max(1, (int)lround(expected.height() * scale)));
+                eighth.trim_dirty_spans();
+                filtered.trim_dirty_spans();
+                cout << "eighth size: ";
+                if (!compare_window(filtered, eighth, {0, 0}, {-1, -1}))
+                {
+                    return false;
+                }
+            }
+            // A viewport must match the same window of the full image.
+            Viewport window = {expected.width() / 3, expected.height() / 4,
+                               max(1, expected.width() / 2), max(1, expected.height() / 2), 1.0};
+            string viewport_file = root_path + "/output/" + id + ".viewport.png";
+            convert_viewport(svg_file, viewport_file, window);
+            cout << "viewport: ";
+            if (!compare_window(exp_file, viewport_file, {window.x, window.y},
+                                {window.width, window.height}))
+            {
+                return false;
+            }
+            // Front-to-back drawing must match painter's order exactly,
+            // both from the SVG and from the compiled scene.
+            RenderOptions front_to_back;
+            front_to_back.front_to_back = true;
+            string ftb_file = root_path + "/output/" + id + ".ftb.png";
+            convert(svg_file, ftb_file, front_to_back);
+            cout << "front-to-back: ";
+            if (!compare_images(exp_file, ftb_file))
+            {
+                return false;
+            }
+            convert(svgb_file, ftb_file, front_to_back);
+            cout << "front-to-back svgb: ";
+            if (!compare_images(exp_file, ftb_file))
+            {
+                return false;
+            }
+            // Profiling must not change the output.
+            Profiler profiler;
+            RenderOptions profiled;
+            profiled.profiler = &profiler;
+            string profiled_file = root_path + "/output/" + id + ".profiled.png";
+            convert(svg_file, profiled_file, profiled);
+            cout << "profiled: ";
+            if (!compare_images(exp_file, profiled_file))
+            {
+                return false;
+            }
+            // So must rendering from memory into a caller buffer with
+            // padded rows, and encoding through callbacks.
+            ifstream svg_in(svg_file, ios::binary);
+            string svg_bytes((istreambuf_iterator<char>(svg_in)), istreambuf_iterator<char>());
+            SVGDocument document(svg_bytes.data(), svg_bytes.size());
+            Point size = document.dimensions();
+            size_t stride = (size_t)size.x * 3 + 5;
+            vector<unsigned char> buffer(stride * size.y, 0);
+            document.render({buffer.data(), size.x, size.y, stride});
+            string memory_file = root_path + "/output/" + id + ".memory.png";
+            {
+                ofstream out(memory_file, ios::binary);
+                encode_png({buffer.data(), size.x, size.y, stride}, [&out](const void *data, size_t n) {
+                    out.write((const char *)data, n);
+                });
+            }
+            cout << "memory buffer: ";
+            if (!compare_images(exp_file, memory_file))
+            {
+                return false;
+            }
+            // The PNG is handed over as it is produced: the signature first,
+            // then each chunk in pieces.
+            vector<size_t> pieces;
+            {
+                ofstream out(memory_file, ios::binary);
+                document.encode_png([&out, &pieces](const void *data, size_t n) {
+                    out.write((const char *)data, n);
+                    pieces.push_back(n);
+                });
+            }
+            cout << "memory encode: ";
+            if (pieces.size() < 8 || pieces[0] != 8 || !compare_images(exp_file, memory_file))
+            {
+                return false;
+            }
+            // Buffers too small for their size must be rejected, not drawn.
+            bool rejected = false;
+            try
+            {
+                document.render({buffer.data(), size.x, size.y, (size_t)size.x * 3 - 1});
+            }
+            catch (const invalid_argument &)
+            {
+                rejected = true;
+            }
+            if (!rejected)
+            {
+                cout << "buffer with short rows accepted" << endl;
+                return false;
+            }
+            // The stream pipeline must match as well, with concatenated and
+            // null-separated documents.
+            if (svg_file.back() != 'z')
+            {
+                ifstream in(svg_file);
+                string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+                istringstream stream(text + text + '\0' + text);
+                PipelineOptions pipeline;
+                pipeline.raster_threads = 2;
+                pipeline.queue_capacity = 1;
+                PipelineReport report = convert_stream(stream, root_path + "/output/" + id + ".stream_%d.png", pipeline);
+                cout << "stream: ";
+                if (report.documents != 3 || !report.errors.empty())
+                {
+                    cout << report.documents << " documents, " << report.errors.size() << " errors" << endl;
+                    return false;
+                }
+                for (int i = 1; i <= 3; i++)
+                {
+                    if (!compare_images(exp_file, root_path + "/output/" + id + ".stream_" + to_string(i) + ".png"))
+                    {
+                        return false;
+                    }
+                }
+            }
+            // So must batch conversion, alternating the I/O engines
+            // across the inputs.
+            PipelineOptions batch;
+            batch.io_uring = id.size() % 2 == 0;
+            string batch_file = root_path + "/output/" + id + ".batch.png";
+            PipelineReport report = convert_batch({{svg_file, batch_file}}, batch);
+            cout << "batch (" << report.io_backend << "): ";
+            if (!report.errors.empty())
+            {
+                cout << report.errors[0] << endl;
+                return false;
+            }
+            if (!compare_images(exp_file, batch_file))
+            {
+                return false;
+            }
+            cout << "index: ";
+            if (!check_index(svg_file))
+            {
+                return false;
+            }
+            cout << "stats: ";
+            return check_stats(svg_file);
+        }
+
+        // Count the elements of a tree, <use> instances excluded.
+        static uint64_t count_elements(SVGElement *e)
+        {
+            if (dynamic_cast<Use *>(e) != nullptr)
+            {
+                return 0;
+            }
+            Clip *clip = dynamic_cast<Clip *>(e);
+            if (clip != nullptr)
+            {
+                return count_elements(clip->getElement());
+            }
+            uint64_t count = 1;
+            Group *g = dynamic_cast<Group *>(e);
+            if (g != nullptr)
+            {
+                for (SVGElement *member : g->getElements())
+                {
+                    count += count_elements(member);
+                }
+            }
+            return count;
+        }
+
+        // The one-pass analyzer must see the elements readSVG builds.
+        bool check_stats(const string &svg_file)
+        {
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(svg_file, dimensions, elements);
+            uint64_t count = 0;
+            for (SVGElement *e : elements)
+            {
+                count += count_elements(e);
+                delete e;
+            }
+            SceneStats stats = analyze_svg(svg_file);
+            if (stats.dimensions.x != dimensions.x || stats.dimensions.y != dimensions.y || stats.drawn_elements != count)
+            {
+                cout << "analyzer counted " << stats.drawn_elements << " elements, readSVG built " << count << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Add the innermost elements, in painter's order.
+        static void leaves(SVGElement *e, vector<SVGElement *> &out)
+        {
+            Group *g = dynamic_cast<Group *>(e);
+            if (g == nullptr)
+            {
+                out.push_back(e);
+                return;
+            }
+            for (SVGElement *member : g->getElements())
+            {
+                leaves(member, out);
+            }
+        }
+
+        // Spatial index queries must match a linear scan.
+        bool check_index(const string &svg_file)
+        {
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(svg_file, dimensions, elements);
+            vector<SVGElement *> all;
+            for (SVGElement *e : elements)
+            {
+                leaves(e, all);
+            }
+            bool ok = true;
+            {
+                SpatialIndex index(elements);
+                for (int y = -3; ok && y < dimensions.y + 3; y += 7)
+                {
+                    for (int x = -3; ok && x < dimensions.x + 3; x += 7)
+                    {
+                        SVGElement *expected = nullptr;
+                        vector<SVGElement *> in_rect;
+                        BoundingBox rect = {{x, y}, {x + 20, y + 10}};
+                        for (SVGElement *e : all)
+                        {
+                            BoundingBox box = e->bounding_box();
+                            if (!box.empty() && box.min.x <= x && x <= box.max.x &&
+                                box.min.y <= y && y <= box.max.y)
+                            {
+                                expected = e;
+                            }
+                            if (box.intersects(rect))
+                            {
+                                in_rect.push_back(e);
+                            }
+                        }
+                        if (index.query_point(x, y) != expected || index.query_rect(rect) != in_rect)
+                        {
+                            cout << "query mismatch at (" << x << ' ' << y << ')' << endl;
+                            ok = false;
+                        }
+                    }
+                }
+            }
+            for (SVGElement *e : elements)
+            {
+                delete e;
+            }
+            return ok;
+        }
+
+        // Build an element and check the allocations it takes against a
+        // budget (the inputs are prepared beforehand, outside the count).
+        bool check_budget(const string &what, size_t budget, const function<SVGElement *()> &make)
+        {
+            size_t before = allocations;
+            SVGElement *e = make();
+            size_t used = allocations - before;
+            delete e;
+            if (used != budget)
+            {
+                cout << what << ": " << used << " allocations, budget " << budget << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Elements take their vertex and child storage by move: building
+        // one allocates the element, plus the vertices it makes itself.
+        bool check_allocations()
+        {
+            const Color c = {10, 20, 30};
+            bool ok = true;
+            ok &= check_budget("ellipse", 1, [&] { return new Ellipse(c, {5, 5}, {3, 2}); });
+            ok &= check_budget("circle", 1, [&] { return new Circle(c, {5, 5}, 3); });
+            ok &= check_budget("line", 2, [&] { return new Line(0, 0, 9, 9, c); });
+            ok &= check_budget("rect", 2, [&] { return new Rect(1, 1, c, 8, 4); });
+            vector<Point> polyline_points = {{0, 0}, {4, 8}, {8, 0}};
+            ok &= check_budget("polyline", 1, [&] { return new Polyline(std::move(polyline_points), c); });
+            vector<Point> polygon_points = {{0, 0}, {4, 8}, {8, 0}};
+            ok &= check_budget("polygon", 1, [&] { return new Polygon(std::move(polygon_points), c); });
+            vector<SVGElement *> members = {new Rect(1, 1, c, 8, 4), new Circle(c, {5, 5}, 3)};
+            ok &= check_budget("group", 1, [&] { return new Group(std::move(members)); });
+            shared_ptr<Use::Source> source = make_shared<Use::Source>(new Rect(1, 1, c, 8, 4));
+            ok &= check_budget("use", 1, [&] { return new Use(source); });
+
+            // A copy owns its storage: group, child vector, and each member.
+            Group group({new Rect(1, 1, c, 8, 4), new Circle(c, {5, 5}, 3)});
+            ok &= check_budget("rect copy", 2, [&] { return group.getElements()[0]->clone(); });
+            ok &= check_budget("group copy", 5, [&] { return group.clone(); });
+            return ok;
+        }
+
+        // Level-of-detail simplification is off by default, and when on
+        // it must drop vertices while keeping every changed pixel within
+        // the tolerance (plus one pixel of rounding) of the exact outline.
+        bool check_lod()
+        {
+            // A 180-gon, a fine zigzag, and triangles that fall within a
+            // pixel at half scale.
+            ostringstream svg;
+            svg << "<svg width=\"200\" height=\"200\" xmlns=\"http://www.w3.org/2000/svg\">\n<polygon points=\"";
+            for (int i = 0; i < 180; i++)
+            {
+                double a = i * M_PI / 90;
+                svg << lround(100 + 80 * cos(a)) << ',' << lround(100 + 80 * sin(a)) << ' ';
+            }
+            svg << "\" fill=\"blue\"/>\n<polyline points=\"";
+            for (int x = 10; x <= 190; x += 2)
+            {
+                svg << x << ',' << 15 + (x / 2) % 2 << ' ';
+            }
+            svg << "\" stroke=\"red\" fill=\"none\"/>\n";
+            for (int x = 20; x < 180; x += 20)
+            {
+                svg << "<polygon points=\"" << x << ",190 " << x + 1 << ",190 " << x << ",191\" fill=\"green\"/>\n";
+            }
+            svg << "</svg>";
+            const string text = svg.str();
+            SVGDocument document(text.data(), text.size());
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(text.data(), text.size(), dimensions, elements);
+            const double tolerance = 1.5;
+            Profiler exact_profiler, lod_profiler;
+            PNGImage exact(100, 100, {0, 0}, 0.5), simplified(100, 100, {0, 0}, 0.5);
+            exact.set_profiler(&exact_profiler);
+            simplified.set_profiler(&lod_profiler);
+            simplified.set_lod_tolerance(tolerance);
+            for (SVGElement *e : elements)
+            {
+                e->draw(exact);
+                e->draw(simplified);
+                delete e;
+            }
+
+            // Off by default, so the default render is the exact one.
+            vector<unsigned char> buffer(100 * 100 * 3);
+            document.render({buffer.data(), 100, 100, 300}, {0, 0}, 0.5);
+            PNGImage by_default((Color *)buffer.data(), 100, 100, 300);
+            if (PNGImage(1, 1).lod_tolerance() != 0 || RenderOptions().lod_tolerance != 0 ||
+                !compare_window(exact, by_default, {0, 0}, {-1, -1}))
+            {
+                cout << "level of detail is not off by default" << endl;
+                return false;
+            }
+
+            if (simplified.vertices_processed() >= exact.vertices_processed())
+            {
+                cout << "no vertices dropped: " << simplified.vertices_processed() << " of "
+                     << exact.vertices_processed() << endl;
+                return false;
+            }
+
+            // The exact outline: pixels with a neighbour of another colour.
+            auto same = [](const Color &a, const Color &b) {
+                return a.red == b.red && a.green == b.green && a.blue == b.blue;
+            };
+            vector<Point> outline;
+            for (int y = 0; y < 100; y++)
+            {
+                for (int x = 0; x < 100; x++)
+                {
+                    Color c = exact.at(x, y);
+                    if ((x > 0 && !same(c, exact.at(x - 1, y))) || (x < 99 && !same(c, exact.at(x + 1, y))) ||
+                        (y > 0 && !same(c, exact.at(x, y - 1))) || (y < 99 && !same(c, exact.at(x, y + 1))))
+                    {
+                        outline.push_back({x, y});
+                    }
+                }
+            }
+            int differing = 0;
+            double bound = tolerance + 1;
+            for (int y = 0; y < 100; y++)
+            {
+                for (int x = 0; x < 100; x++)
+                {
+                    if (same(exact.at(x, y), simplified.at(x, y)))
+                    {
+                        continue;
+                    }
+                    differing++;
+                    bool near = false;
+                    for (const Point &p : outline)
+                    {
+                        near |= (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y) <= bound * bound;
+                    }
+                    if (!near)
+                    {
+                        cout << "pixel " << x << "," << y << " is farther than " << bound
+                             << " pixels from the exact outline" << endl;
+                        return false;
+                    }
+                }
+            }
+            cout << "lod: " << simplified.vertices_processed()
+                 << " of " << exact.vertices_processed() << " vertices, " << differing
+                 << " pixels differ" << endl;
+            return differing > 0;
+        }
+
+        // A multi-size conversion must throw, not terminate, when an
+        // encoder fails or the SVG has no size to scale.
+        bool check_size_errors()
+        {
+            string svg_file = root_path + "/input/rect_1.svg";
+            try
+            {
+                convert_sizes(svg_file, {{64, root_path + "/output/size_errors.png"},
+                                         {32, root_path + "/no_such_dir/size_errors.png"}});
+                cout << "unwritable output accepted" << endl;
+                return false;
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+            string empty_file = root_path + "/output/size_errors.svg";
+            ofstream(empty_file) << "<svg width=\"0\" height=\"0\" xmlns=\"http://www.w3.org/2000/svg\"/>";
+            try
+            {
+                convert_sizes(empty_file, {{64, root_path + "/output/size_errors.png"}});
+                cout << "SVG without a size accepted" << endl;
+                return false;
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+            return true;
+        }
+
+        // The profile must charge the cost of a known input to its
+        // costliest element, and the trace must close every event inside
+        // the event that encloses it.
+        bool check_profile()
+        {
+            const string svg = "<svg width=\"1000\" height=\"1000\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+                               "<circle cx=\"5\" cy=\"5\" r=\"2\" fill=\"red\"/>\n"
+                               "<polygon id=\"big\" points=\"0,0 999,0 999,999 0,999\" fill=\"blue\"/>\n"
+                               "<rect x=\"1\" y=\"1\" width=\"3\" height=\"3\" fill=\"green\"/>\n"
+                               "</svg>";
+            Profiler profiler;
+            Point dimensions;
+            vector<SVGElement *> elements;
+            readSVG(svg.data(), svg.size(), dimensions, elements, &profiler);
+            PNGImage img(dimensions.x, dimensions.y);
+            img.set_profiler(&profiler);
+            for (SVGElement *e : elements)
+            {
+                draw_element(*e, img);
+                delete e;
+            }
+
+            // Header, column names, then the costliest element.
+            ostringstream top;
+            profiler.print_top(top, 1);
+            istringstream lines(top.str());
+            string line;
+            getline(lines, line);
+            getline(lines, line);
+            getline(lines, line);
+            double times[5];
+            uint64_t draws = 0, pixels = 0, vertices = 0;
+            istringstream row(line);
+            row >> times[0] >> times[1] >> times[2] >> times[3] >> times[4] >> draws >> pixels >> vertices;
+            if (line.find("<polygon> line 3 #big") == string::npos || draws != 1 || pixels == 0 || vertices == 0)
+            {
+                cout << "unexpected top element: " << line << endl;
+                return false;
+            }
+
+            // Events are written in the order they began.
+            ostringstream trace;
+            profiler.write_trace(trace);
+            string json = trace.str();
+            vector<double> ends;     // end times of the enclosing events
+            size_t count = 0;
+            for (size_t pos = json.find("\"ts\":"); pos != string::npos; pos = json.find("\"ts\":", pos + 1))
+            {
+                size_t dur = json.find("\"dur\":", pos);
+                if (dur == string::npos)
+                {
+                    cout << "trace event without a duration" << endl;
+                    return false;
+                }
+                double start = atof(json.c_str() + pos + 5), end = start + atof(json.c_str() + dur + 6);
+                const double rounding = 0.002;
+                while (!ends.empty() && start >= ends.back() - rounding)
+                {
+                    ends.pop_back();
+                }
+                if (end < start || (!ends.empty() && end > ends.back() + rounding))
+                {
+                    cout << "trace event " << count << " ends outside its parent" << endl;
+                    return false;
+                }
+                ends.push_back(end);
+                count++;
+            }
+            if (count != profiler.events() || count == 0)
+            {
+                cout << "trace has " << count << " events, profiler " << profiler.events() << endl;
+                return false;
+            }
+            return true;
+        }
+
         void onTestBegin(const string &id)
         {
             total_tests++;
@@ -88,7 +800,7 @@ namespace svg
             }
         }
 
-        void run_test(const string& id)
+        void run_test(const string& id, const function<bool()> &test)
         {
             int log_fd = ::fileno(log_stream);
             onTestBegin(id);
@@ -99,7 +811,7 @@ namespace svg
             
                 ::dup2(log_fd, 1);
                 ::dup2(log_fd, 2);
-                bool success = run_conversion_test(id);
+                bool success = test();
                 ::exit(success ? 0 : 1);
             }
             else if (pid > 0)
@@ -150,17 +862,36 @@ namespace svg
                 }
             }
             ::closedir(directory);
-            if (scripts_to_execute.empty())
+            // Checks that take no input file, run when their name matches.
+            const vector<pair<string, function<bool()>>> named_checks = {
+                {"allocations", [this] { return check_allocations(); }},
+                {"profile", [this] { return check_profile(); }},
+                {"size_errors", [this] { return check_size_errors(); }},
+                {"lod", [this] { return check_lod(); }}};
+            vector<size_t> checks_to_execute;
+            for (size_t i = 0; i < named_checks.size(); i++)
+            {
+                if (named_checks[i].first.find(spec) == 0)
+                {
+                    checks_to_execute.push_back(i);
+                }
+            }
+            if (scripts_to_execute.empty() && checks_to_execute.empty())
             {
                 cout << "No scripts matched the spec: " << spec << endl;
                 return;
             }
             sort(scripts_to_execute.begin(), scripts_to_execute.end());
 
-            cout << "== " << scripts_to_execute.size() << " tests to execute  ==" << endl;
+            cout << "== " << scripts_to_execute.size() + checks_to_execute.size()
+                 << " tests to execute  ==" << endl;
             for (string id : scripts_to_execute)
             {
-                run_test(id);
+                run_test(id, [&] { return run_conversion_test(id); });
+            }
+            for (size_t i : checks_to_execute)
+            {
+                run_test(named_checks[i].first, named_checks[i].second);
             }
 
             cout << "== TEST EXECUTION SUMMARY ==" << endl
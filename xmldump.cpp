@@ -1,8 +1,10 @@
 #include "external/tinyxml2/tinyxml2.h"
+#include "SceneStats.hpp"
 
 using namespace tinyxml2;
 
 #include <iostream>
+#include <string>
 
 void dump(XMLElement *elem, int indentation)
 {
@@ -24,9 +26,15 @@ void dump(XMLElement *elem, int indentation)
 int main(int argc, char **argv)
 {
     XMLDocument doc;
-    if (argc != 2)
+    if (argc == 3 && std::string(argv[1]) == "--stats")
     {
-        std::cout << "Usage: xmldump filename";
+        // Pre-flight cost estimate, in one pass without building a tree.
+        svg::analyze_svg(argv[2]).print(std::cout);
+    }
+    else if (argc != 2)
+    {
+        std::cout << "Usage: xmldump filename" << std::endl
+                  << "       xmldump --stats filename.svg[z]   (element counts and cost estimates)" << std::endl;
     }
     else
     {
@@ -34,4 +42,4 @@ int main(int argc, char **argv)
         dump(doc.RootElement(), 0);
     }
     return 0;
-}
\ No newline at end of file
+}